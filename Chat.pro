@@ -1,4 +1,6 @@
 TEMPLATE = subdirs
 
 SUBDIRS += Client \
-    Server
+    Server \
+    LoadGen \
+    Tests
@@ -1,9 +1,17 @@
 #include "ChatDialogListModel.h"
-#include "Connection.h"
+#include "NetworkThread.h"
+#include "Protocol.h"
+#include <QAbstractSocket>
 #include <QDateTime>
+#include <QGuiApplication>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QSizeF>
 #include <QTextDocument>
+#include <QTimer>
+
+// строк за один fetchMore, из кэша или с сервера
+static const int FetchPageSize = 50;
 
 //-----------------------------------------------------------------------//
 //  ChatDialogListModel::Pimpl                                           //
@@ -12,27 +20,67 @@
 class ChatDialogListModel::Pimpl {
 public:
     Pimpl(ChatDialogListModel* parent);
-    void appendMessage(const QString &login, const QString &ip, qint32 port, const QString &message,
-                       ChatDialogListModel::MessageType type = MESSAGETYPE_TEXT);
     void setNameError(bool error);
     void clearData();
+    void append(const QList<Item>& items);
+    void stage(const Item& item);
+    void flushStaged();
+    void prepend(const QList<Item>& items);
+    void evict();
+    bool hasOlder() const;
+    void setRoom(const QString& room);
+    void setPageRequested(bool requested);
+    void invalidatePresentation();
 public:
+    struct Presentation {
+        quint32 generation = 0; /*!< 0 — ещё не заполнено */
+        QString message; /*!< Текст с подсвеченным ником */
+        QString time;
+        bool mine = false;
+        quint32 layoutGeneration = 0; /*!< Раскладка QTextDocument дорогая, считается отдельно */
+        QSizeF sizeHint; /*!< Размер текста без переносов */
+        bool empty = false;
+    };
     struct Item {
+        qint64 seq = 0;
         QString ip;
         quint16 port = 0;
         QString name;
         QString message;
-        QDateTime dateTime;
+        qint64 timestamp = 0; /*!< мс от эпохи, строка собирается только для отображения */
         ChatDialogListModel::MessageType type = ChatDialogListModel::MESSAGETYPE_TEXT;
+        Presentation view;
     };
+    const Presentation& presentation(int row);
+    const Presentation& layout(int row);
+    void processEvent(const ChatEvent& event);
+    void processState(QAbstractSocket::SocketState socketState);
+    static qint64 firstSequence(const QList<Item>& items);
+    static Item textItem(const ChatMessage& msg);
+    static Item participantItem(const QJsonObject& participant, const QString& format);
+    static Item notification(const QString& message);
+public:
     QList<Item> m_data;
-    Connection* m_connection = nullptr;
+    QList<Item> m_evicted; /*!< Вытесненные из окна строки, от старых к новым */
+    QList<Item> m_staged; /*!< Пришедшие строки, которые вставятся одной пачкой */
+    QTimer* m_flushTimer = nullptr;
+    int m_stagedTexts = 0;
+    QString m_lastLogin;
+    QString m_lastText;
+    NetworkThread* m_network = nullptr;
     QJsonArray m_peers;
     QString m_myNickName;
+    QString m_room;
     ChatDialogListModel* m_parent = nullptr;
     QString m_accent = QLatin1String("#00B8D4");
     ChatDialogListModel::ConnectionState m_state = ChatDialogListModel::STATE_UNCONNECTED;
     bool m_nameError = false;
+    int m_windowSize = 500;
+    int m_batchInterval = 16;
+    bool m_pageRequested = false;
+    bool m_viewAtTop = false;
+    qint64 m_oldestSequence = 0; /*!< Номер самого старого сообщения в окне, 0 — нет номеров */
+    quint32 m_generation = 1; /*!< Меняется при смене ника или цвета, сбрасывая кэш всех строк */
 };
 
 ChatDialogListModel::Pimpl::Pimpl(ChatDialogListModel *parent) :
@@ -40,26 +88,6 @@ ChatDialogListModel::Pimpl::Pimpl(ChatDialogListModel *parent) :
 {
 }
 
-void ChatDialogListModel::Pimpl::appendMessage(const QString &login, const QString &ip, qint32 port, const QString &message, ChatDialogListModel::MessageType type)
-{
-    if ( login.isEmpty() || message.isEmpty())
-        return;
-
-    m_parent->beginInsertRows(QModelIndex(), m_parent->rowCount(), m_parent->rowCount());
-
-    Item newItem;{
-        newItem.ip = ip;
-        newItem.name = login;
-        newItem.port = port;
-        newItem.message = message;
-        newItem.dateTime = QDateTime::currentDateTime();
-        newItem.type = type;
-    }
-
-    m_data.append(newItem);
-    m_parent->endInsertRows();
-}
-
 void ChatDialogListModel::Pimpl::setNameError(bool error)
 {
     if (error != m_nameError) {
@@ -70,6 +98,10 @@ void ChatDialogListModel::Pimpl::setNameError(bool error)
 
 void ChatDialogListModel::Pimpl::clearData()
 {
+    m_evicted.clear();
+    m_staged.clear();
+    m_stagedTexts = 0;
+    m_oldestSequence = 0;
     if (m_parent->rowCount() > 0) {
         m_parent->beginRemoveRows(QModelIndex(),0, m_parent->rowCount()-1);
         m_data.clear();
@@ -77,112 +109,348 @@ void ChatDialogListModel::Pimpl::clearData()
     }
 }
 
-//-----------------------------------------------------------------------//
-//  ChatDialogListModel                                                  //
-//-----------------------------------------------------------------------//
+void ChatDialogListModel::Pimpl::append(const QList<Item> &items)
+{
+    if (items.isEmpty()) {
+        return;
+    }
+    m_parent->beginInsertRows(QModelIndex(), m_data.size(), m_data.size() + items.size() - 1);
+    m_data.append(items);
+    m_parent->endInsertRows();
+    if (m_oldestSequence == 0) {
+        m_oldestSequence = firstSequence(items);
+    }
+    evict();
+}
 
-ChatDialogListModel::ChatDialogListModel(QObject *parent) :
-    QAbstractListModel(parent)
+void ChatDialogListModel::Pimpl::stage(const Item &item)
 {
-    m_d = new Pimpl(this);
-    m_d->m_connection = new Connection(this);
-    connect(m_d->m_connection, &Connection::newMessage,
-            this, [this](const QJsonObject& msg){
-        beginInsertRows(QModelIndex(), rowCount(), rowCount());
-        Pimpl::Item newItem;{
-            newItem.ip = msg.value(QLatin1String("ip")).toString();
-            newItem.name = msg.value(QLatin1String("name")).toString();
-            newItem.port = msg.value(QLatin1String("port")).toInt();
-            newItem.message = msg.value(QLatin1String("message")).toString();
-            newItem.dateTime = QDateTime::fromString(msg.value(QLatin1String("time")).toString(),QLatin1String("dd.MM.yyyy hh:mm:ss"));
-            newItem.type = MESSAGETYPE_TEXT;
+    m_staged.append(item);
+    if (item.type == MESSAGETYPE_TEXT) {
+        ++m_stagedTexts;
+        m_lastLogin = item.name;
+        m_lastText = item.message;
+    }
+    if (!m_flushTimer->isActive()) {
+        m_flushTimer->start();
+    }
+}
+
+void ChatDialogListModel::Pimpl::flushStaged()
+{
+    // одна вставка на кадр: прокси и ListView пересчитываются один раз за пачку
+    const QList<Item> items = m_staged;
+    const int texts = m_stagedTexts;
+    m_staged.clear();
+    m_stagedTexts = 0;
+    append(items);
+    if (texts > 0) {
+        emit m_parent->newTextMessage(m_lastLogin, m_lastText, texts);
+    }
+}
+
+void ChatDialogListModel::Pimpl::prepend(const QList<Item> &items)
+{
+    // листание вверх окно не урезает: строки уйдут при следующем добавлении снизу
+    m_parent->beginInsertRows(QModelIndex(), 0, items.size() - 1);
+    m_data = items + m_data;
+    m_parent->endInsertRows();
+    const qint64 oldest = firstSequence(items);
+    if (oldest > 0) {
+        m_oldestSequence = oldest;
+    }
+}
+
+void ChatDialogListModel::Pimpl::evict()
+{
+    const int excess = m_data.size() - m_windowSize;
+    if (excess <= 0) {
+        return;
+    }
+
+    m_parent->beginRemoveRows(QModelIndex(), 0, excess - 1);
+    m_evicted.append(m_data.mid(0, excess));
+    m_data.erase(m_data.begin(), m_data.begin() + excess);
+    m_parent->endRemoveRows();
+    m_oldestSequence = firstSequence(m_data);
+    // кэш того же размера, что и окно; что старше — снова возьмём у сервера
+    if (m_evicted.size() > m_windowSize) {
+        m_evicted.erase(m_evicted.begin(), m_evicted.begin() + (m_evicted.size() - m_windowSize));
+    }
+}
+
+bool ChatDialogListModel::Pimpl::hasOlder() const
+{
+    if (!m_evicted.isEmpty()) {
+        return true;
+    }
+    return (m_oldestSequence > 1) && m_network->canRequestHistoryPage();
+}
+
+void ChatDialogListModel::Pimpl::setRoom(const QString &room)
+{
+    if (room != m_room) {
+        m_room = room;
+        emit m_parent->roomChanged();
+    }
+}
+
+void ChatDialogListModel::Pimpl::setPageRequested(bool requested)
+{
+    if (requested != m_pageRequested) {
+        m_pageRequested = requested;
+        emit m_parent->fetchingOlderChanged();
+    }
+}
+
+qint64 ChatDialogListModel::Pimpl::firstSequence(const QList<Item> &items)
+{
+    // у уведомлений и сообщений старого сервера номера нет
+    for (const Item& item : items) {
+        if (item.seq > 0) {
+            return item.seq;
         }
+    }
+    return 0;
+}
 
-        m_d->m_data.append(newItem);
-        endInsertRows();
-        emit newTextMessage(newItem.name, newItem.message);
-    });
-    connect(m_d->m_connection, &Connection::historyReceived,
-            this, [this](const QJsonArray& hist){
-        beginInsertRows(QModelIndex(), rowCount(), hist.size()-1);
-        for (const auto& val : hist) {
-            const QJsonObject& msg = val.toObject();
-            Pimpl::Item newItem;{
-                newItem.ip = msg.value(QLatin1String("ip")).toString();
-                newItem.name = msg.value(QLatin1String("name")).toString();
-                newItem.port = msg.value(QLatin1String("port")).toInt();
-                newItem.message = msg.value(QLatin1String("message")).toString();
-                newItem.dateTime = QDateTime::fromString(msg.value(QLatin1String("time")).toString(),QLatin1String("dd.MM.yyyy hh:mm:ss"));
-                newItem.type = MESSAGETYPE_TEXT;
+void ChatDialogListModel::Pimpl::invalidatePresentation()
+{
+    // строки не обходим: каждая пересчитается при следующем обращении;
+    // роли перечислены, чтобы представление и прокси не трогали остальные
+    if (++m_generation == 0) {
+        m_generation = 1;
+    }
+    if (!m_data.isEmpty()) {
+        emit m_parent->dataChanged(m_parent->index(0), m_parent->index(m_data.size() - 1),
+                                   { DATAROLE_MESSAGE, DATAROLE_IS_MINE, DATAROLE_SIZE_HINT });
+    }
+}
+
+const ChatDialogListModel::Pimpl::Presentation& ChatDialogListModel::Pimpl::presentation(int row)
+{
+    Item& item = m_data[row];
+    Presentation& view = item.view;
+    if (view.generation == m_generation) {
+        return view;
+    }
+
+    view.generation = m_generation;
+    view.mine = (item.name == m_myNickName);
+    if (view.time.isEmpty()) {
+        // от ника и цвета не зависит
+        view.time = QDateTime::fromMSecsSinceEpoch(item.timestamp).toString(QStringLiteral("hh:mm:ss"));
+    }
+    view.message = item.message;
+    if ( (item.type == MESSAGETYPE_TEXT) && !view.mine && !m_myNickName.isEmpty() && item.message.contains(m_myNickName) ) {
+        view.message.replace(m_myNickName, ChatDialogListModel::tr("<font color=\"%1\">%2</font>").arg(m_accent).arg(m_myNickName));
+    }
+    return view;
+}
+
+const ChatDialogListModel::Pimpl::Presentation& ChatDialogListModel::Pimpl::layout(int row)
+{
+    presentation(row);
+    Presentation& view = m_data[row].view;
+    if (view.layoutGeneration == m_generation) {
+        return view;
+    }
+
+    view.layoutGeneration = m_generation;
+    QTextDocument doc;
+    doc.setDefaultFont(QGuiApplication::font());
+    doc.setDocumentMargin(0);
+    if (Qt::mightBeRichText(view.message)) {
+        doc.setHtml(view.message);
+    }
+    else {
+        doc.setPlainText(view.message);
+    }
+    view.empty = doc.toPlainText().isEmpty();
+    view.sizeHint = QSizeF(doc.idealWidth(), doc.size().height());
+    return view;
+}
+
+void ChatDialogListModel::Pimpl::processEvent(const ChatEvent &event)
+{
+    switch (event.type) {
+    case ChatEvent::Message: {
+        for (const ChatMessage& msg : event.messages) {
+            stage(textItem(msg));
+        }
+        break;
+    }
+    case ChatEvent::History: {
+        // история — это не новые сообщения, уведомлять о ней не нужно; но
+        // пришедшие до неё в той же пачке уведомление получить должны
+        const int texts = m_stagedTexts;
+        const QString lastLogin = m_lastLogin;
+        const QString lastText = m_lastText;
+        for (const ChatMessage& msg : event.messages) {
+            stage(textItem(msg));
+        }
+        m_stagedTexts = texts;
+        m_lastLogin = lastLogin;
+        m_lastText = lastText;
+        break;
+    }
+    case ChatEvent::HistoryPage: {
+        // страница может пересекаться с уже показанными сообщениями
+        const qint64 oldest = m_oldestSequence;
+        QList<Item> items;
+        for (const ChatMessage& msg : event.messages) {
+            if ( (oldest == 0) || (msg.seq < oldest) ) {
+                items.append(textItem(msg));
             }
-            m_d->m_data.append(newItem);
         }
-
-        endInsertRows();
-    });
-    connect(m_d->m_connection, &Connection::participantJoin,
-            this, [this](const QJsonObject& msg){
-        beginInsertRows(QModelIndex(), rowCount(), rowCount());
-        Pimpl::Item newItem;{
-            newItem.ip = msg.value(QLatin1String("ip")).toString();
-            newItem.name = msg.value(QLatin1String("name")).toString();
-            newItem.port = msg.value(QLatin1String("port")).toInt();
-            newItem.message = tr("* %1@%2:%3 has joined").arg(newItem.name).arg(newItem.ip).arg(newItem.port);
-            newItem.dateTime = QDateTime::currentDateTime();
-            newItem.type = MESSAGETYPE_NOTIFICATION;
+        if (!items.isEmpty()) {
+            prepend(items);
         }
-
-        m_d->m_data.append(newItem);
-        endInsertRows();
-    });
-    connect(m_d->m_connection, &Connection::participantLeft,
-            this, [this](const QJsonObject& msg){
-        beginInsertRows(QModelIndex(), rowCount(), rowCount());
-        Pimpl::Item newItem;{
-            newItem.ip = msg.value(QLatin1String("ip")).toString();
-            newItem.name = msg.value(QLatin1String("name")).toString();
-            newItem.port = msg.value(QLatin1String("port")).toInt();
-            newItem.message = tr("* %1@%2:%3 has left").arg(newItem.name).arg(newItem.ip).arg(newItem.port);
-            newItem.dateTime = QDateTime::currentDateTime();
-            newItem.type = MESSAGETYPE_NOTIFICATION;
+        setPageRequested(false);
+        break;
+    }
+    case ChatEvent::ParticipantJoin: {
+        stage(participantItem(event.participant, ChatDialogListModel::tr("* %1@%2:%3 has joined")));
+        break;
+    }
+    case ChatEvent::ParticipantLeft: {
+        stage(participantItem(event.participant, ChatDialogListModel::tr("* %1@%2:%3 has left")));
+        break;
+    }
+    case ChatEvent::Missed: {
+        stage(notification(ChatDialogListModel::tr("* %n message(s) skipped: the connection could not keep up", "", event.value)));
+        break;
+    }
+    case ChatEvent::Participants: {
+        m_peers = event.participants;
+        emit m_parent->chattersChanged();
+        break;
+    }
+    case ChatEvent::PresenceAdded: {
+        const QJsonObject& participant = event.participant;
+        m_peers.append( QJsonObject{
+                            { QLatin1String("name"), participant.value(QLatin1String("name")) },
+                            { QLatin1String("ip"), participant.value(QLatin1String("ip")) },
+                            { QLatin1String("port"), participant.value(QLatin1String("port")) }
+                        });
+        emit m_parent->chattersChanged();
+        break;
+    }
+    case ChatEvent::PresenceRemoved: {
+        const QJsonValue name = event.participant.value(QLatin1String("name"));
+        for (int i = 0; i < m_peers.size(); ++i) {
+            if (m_peers.at(i).toObject().value(QLatin1String("name")) == name) {
+                m_peers.removeAt(i);
+                emit m_parent->chattersChanged();
+                break;
+            }
         }
+        break;
+    }
+    case ChatEvent::StateChanged: {
+        processState(static_cast<QAbstractSocket::SocketState>(event.value));
+        break;
+    }
+    case ChatEvent::NameError: {
+        setNameError(true);
+        clearData();
+        break;
+    }
+    case ChatEvent::RoomJoined: {
+        // история новой комнаты придёт следом целиком
+        clearData();
+        setPageRequested(false);
+        setRoom(event.room);
+        break;
+    }
+    }
+}
 
-        m_d->m_data.append(newItem);
-        endInsertRows();
-    });
-    connect(m_d->m_connection, &Connection::participantsReceived,
-            this, [this](const QJsonArray& part){
-        m_d->m_peers = part;
-        emit chattersChanged();
-    });
+void ChatDialogListModel::Pimpl::processState(QAbstractSocket::SocketState socketState)
+{
+    switch (socketState) {
+    case QAbstractSocket::UnconnectedState:
+        m_state = STATE_UNCONNECTED;
+        setPageRequested(false);
+        // после переподключения сервер снова помещает клиента в общую комнату
+        setRoom(QString());
+        break;
+    case QAbstractSocket::HostLookupState:
+    case QAbstractSocket::ConnectingState:
+        m_state = STATE_CONNECTING;
+        break;
+    case QAbstractSocket::ConnectedState:
+        m_state = STATE_CONNECTED;
+        setNameError(false);
+        break;
+    case QAbstractSocket::ClosingState:
+        m_state = STATE_CLOSING;
+        break;
+    default:
+        m_state = STATE_UNDEFINED;
+        break;
+    }
+    emit m_parent->connectionStateChanged();
+}
 
-    connect(m_d->m_connection, &Connection::stateChanged,
-            this, [this](QAbstractSocket::SocketState socketState){
-        switch (socketState) {
-        case QAbstractSocket::UnconnectedState:
-            m_d->m_state = STATE_UNCONNECTED;
-            break;
-        case QAbstractSocket::HostLookupState:
-        case QAbstractSocket::ConnectingState:
-            m_d->m_state = STATE_CONNECTING;
-            break;
-        case QAbstractSocket::ConnectedState:
-            m_d->m_state = STATE_CONNECTED;
-            m_d->setNameError(false);
-            break;
-        case QAbstractSocket::ClosingState:
-            m_d->m_state = STATE_CLOSING;
-            break;
-        default:
-            m_d->m_state = STATE_UNDEFINED;
-            break;
-        }
-        emit connectionStateChanged();
+ChatDialogListModel::Pimpl::Item ChatDialogListModel::Pimpl::textItem(const ChatMessage &msg)
+{
+    Item newItem;{
+        newItem.seq = msg.seq;
+        newItem.ip = msg.ip;
+        newItem.name = msg.name;
+        newItem.port = msg.port;
+        newItem.message = msg.message;
+        newItem.timestamp = msg.timestamp;
+        newItem.type = MESSAGETYPE_TEXT;
+    }
+    return newItem;
+}
+
+ChatDialogListModel::Pimpl::Item ChatDialogListModel::Pimpl::participantItem(const QJsonObject &participant, const QString &format)
+{
+    Item newItem;{
+        newItem.ip = participant.value(QLatin1String("ip")).toString();
+        newItem.name = participant.value(QLatin1String("name")).toString();
+        newItem.port = participant.value(QLatin1String("port")).toInt();
+        newItem.message = format.arg(newItem.name).arg(newItem.ip).arg(newItem.port);
+        newItem.timestamp = QDateTime::currentMSecsSinceEpoch();
+        newItem.type = MESSAGETYPE_NOTIFICATION;
+    }
+    return newItem;
+}
+
+ChatDialogListModel::Pimpl::Item ChatDialogListModel::Pimpl::notification(const QString &message)
+{
+    Item newItem;{
+        newItem.message = message;
+        newItem.timestamp = QDateTime::currentMSecsSinceEpoch();
+        newItem.type = MESSAGETYPE_NOTIFICATION;
+    }
+    return newItem;
+}
+
+//-----------------------------------------------------------------------//
+//  ChatDialogListModel                                                  //
+//-----------------------------------------------------------------------//
+
+ChatDialogListModel::ChatDialogListModel(QObject *parent) :
+    QAbstractListModel(parent)
+{
+    m_d = new Pimpl(this);
+    m_d->m_network = new NetworkThread(this);
+    m_d->m_flushTimer = new QTimer(this);
+    m_d->m_flushTimer->setSingleShot(true);
+    m_d->m_flushTimer->setInterval(m_d->m_batchInterval);
+    connect(m_d->m_flushTimer, &QTimer::timeout,
+            this, [this](){
+        m_d->flushStaged();
     });
-    connect(m_d->m_connection, &Connection::nameError,
+    connect(m_d->m_network, &NetworkThread::eventsReady,
             this, [this](){
-        m_d->setNameError(true);
-        m_d->clearData();
+        for (const ChatEvent& event : m_d->m_network->takeEvents()) {
+            m_d->processEvent(event);
+        }
     });
 }
 
@@ -201,11 +469,18 @@ bool ChatDialogListModel::nameError() const
     return m_d->m_nameError;
 }
 
+QString ChatDialogListModel::room() const
+{
+    return m_d->m_room;
+}
+
 void ChatDialogListModel::connectToServer(const QString &ip, int port, const QString& name)
 {
-    m_d->m_myNickName = name;
-    m_d->m_connection->setGreetingMessage(name);
-    m_d->m_connection->connectToHost(ip, port);
+    if (name != m_d->m_myNickName) {
+        m_d->m_myNickName = name;
+        m_d->invalidatePresentation();
+    }
+    m_d->m_network->connectToHost(ip, static_cast<quint16>(port), name);
 }
 
 QJsonArray ChatDialogListModel::chatters() const
@@ -228,18 +503,14 @@ QVariant ChatDialogListModel::data(const QModelIndex &index, int role) const
         case DATAROLE_IP:             return element.ip;
         case DATAROLE_PORT:           return element.port;
         case DATAROLE_LOGIN:          return element.name;
-        case DATAROLE_MESSAGE:        {
-            if ( (element.type == MESSAGETYPE_NOTIFICATION) || isMine(element.name/*, element.ip, element.port*/) || !element.message.contains(m_d->m_myNickName) ) {
-                return element.message;
-            }
-            else {
-                QString result = element.message;
-                return result.replace(m_d->m_myNickName, tr("<font color=\"%1\">%2</font>")).arg(m_d->m_accent).arg(m_d->m_myNickName);
-            }
-        }
-        case DATAROLE_DATE_TIME:      return element.dateTime.toString( QStringLiteral("hh:mm:ss"));
+        case DATAROLE_MESSAGE:        return m_d->presentation(row).message;
+        case DATAROLE_TEXT:           return element.message;
+        case DATAROLE_DATE_TIME:      return m_d->presentation(row).time;
         case DATAROLE_MESSAGE_TYPE:   return element.type;
-        case DATAROLE_IS_MINE:        return isMine(element.name/*, element.ip, element.port*/);
+        case DATAROLE_IS_MINE:        return m_d->presentation(row).mine;
+        case DATAROLE_IS_EMPTY:       return m_d->layout(row).empty;
+        case DATAROLE_SIZE_HINT:      return m_d->layout(row).sizeHint;
+        case DATAROLE_TIMESTAMP:      return element.timestamp;
         default: break;
         }
     }
@@ -256,15 +527,103 @@ QHash<int, QByteArray> ChatDialogListModel::roleNames() const
         { DATAROLE_MESSAGE,        "chat_message" },
         { DATAROLE_DATE_TIME,      "chat_date_time" },
         { DATAROLE_MESSAGE_TYPE,   "chat_message_type" },
-        { DATAROLE_IS_MINE,        "chat_mine" }
+        { DATAROLE_IS_MINE,        "chat_mine" },
+        { DATAROLE_IS_EMPTY,       "chat_empty" },
+        { DATAROLE_SIZE_HINT,      "chat_size_hint" },
+        { DATAROLE_TIMESTAMP,      "chat_timestamp" },
+        { DATAROLE_TEXT,           "chat_text" }
     };
     return roles;
 }
 
+bool ChatDialogListModel::canFetchMore(const QModelIndex &parent) const
+{
+    // представление зовёт fetchMore, дойдя до последней строки; у чата это
+    // обычное положение, поэтому подгрузка старых строк только у верхнего края
+    return !parent.isValid() && m_d->m_viewAtTop && !m_d->m_pageRequested && m_d->hasOlder();
+}
+
+void ChatDialogListModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent)) {
+        return;
+    }
+
+    if (!m_d->m_evicted.isEmpty()) {
+        const int count = qMin(m_d->m_evicted.size(), FetchPageSize);
+        const QList<Pimpl::Item> items = m_d->m_evicted.mid(m_d->m_evicted.size() - count);
+        m_d->m_evicted.erase(m_d->m_evicted.end() - count, m_d->m_evicted.end());
+        m_d->setPageRequested(true);
+        m_d->prepend(items);
+        m_d->setPageRequested(false);
+        return;
+    }
+    m_d->setPageRequested(m_d->m_network->requestHistoryPage(m_d->m_oldestSequence, FetchPageSize));
+}
+
+int ChatDialogListModel::windowSize() const
+{
+    return m_d->m_windowSize;
+}
+
+void ChatDialogListModel::setWindowSize(int size)
+{
+    size = qMax(size, FetchPageSize);
+    if (size != m_d->m_windowSize) {
+        m_d->m_windowSize = size;
+        m_d->evict();
+        emit windowSizeChanged();
+    }
+}
+
+int ChatDialogListModel::batchInterval() const
+{
+    return m_d->m_batchInterval;
+}
+
+void ChatDialogListModel::setBatchInterval(int ms)
+{
+    ms = qMax(ms, 0);
+    if (ms != m_d->m_batchInterval) {
+        m_d->m_batchInterval = ms;
+        m_d->m_flushTimer->setInterval(ms);
+        emit batchIntervalChanged();
+    }
+}
+
+bool ChatDialogListModel::viewAtTop() const
+{
+    return m_d->m_viewAtTop;
+}
+
+void ChatDialogListModel::setViewAtTop(bool atTop)
+{
+    if (atTop != m_d->m_viewAtTop) {
+        m_d->m_viewAtTop = atTop;
+        emit viewAtTopChanged();
+        fetchMore(QModelIndex());
+    }
+}
+
+bool ChatDialogListModel::fetchingOlder() const
+{
+    return m_d->m_pageRequested;
+}
+
+bool ChatDialogListModel::joinRoom(const QString &room)
+{
+    const QString name = room.trimmed();
+    if ( (name == m_d->m_room) || (name.size() > Protocol::MaxRoomNameSize) ) {
+        return false;
+    }
+
+    return m_d->m_network->joinRoom(name);
+}
+
 void ChatDialogListModel::sendMessage(const QString &message)
 {
     QString simplified = message.simplified();
-    m_d->m_connection->sendMessage(simplified);
+    m_d->m_network->sendMessage(simplified);
 }
 
 bool ChatDialogListModel::isEmptyHtml(const QString &message)
@@ -289,6 +648,6 @@ void ChatDialogListModel::setAccent(const QString &accent)
     if (accent != m_d->m_accent) {
         m_d->m_accent = accent;
         emit accentChanged();
-        emit dataChanged(index(0), index(rowCount()-1),{DATAROLE_MESSAGE});
+        m_d->invalidatePresentation();
     }
 }
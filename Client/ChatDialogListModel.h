@@ -13,6 +13,11 @@ class ChatDialogListModel : public QAbstractListModel {
     Q_PROPERTY(QString accent READ accent WRITE setAccent NOTIFY accentChanged)
     Q_PROPERTY(ConnectionState connectionState READ connectionState NOTIFY connectionStateChanged)
     Q_PROPERTY(bool nameError READ nameError NOTIFY nameErrorChanged)
+    Q_PROPERTY(QString room READ room NOTIFY roomChanged)
+    Q_PROPERTY(int windowSize READ windowSize WRITE setWindowSize NOTIFY windowSizeChanged)
+    Q_PROPERTY(int batchInterval READ batchInterval WRITE setBatchInterval NOTIFY batchIntervalChanged)
+    Q_PROPERTY(bool viewAtTop READ viewAtTop WRITE setViewAtTop NOTIFY viewAtTopChanged)
+    Q_PROPERTY(bool fetchingOlder READ fetchingOlder NOTIFY fetchingOlderChanged)
 public:
     enum DataRole {
         DATAROLE_IP = Qt::UserRole + 1,
@@ -21,7 +26,11 @@ public:
         DATAROLE_MESSAGE,
         DATAROLE_DATE_TIME,
         DATAROLE_MESSAGE_TYPE,
-        DATAROLE_IS_MINE
+        DATAROLE_IS_MINE,
+        DATAROLE_IS_EMPTY, /*!< Сообщение без видимого текста */
+        DATAROLE_SIZE_HINT, /*!< Размер текста без переносов, шрифт приложения */
+        DATAROLE_TIMESTAMP, /*!< Время сообщения, мс от эпохи */
+        DATAROLE_TEXT /*!< Текст как пришёл, без подсветки ника */
     };
     enum MessageType{
         MESSAGETYPE_NOTIFICATION, /*!< Уведомление о присоединении/уходе участника */
@@ -42,10 +51,19 @@ public:
 public:
     ConnectionState connectionState() const;
     bool nameError() const;
+    QString room() const;
+    int windowSize() const;
+    void setWindowSize(int size);
+    int batchInterval() const;
+    void setBatchInterval(int ms);
+    bool viewAtTop() const;
+    void setViewAtTop(bool atTop);
+    bool fetchingOlder() const;
 public:
     Q_INVOKABLE void connectToServer(const QString& ip, int port, const QString& name);
     QJsonArray chatters() const;
     Q_INVOKABLE void sendMessage(const QString &message);
+    Q_INVOKABLE bool joinRoom(const QString& room);
     Q_INVOKABLE static bool isEmptyHtml(const QString &message);
     Q_INVOKABLE bool isMine(const QString &login) const;
     QString accent() const;
@@ -55,12 +73,19 @@ public:
     int rowCount(const QModelIndex& parent = QModelIndex() ) const override;
     QVariant data(const QModelIndex & index, int role = Qt::DisplayRole) const override;
     QHash<int, QByteArray> roleNames() const override;
+    bool canFetchMore(const QModelIndex& parent) const override;
+    void fetchMore(const QModelIndex& parent) override;
 signals:
     void chattersChanged();
-    void newTextMessage(const QString &login, const QString &message);
+    void newTextMessage(const QString &login, const QString &message, int count);
     void accentChanged();
     void connectionStateChanged();
     void nameErrorChanged();
+    void roomChanged();
+    void windowSizeChanged();
+    void batchIntervalChanged();
+    void viewAtTopChanged();
+    void fetchingOlderChanged();
 private:
     class Pimpl;
     Pimpl* m_d;
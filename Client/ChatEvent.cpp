@@ -0,0 +1,41 @@
+#include "ChatEvent.h"
+
+#include <QDateTime>
+
+//-----------------------------------------------------------------------//
+//  ChatMessage                                                          //
+//-----------------------------------------------------------------------//
+
+ChatMessage ChatMessage::fromJson(const QJsonObject &msg)
+{
+    ChatMessage result;{
+        result.seq = static_cast<qint64>(msg.value(QLatin1String("seq")).toDouble());
+        result.ip = msg.value(QLatin1String("ip")).toString();
+        result.name = msg.value(QLatin1String("name")).toString();
+        result.port = static_cast<quint16>(msg.value(QLatin1String("port")).toInt());
+        result.message = msg.value(QLatin1String("message")).toString();
+    }
+
+    const QJsonValue ts = msg.value(QLatin1String("ts"));
+    if (!ts.isUndefined()) {
+        result.timestamp = static_cast<qint64>(ts.toDouble());
+    }
+    else {
+        // старый сервер присылает только строку
+        result.timestamp = QDateTime::fromString(msg.value(QLatin1String("time")).toString(),QLatin1String("dd.MM.yyyy hh:mm:ss")).toMSecsSinceEpoch();
+    }
+    return result;
+}
+
+ChatMessage ChatMessage::fromPayload(const CborPayload::Message &msg)
+{
+    ChatMessage result;{
+        result.seq = msg.sequence;
+        result.ip = msg.ip;
+        result.name = msg.name;
+        result.port = static_cast<quint16>(msg.port);
+        result.message = msg.text;
+        result.timestamp = msg.timestamp;
+    }
+    return result;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "CborPayload.h"
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+
+//-----------------------------------------------------------------------//
+//  ChatMessage                                                          //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Текстовое сообщение, уже разобранное из JSON или CBOR в сетевом потоке.
+ */
+struct ChatMessage {
+    qint64 seq = 0; /*!< 0 — старый сервер номеров не присылает */
+    QString ip;
+    quint16 port = 0;
+    QString name;
+    QString message;
+    qint64 timestamp = 0; /*!< мс от эпохи */
+public:
+    static ChatMessage fromJson(const QJsonObject& msg);
+    static ChatMessage fromPayload(const CborPayload::Message& msg);
+};
+
+//-----------------------------------------------------------------------//
+//  ChatEvent                                                            //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Событие соединения, которое сетевой поток передаёт модели.
+ */
+struct ChatEvent {
+    enum Type {
+        Message,
+        History,
+        HistoryPage,
+        ParticipantJoin,
+        ParticipantLeft,
+        Participants,
+        PresenceAdded,
+        PresenceRemoved,
+        Missed,
+        RoomJoined,
+        NameError,
+        StateChanged
+    };
+public:
+    Type type = Message;
+    QVector<ChatMessage> messages; /*!< Message, History, HistoryPage */
+    QJsonArray participants; /*!< Participants */
+    QJsonObject participant; /*!< ParticipantJoin/Left, PresenceAdded/Removed */
+    QString room; /*!< RoomJoined */
+    int value = 0; /*!< Missed — сколько пропущено, StateChanged — QAbstractSocket::SocketState */
+};
@@ -0,0 +1,48 @@
+#include "ChatEventQueue.h"
+
+#include <algorithm>
+
+//-----------------------------------------------------------------------//
+//  ChatEventQueue                                                       //
+//-----------------------------------------------------------------------//
+
+ChatEventQueue::ChatEventQueue() :
+    m_head(nullptr)
+{
+}
+
+ChatEventQueue::~ChatEventQueue()
+{
+    Node* node = m_head.fetchAndStoreAcquire(nullptr);
+    while (node) {
+        Node* next = node->next;
+        delete node;
+        node = next;
+    }
+}
+
+bool ChatEventQueue::push(const ChatEvent &event)
+{
+    Node* node = new Node;
+    node->event = event;
+    Node* head = m_head.loadAcquire();
+    do {
+        node->next = head;
+    } while (!m_head.testAndSetRelease(head, node, head));
+    return head == nullptr;
+}
+
+QVector<ChatEvent> ChatEventQueue::takeAll()
+{
+    // забираем весь стек одной операцией, дальше он только наш
+    Node* node = m_head.fetchAndStoreAcquire(nullptr);
+    QVector<ChatEvent> result;
+    while (node) {
+        Node* next = node->next;
+        result.append(node->event);
+        delete node;
+        node = next;
+    }
+    std::reverse(result.begin(), result.end());
+    return result;
+}
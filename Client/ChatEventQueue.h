@@ -0,0 +1,32 @@
+#pragma once
+
+#include "ChatEvent.h"
+
+#include <QAtomicPointer>
+#include <QVector>
+
+//-----------------------------------------------------------------------//
+//  ChatEventQueue                                                       //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Очередь событий без блокировок: сетевой поток кладёт события по одному,
+ * поток интерфейса забирает всё накопленное разом. Внутри — стек на одном
+ * атомарном указателе, порядок восстанавливается при извлечении.
+ */
+class ChatEventQueue {
+public:
+    ChatEventQueue();
+    ~ChatEventQueue();
+    ChatEventQueue(const ChatEventQueue&) = delete;
+    ChatEventQueue& operator=(const ChatEventQueue&) = delete;
+public:
+    bool push(const ChatEvent& event); /*!< true, если очередь была пуста и читателя надо разбудить */
+    QVector<ChatEvent> takeAll(); /*!< События в порядке поступления */
+private:
+    struct Node {
+        ChatEvent event;
+        Node* next = nullptr;
+    };
+    QAtomicPointer<Node> m_head;
+};
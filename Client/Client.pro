@@ -6,6 +6,8 @@ SOURCES += *.cpp
 
 HEADERS += *h
 
+include(../Common/Common.pri)
+
 RESOURCES += qml.qrc
 
 #QML_IMPORT_PATH =
@@ -1,13 +1,24 @@
 #include "Connection.h"
+#include "CborPayload.h"
+#include "Compression.h"
+#include "FrameDecoder.h"
 
 #include <QtNetwork>
 #include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
 
 static const int TransferTimeout = 30 * 1000;
 static const int PongTimeout = 30 * 1000;
 static const int PingInterval = 100;
-static const char SeparatorToken = ' ';
-static const int MaxBufferSize = 1024000;
+static const quint32 SupportedCapabilities = Protocol::CapabilityBinaryFraming |
+                                             Protocol::CapabilityPresence |
+                                             Protocol::CapabilityMissedMarker |
+                                             Protocol::CapabilityHistoryPaging |
+                                             Protocol::CapabilityCompression |
+                                             Protocol::CapabilityRooms |
+                                             Protocol::CapabilitySessions |
+                                             Protocol::CapabilityCbor;
 
 //-----------------------------------------------------------------------//
 //  Connection::Pimpl                                                    //
@@ -17,11 +28,18 @@ class Connection::Pimpl {
 public:
     Pimpl(Connection* parent);
 public:
-    int readDataIntoBuffer(int maxSize = MaxBufferSize);
-    int dataLengthForCurrentDataType();
-    bool readProtocolHeader();
-    bool hasEnoughData();
-    void processData();
+    void processFrame(const FrameDecoder::Frame& frame);
+    void processCapabilities(const QByteArray& accepted);
+    void processParticipants(const QByteArray& payload);
+    static QVector<ChatMessage> messages(const QByteArray& payload);
+    static QJsonObject participant(const QByteArray& payload);
+    static QJsonObject participantObject(const CborPayload::Participant& participant);
+    void processPresence(const FrameDecoder::Frame& frame);
+    void rememberSessions(const QJsonArray& participants);
+    void rememberSession(const QJsonObject& participant);
+    QJsonObject resolveSession(const QJsonObject& participant, bool forget);
+    void requestPresenceSync();
+    void updateTransferTimer();
 public:
     QString m_greetingMessage = tr("undefined");
     QString m_username = tr("unknown");
@@ -29,10 +47,13 @@ public:
     quint16 m_userPort = 0;
     QTimer* m_pingTimer = nullptr;
     QTime m_pongTime;
-    QByteArray m_buffer;
+    FrameDecoder m_decoder;
+    InflateStream m_inflate;
+    Protocol::Framing m_framing = Protocol::TextFraming;
+    quint32 m_capabilities = Protocol::NoCapabilities;
+    qint64 m_presenceVersion = -1;
+    QHash<qint64, QJsonObject> m_sessions;
     Connection::ConnectionState m_state = Connection::WaitingForGreeting;
-    Connection::DataType m_currentDataType = Connection::Undefined;
-    int m_numBytesForCurrentDataType = -1;
     int m_transferTimerId = 0;
     bool m_isGreetingMessageSent = false;
     Connection* m_parent = nullptr;
@@ -43,159 +64,254 @@ Connection::Pimpl::Pimpl(Connection *parent) :
 {
 }
 
-int Connection::Pimpl::readDataIntoBuffer(int maxSize)
+void Connection::Pimpl::processFrame(const FrameDecoder::Frame &frame)
 {
-    if (maxSize > MaxBufferSize) {
-        return 0;
-    }
-
-    int numBytesBeforeRead = m_buffer.size();
-    if (numBytesBeforeRead == MaxBufferSize) {
-        m_parent->abort();
-        return 0;
-    }
-
-    while (m_parent->bytesAvailable() > 0 && m_buffer.size() < maxSize) {
-        m_buffer.append(m_parent->read(1));
-        if (m_buffer.endsWith(SeparatorToken)) {
-            break;
+    if (frame.flags & Protocol::FlagCompressed) {
+        FrameDecoder::Frame inflated;
+        inflated.type = frame.type;
+        if (!m_inflate.decompress(frame.payload, &inflated.payload, Protocol::MaxBufferSize)) {
+            m_parent->abort();
+            return;
         }
+        processFrame(inflated);
+        return;
     }
-    return m_buffer.size() - numBytesBeforeRead;
-}
 
-int Connection::Pimpl::dataLengthForCurrentDataType()
-{
-    if ( (m_parent->bytesAvailable() <= 0) || (readDataIntoBuffer() <= 0) || !m_buffer.endsWith(SeparatorToken) ) {
-        return 0;
+    switch (frame.type) {
+    case Protocol::PlainText: {
+        CborPayload::Message message;
+        if (!CborPayload::isCbor(frame.payload)) {
+            emit m_parent->newMessage( ChatMessage::fromJson(QJsonDocument::fromJson(frame.payload).object()) );
+        }
+        else if (CborPayload::decodeMessage(frame.payload, &message)) {
+            emit m_parent->newMessage( ChatMessage::fromPayload(message) );
+        }
+        break;
     }
-
-    m_buffer.chop(1);
-    int number = m_buffer.toInt();
-    m_buffer.clear();
-    return number;
-}
-
-bool Connection::Pimpl::readProtocolHeader()
-{
-    if (m_transferTimerId) {
-        m_parent->killTimer(m_transferTimerId);
-        m_transferTimerId = 0;
+    case Protocol::Ping: {
+        m_parent->write(Protocol::controlFrame(Protocol::Pong, m_framing));
+        break;
     }
-
-    if (readDataIntoBuffer() <= 0) {
-        m_transferTimerId = m_parent->startTimer(TransferTimeout);
-        return false;
+    case Protocol::Pong: {
+        m_pongTime.restart();
+        break;
     }
-
-    if (m_buffer == "PING ") {
-        m_currentDataType = Ping;
+    case Protocol::History: {
+        emit m_parent->historyReceived( messages(frame.payload) );
+        break;
     }
-    else if (m_buffer == "PONG ") {
-        m_currentDataType = Pong;
+    case Protocol::Join: {
+        const QJsonObject joined = participant(frame.payload);
+        rememberSession(joined);
+        emit m_parent->participantJoin(joined);
+        break;
     }
-    else if (m_buffer == "MESSAGE ") {
-        m_currentDataType = PlainText;
+    case Protocol::Leave: {
+        // запись нужна ещё для следующего за LEAVE кадра PRESENCE_REMOVE
+        const QJsonObject left = resolveSession( participant(frame.payload), false );
+        if (!left.isEmpty()) {
+            emit m_parent->participantLeft(left);
+        }
+        break;
     }
-    else if (m_buffer == "GREETING ") {
-        m_currentDataType = Greeting;
+    case Protocol::Participants: {
+        processParticipants(frame.payload);
+        break;
     }
-    else if (m_buffer == "HISTORY ") {
-        m_currentDataType = History;
+    case Protocol::PresenceAdd:
+    case Protocol::PresenceRemove: {
+        processPresence(frame);
+        break;
     }
-    else if (m_buffer == "LEAVE ") {
-        m_currentDataType = Leave;
+    case Protocol::NameError: {
+        emit m_parent->nameError();
+        break;
     }
-    else if (m_buffer == "JOIN ") {
-        m_currentDataType = Join;
+    case Protocol::Greeting: {
+        processCapabilities(frame.payload);
+        break;
     }
-    else if (m_buffer == "LEAVE ") {
-        m_currentDataType = Leave;
+    case Protocol::HistoryPage: {
+        emit m_parent->historyPageReceived( messages(frame.payload) );
+        break;
     }
-    else if (m_buffer == "PARTICIPANTS ") {
-        m_currentDataType = Participants;
+    case Protocol::JoinRoom: {
+        // дальше придут снимок участников и история новой комнаты
+        m_presenceVersion = -1;
+        emit m_parent->roomJoined( QJsonDocument::fromJson(frame.payload).object().value(QLatin1String("room")).toString() );
+        break;
     }
-    else if (m_buffer == "NAMEERROR ") {
-        m_currentDataType = NameError;
+    case Protocol::Missed: {
+        emit m_parent->messagesMissed( QJsonDocument::fromJson(frame.payload).object().value(QLatin1String("count")).toInt() );
+        break;
     }
-    else {
-        m_currentDataType = Undefined;
-        m_parent->abort();
-        return false;
+    default:
+        break;
     }
+}
 
-    m_buffer.clear();
-    m_numBytesForCurrentDataType = dataLengthForCurrentDataType();
-    return true;
+void Connection::Pimpl::processCapabilities(const QByteArray &accepted)
+{
+    m_capabilities = Protocol::capabilitiesFromNames(accepted);
+    if (m_capabilities & Protocol::CapabilityBinaryFraming) {
+        m_framing = Protocol::BinaryFraming;
+    }
+    emit m_parent->capabilitiesChanged(m_capabilities);
 }
 
-bool Connection::Pimpl::hasEnoughData()
+void Connection::Pimpl::processParticipants(const QByteArray &payload)
 {
-    if (m_transferTimerId) {
-        m_parent->killTimer(m_transferTimerId);
-        m_transferTimerId = 0;
+    if (CborPayload::isCbor(payload)) {
+        QVector<CborPayload::Participant> records;
+        qint64 version = -1;
+        if (!CborPayload::decodeParticipants(payload, &records, &version)) {
+            return;
+        }
+        QJsonArray participants;
+        for (const CborPayload::Participant& record : records) {
+            participants.append(participantObject(record));
+        }
+        if (version >= 0) {
+            m_presenceVersion = version;
+        }
+        rememberSessions(participants);
+        emit m_parent->participantsReceived(participants);
+        return;
     }
 
-    if (m_numBytesForCurrentDataType <= 0) {
-        m_numBytesForCurrentDataType = dataLengthForCurrentDataType();
+    const QJsonDocument doc = QJsonDocument::fromJson(payload);
+    if (doc.isArray()) {
+        // полный список от старого сервера или до согласования возможностей
+        rememberSessions(doc.array());
+        emit m_parent->participantsReceived(doc.array());
+        return;
     }
 
-    if ( (m_parent->bytesAvailable() < m_numBytesForCurrentDataType) || (m_numBytesForCurrentDataType <= 0) ) {
-        m_transferTimerId = m_parent->startTimer(TransferTimeout);
-        return false;
+    const QJsonObject snapshot = doc.object();
+    const QJsonArray participants = snapshot.value(QLatin1String("participants")).toArray();
+    m_presenceVersion = static_cast<qint64>(snapshot.value(QLatin1String("version")).toDouble());
+    rememberSessions(participants);
+    emit m_parent->participantsReceived(participants);
+}
+
+QVector<ChatMessage> Connection::Pimpl::messages(const QByteArray &payload)
+{
+    QVector<ChatMessage> result;
+    if (CborPayload::isCbor(payload)) {
+        QVector<CborPayload::Message> records;
+        CborPayload::decodeMessages(payload, &records);
+        result.reserve(records.size());
+        for (const CborPayload::Message& record : records) {
+            result.append(ChatMessage::fromPayload(record));
+        }
+        return result;
     }
 
-    return true;
+    const QJsonArray array = QJsonDocument::fromJson(payload).array();
+    result.reserve(array.size());
+    for (const QJsonValue& value : array) {
+        result.append(ChatMessage::fromJson(value.toObject()));
+    }
+    return result;
 }
 
-void Connection::Pimpl::processData()
+QJsonObject Connection::Pimpl::participant(const QByteArray &payload)
 {
-    m_buffer = m_parent->read(m_numBytesForCurrentDataType);
-    if (m_buffer.size() != m_numBytesForCurrentDataType) {
-        m_parent->abort();
-        return;
+    if (!CborPayload::isCbor(payload)) {
+        return QJsonDocument::fromJson(payload).object();
     }
+    CborPayload::Participant record;
+    return CborPayload::decodeParticipant(payload, &record) ? participantObject(record) : QJsonObject();
+}
 
-    switch (m_currentDataType) {
-    case PlainText: {
-        emit m_parent->newMessage( QJsonDocument::fromJson(m_buffer).object() );
-        break;
+QJsonObject Connection::Pimpl::participantObject(const CborPayload::Participant &participant)
+{
+    // учёт сессий на клиенте ведётся в JSON, ключи те же, что у сервера
+    QJsonObject result;
+    if (participant.id >= 0) {
+        result.insert(QLatin1String("id"), participant.id);
     }
-    case Ping: {
-        m_parent->write("PONG 1 p");
-        break;
+    if (!participant.name.isEmpty()) {
+        result.insert(QLatin1String("name"), participant.name);
+        result.insert(QLatin1String("ip"), participant.ip);
+        result.insert(QLatin1String("port"), participant.port);
     }
-    case Pong: {
-        m_pongTime.restart();
-        break;
+    return result;
+}
+
+void Connection::Pimpl::rememberSessions(const QJsonArray &participants)
+{
+    m_sessions.clear();
+    for (const QJsonValue& participant : participants) {
+        rememberSession(participant.toObject());
     }
-    case History: {
-        emit m_parent->historyReceived( QJsonDocument::fromJson(m_buffer).array() );
-        break;
+}
+
+void Connection::Pimpl::rememberSession(const QJsonObject &participant)
+{
+    const QJsonValue id = participant.value(QLatin1String("id"));
+    if (!id.isUndefined()) {
+        m_sessions.insert(static_cast<qint64>(id.toDouble()), participant);
     }
-    case Join: {
-        emit m_parent->participantJoin( QJsonDocument::fromJson(m_buffer).object() );
-        break;
+}
+
+QJsonObject Connection::Pimpl::resolveSession(const QJsonObject &participant, bool forget)
+{
+    // с "sessions" уход приходит одним id, имя и адрес берутся из запомненного
+    const QJsonValue id = participant.value(QLatin1String("id"));
+    if (id.isUndefined()) {
+        return participant;
+    }
+    const qint64 key = static_cast<qint64>(id.toDouble());
+    const QJsonObject known = forget ? m_sessions.take(key) : m_sessions.value(key);
+    return participant.contains(QLatin1String("name")) ? participant : known;
+}
+
+void Connection::Pimpl::processPresence(const FrameDecoder::Frame &frame)
+{
+    // до снимка дельты не к чему применять, он их уже учтёт
+    if (m_presenceVersion < 0) {
+        return;
     }
-    case Leave: {
-        emit m_parent->participantLeft( QJsonDocument::fromJson(m_buffer).object() );
-        break;
+
+    const QJsonObject participant = QJsonDocument::fromJson(frame.payload).object();
+    const qint64 version = static_cast<qint64>(participant.value(QLatin1String("version")).toDouble());
+    if (version <= m_presenceVersion) {
+        return;
     }
-    case Participants: {
-        emit m_parent->participantsReceived( QJsonDocument::fromJson(m_buffer).array() );
-        break;
+    if (version != m_presenceVersion + 1) {
+        requestPresenceSync();
+        return;
     }
-    case NameError: {
-        emit m_parent->nameError();
-        break;
+
+    m_presenceVersion = version;
+    if (frame.type == Protocol::PresenceAdd) {
+        rememberSession(participant);
+        emit m_parent->presenceAdded(participant);
+        return;
     }
-    default:
-        break;
+    const QJsonObject removed = resolveSession(participant, true);
+    if (!removed.isEmpty()) {
+        emit m_parent->presenceRemoved(removed);
+    }
+}
+
+void Connection::Pimpl::requestPresenceSync()
+{
+    m_presenceVersion = -1;
+    m_parent->write(Protocol::encodeFrame(Protocol::PresenceSync, QByteArray(), m_framing));
+}
+
+void Connection::Pimpl::updateTransferTimer()
+{
+    if (m_transferTimerId) {
+        m_parent->killTimer(m_transferTimerId);
+        m_transferTimerId = 0;
     }
 
-    m_currentDataType = Undefined;
-    m_numBytesForCurrentDataType = 0;
-    m_buffer.clear();
+    if (m_decoder.hasPendingData()) {
+        m_transferTimerId = m_parent->startTimer(TransferTimeout);
+    }
 }
 
 
@@ -218,6 +334,15 @@ Connection::Connection(QObject *parent)
             this, &Connection::sendPing);
     connect(this, &Connection::connected,
             this, &Connection::sendGreetingMessage);
+    connect(this, &Connection::disconnected,
+            this, [this](){
+        m_d->m_decoder.clear();
+        m_d->m_inflate.reset();
+        m_d->m_framing = Protocol::TextFraming;
+        m_d->m_capabilities = Protocol::NoCapabilities;
+        m_d->m_presenceVersion = -1;
+        emit capabilitiesChanged(m_d->m_capabilities);
+    });
 }
 
 Connection::~Connection()
@@ -251,8 +376,40 @@ bool Connection::sendMessage(const QString &message)
         return false;
     }
 
-    QByteArray msg = message.toUtf8();
-    QByteArray data = "MESSAGE " + QByteArray::number(msg.size()) + ' ' + msg;
+    QByteArray data = Protocol::encodeFrame(Protocol::PlainText, message.toUtf8(), m_d->m_framing);
+    return write(data) == data.size();
+}
+
+bool Connection::canRequestHistoryPage() const
+{
+    return m_d->m_capabilities & Protocol::CapabilityHistoryPaging;
+}
+
+bool Connection::requestHistoryPage(qint64 before, int limit)
+{
+    if (!canRequestHistoryPage()) {
+        return false;
+    }
+
+    const QByteArray request = "before=" + QByteArray::number(before) + Protocol::SeparatorToken +
+                               "limit=" + QByteArray::number(limit);
+    QByteArray data = Protocol::encodeFrame(Protocol::HistoryPage, request, m_d->m_framing);
+    return write(data) == data.size();
+}
+
+bool Connection::canJoinRoom() const
+{
+    return m_d->m_capabilities & Protocol::CapabilityRooms;
+}
+
+bool Connection::joinRoom(const QString &room)
+{
+    if (!canJoinRoom()) {
+        return false;
+    }
+
+    QByteArray data = room.isEmpty() ? Protocol::encodeFrame(Protocol::LeaveRoom, QByteArray(), m_d->m_framing)
+                                     : Protocol::encodeFrame(Protocol::JoinRoom, room.toUtf8(), m_d->m_framing);
     return write(data) == data.size();
 }
 
@@ -271,17 +428,24 @@ void Connection::processReadyRead()
         sendGreetingMessage();
     }
 
-    do {
-        if (m_d->m_currentDataType == Undefined) {
-            if (!m_d->readProtocolHeader()) {
-                return;
-            }
+    if (m_d->m_decoder.readFrom(this) <= 0) {
+        return;
+    }
+
+    FrameDecoder::Frame frame;
+    forever {
+        const FrameDecoder::Status status = m_d->m_decoder.next(&frame);
+        if (status == FrameDecoder::NeedMoreData) {
+            break;
         }
-        if (!m_d->hasEnoughData()) {
+        if (status == FrameDecoder::Malformed) {
+            abort();
             return;
         }
-        m_d->processData();
-    } while (bytesAvailable() > 0);
+        m_d->processFrame(frame);
+    }
+
+    m_d->updateTransferTimer();
 }
 
 void Connection::sendPing()
@@ -291,14 +455,15 @@ void Connection::sendPing()
         return;
     }
 
-    write("PING 1 p");
+    write(Protocol::controlFrame(Protocol::Ping, m_d->m_framing));
 }
 
 void Connection::sendGreetingMessage()
 {
-    QByteArray greeting = m_d->m_greetingMessage.toUtf8();
-    QByteArray data = "GREETING " + QByteArray::number(greeting.size()) + ' ' + greeting;
+    QByteArray data = Protocol::encodeFrame(Protocol::Greeting, m_d->m_greetingMessage.toUtf8(), Protocol::TextFraming);
     if (write(data) == data.size()) {
         m_d->m_isGreetingMessageSent = true;
+        // второй GREETING со списком возможностей, старый сервер его пропустит
+        write(Protocol::encodeFrame(Protocol::Greeting, Protocol::capabilityNames(SupportedCapabilities), Protocol::TextFraming));
     }
 }
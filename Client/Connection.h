@@ -1,5 +1,7 @@
 #pragma once
 
+#include "ChatEvent.h"
+
 #include <QHostAddress>
 #include <QString>
 #include <QTcpSocket>
@@ -19,18 +21,6 @@ public:
         ReadingGreeting,
         ReadyForUse
     };
-    enum DataType {
-        PlainText,
-        Ping,
-        Pong,
-        Greeting,
-        History,
-        Participants,
-        Leave,
-        Join,
-        NameError,
-        Undefined
-    };
 public:
     explicit Connection(QObject *parent = nullptr);
     ~Connection();
@@ -40,14 +30,24 @@ public:
     quint16 port() const;
     void setGreetingMessage(const QString &message);
     bool sendMessage(const QString &message);
+    bool canRequestHistoryPage() const;
+    bool requestHistoryPage(qint64 before, int limit);
+    bool canJoinRoom() const;
+    bool joinRoom(const QString& room);
 signals:
     void readyForUse();
-    void historyReceived(const QJsonArray& history);
-    void newMessage(const QJsonObject& message);
+    void historyReceived(const QVector<ChatMessage>& history);
+    void historyPageReceived(const QVector<ChatMessage>& page);
+    void newMessage(const ChatMessage& message);
     void participantsReceived(const QJsonArray& participants);
     void participantLeft(const QJsonObject& participant);
     void participantJoin(const QJsonObject& participant);
+    void presenceAdded(const QJsonObject& participant);
+    void presenceRemoved(const QJsonObject& participant);
+    void messagesMissed(int count);
+    void roomJoined(const QString& room);
     void nameError();
+    void capabilitiesChanged(quint32 capabilities);
 protected:
     void timerEvent(QTimerEvent *timerEvent) override;
 private slots:
@@ -0,0 +1,221 @@
+#include "NetworkThread.h"
+#include "ChatEventQueue.h"
+#include "Connection.h"
+#include "Protocol.h"
+
+#include <QAtomicInt>
+#include <QThread>
+
+//-----------------------------------------------------------------------//
+//  NetworkThread::Pimpl                                                 //
+//-----------------------------------------------------------------------//
+
+class NetworkThread::Pimpl {
+public:
+    Pimpl(NetworkThread* parent);
+public:
+    void bind();
+    void post(const ChatEvent& event);
+public:
+    QThread* m_thread = nullptr;
+    Connection* m_connection = nullptr; /*!< Живёт в m_thread, трогать только через invokeMethod */
+    ChatEventQueue m_queue;
+    QAtomicInt m_capabilities; /*!< Копия возможностей соединения для потока интерфейса */
+    NetworkThread* m_parent = nullptr;
+};
+
+NetworkThread::Pimpl::Pimpl(NetworkThread *parent) :
+    m_parent(parent)
+{
+}
+
+void NetworkThread::Pimpl::bind()
+{
+    // обработчики выполняются в сетевом потоке, где payload уже разобран
+    QObject::connect(m_connection, &Connection::newMessage,
+                     m_connection, [this](const ChatMessage& msg){
+        ChatEvent event;
+        event.type = ChatEvent::Message;
+        event.messages.append(msg);
+        post(event);
+    });
+    QObject::connect(m_connection, &Connection::historyReceived,
+                     m_connection, [this](const QVector<ChatMessage>& history){
+        ChatEvent event;
+        event.type = ChatEvent::History;
+        event.messages = history;
+        post(event);
+    });
+    QObject::connect(m_connection, &Connection::historyPageReceived,
+                     m_connection, [this](const QVector<ChatMessage>& page){
+        ChatEvent event;
+        event.type = ChatEvent::HistoryPage;
+        event.messages = page;
+        post(event);
+    });
+    QObject::connect(m_connection, &Connection::participantJoin,
+                     m_connection, [this](const QJsonObject& participant){
+        ChatEvent event;
+        event.type = ChatEvent::ParticipantJoin;
+        event.participant = participant;
+        post(event);
+    });
+    QObject::connect(m_connection, &Connection::participantLeft,
+                     m_connection, [this](const QJsonObject& participant){
+        ChatEvent event;
+        event.type = ChatEvent::ParticipantLeft;
+        event.participant = participant;
+        post(event);
+    });
+    QObject::connect(m_connection, &Connection::participantsReceived,
+                     m_connection, [this](const QJsonArray& participants){
+        ChatEvent event;
+        event.type = ChatEvent::Participants;
+        event.participants = participants;
+        post(event);
+    });
+    QObject::connect(m_connection, &Connection::presenceAdded,
+                     m_connection, [this](const QJsonObject& participant){
+        ChatEvent event;
+        event.type = ChatEvent::PresenceAdded;
+        event.participant = participant;
+        post(event);
+    });
+    QObject::connect(m_connection, &Connection::presenceRemoved,
+                     m_connection, [this](const QJsonObject& participant){
+        ChatEvent event;
+        event.type = ChatEvent::PresenceRemoved;
+        event.participant = participant;
+        post(event);
+    });
+    QObject::connect(m_connection, &Connection::messagesMissed,
+                     m_connection, [this](int count){
+        ChatEvent event;
+        event.type = ChatEvent::Missed;
+        event.value = count;
+        post(event);
+    });
+    QObject::connect(m_connection, &Connection::roomJoined,
+                     m_connection, [this](const QString& room){
+        ChatEvent event;
+        event.type = ChatEvent::RoomJoined;
+        event.room = room;
+        post(event);
+    });
+    QObject::connect(m_connection, &Connection::nameError,
+                     m_connection, [this](){
+        ChatEvent event;
+        event.type = ChatEvent::NameError;
+        post(event);
+    });
+    QObject::connect(m_connection, &Connection::stateChanged,
+                     m_connection, [this](QAbstractSocket::SocketState state){
+        ChatEvent event;
+        event.type = ChatEvent::StateChanged;
+        event.value = state;
+        post(event);
+    });
+    QObject::connect(m_connection, &Connection::capabilitiesChanged,
+                     m_connection, [this](quint32 capabilities){
+        m_capabilities.store(static_cast<int>(capabilities));
+    });
+}
+
+void NetworkThread::Pimpl::post(const ChatEvent &event)
+{
+    // будим поток интерфейса один раз на пачку: пока он не забрал очередь,
+    // новые события просто к ней добавляются
+    if (m_queue.push(event)) {
+        QMetaObject::invokeMethod(m_parent, [this](){
+            emit m_parent->eventsReady();
+        }, Qt::QueuedConnection);
+    }
+}
+
+//-----------------------------------------------------------------------//
+//  NetworkThread                                                        //
+//-----------------------------------------------------------------------//
+
+NetworkThread::NetworkThread(QObject *parent) :
+    QObject(parent)
+{
+    m_d = new Pimpl(this);
+    m_d->m_thread = new QThread;
+    m_d->m_thread->setObjectName(QStringLiteral("Network"));
+    m_d->m_connection = new Connection;
+    m_d->m_connection->moveToThread(m_d->m_thread);
+    m_d->bind();
+    connect(m_d->m_thread, &QThread::finished,
+            m_d->m_connection, &QObject::deleteLater);
+    m_d->m_thread->start();
+}
+
+NetworkThread::~NetworkThread()
+{
+    Connection* connection = m_d->m_connection;
+    QMetaObject::invokeMethod(connection, [connection](){
+        connection->abort();
+    }, Qt::BlockingQueuedConnection);
+    m_d->m_thread->quit();
+    m_d->m_thread->wait();
+    delete m_d->m_thread;
+    delete m_d;
+}
+
+void NetworkThread::connectToHost(const QString &ip, quint16 port, const QString &greeting)
+{
+    Connection* connection = m_d->m_connection;
+    QMetaObject::invokeMethod(connection, [connection, ip, port, greeting](){
+        connection->setGreetingMessage(greeting);
+        connection->connectToHost(ip, port);
+    }, Qt::QueuedConnection);
+}
+
+void NetworkThread::sendMessage(const QString &message)
+{
+    Connection* connection = m_d->m_connection;
+    QMetaObject::invokeMethod(connection, [connection, message](){
+        connection->sendMessage(message);
+    }, Qt::QueuedConnection);
+}
+
+bool NetworkThread::canRequestHistoryPage() const
+{
+    return m_d->m_capabilities.load() & Protocol::CapabilityHistoryPaging;
+}
+
+bool NetworkThread::requestHistoryPage(qint64 before, int limit)
+{
+    if (!canRequestHistoryPage()) {
+        return false;
+    }
+
+    Connection* connection = m_d->m_connection;
+    QMetaObject::invokeMethod(connection, [connection, before, limit](){
+        connection->requestHistoryPage(before, limit);
+    }, Qt::QueuedConnection);
+    return true;
+}
+
+bool NetworkThread::canJoinRoom() const
+{
+    return m_d->m_capabilities.load() & Protocol::CapabilityRooms;
+}
+
+bool NetworkThread::joinRoom(const QString &room)
+{
+    if (!canJoinRoom()) {
+        return false;
+    }
+
+    Connection* connection = m_d->m_connection;
+    QMetaObject::invokeMethod(connection, [connection, room](){
+        connection->joinRoom(room);
+    }, Qt::QueuedConnection);
+    return true;
+}
+
+QVector<ChatEvent> NetworkThread::takeEvents()
+{
+    return m_d->m_queue.takeAll();
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "ChatEvent.h"
+
+#include <QObject>
+#include <QVector>
+
+//-----------------------------------------------------------------------//
+//  NetworkThread                                                        //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Сокет, разбор кадров и JSON клиента в отдельном потоке. Сам объект живёт
+ * в потоке интерфейса: команды уходят соединению очередью вызовов, события
+ * возвращаются через ChatEventQueue и забираются пачкой по eventsReady().
+ */
+class NetworkThread : public QObject {
+    Q_OBJECT
+public:
+    explicit NetworkThread(QObject *parent = nullptr);
+    ~NetworkThread();
+public:
+    void connectToHost(const QString& ip, quint16 port, const QString& greeting);
+    void sendMessage(const QString& message);
+    bool canRequestHistoryPage() const;
+    bool requestHistoryPage(qint64 before, int limit);
+    bool canJoinRoom() const;
+    bool joinRoom(const QString& room);
+    QVector<ChatEvent> takeEvents();
+signals:
+    void eventsReady();
+private:
+    class Pimpl;
+    Pimpl* m_d;
+};
@@ -1,5 +1,10 @@
 #include "SortFilterProxyModel.h"
 #include "ChatDialogListModel.h"
+#include <QBitArray>
+#include <algorithm>
+
+// сколько удалённых документов терпим, прежде чем перенумеровать индекс
+static const int CompactThreshold = 1024;
 
 //-----------------------------------------------------------------------//
 //  SortFilterProxyModel                                                 //
@@ -10,9 +15,43 @@ public:
     Pimpl(SortFilterProxyModel* parent);
     bool filterIsOk(int sourceRow, const QModelIndex& sourceParent) const;
     bool serviceIsOk(int sourceRow, const QModelIndex& sourceParent) const;
+    QString documentText(int sourceRow) const;
+    quint32 addDocument(const QString& text);
+    void removeDocument(quint32 doc);
+    bool documentMatches(quint32 doc) const;
+    void indexRows(int first, int last);
+    void removeRows(int first, int last);
+    void reindexRows(int first, int last);
+    void rebuild();
+    void compact();
+    void updateMatches();
+    static QString fold(const QString& text);
+    static QVector<quint64> trigrams(const QString& folded);
+public:
+    struct SortKey {
+        qint64 number = 0;
+        int text = -1; /*!< Номер строки в m_strings, -1 — ключ числовой */
+    };
+    SortKey sortKey(int sourceRow);
+    int intern(const QString& text);
+    int compare(const SortKey& left, const SortKey& right) const;
+    void ensureKeys(int role);
+    void updateKeys(int first, int last);
 public:
     QString m_filter;
+    QString m_foldedFilter;
     QList< int > m_roles;
+    QAbstractItemModel* m_source = nullptr;
+    QVector<quint32> m_rowDocs; /*!< Номер документа индекса для каждой строки исходной модели */
+    QHash<quint32, QString> m_texts; /*!< Текст для поиска по документу, в нижнем регистре */
+    QHash<quint64, QVector<quint32>> m_postings; /*!< Триграмма -> документы по возрастанию */
+    QBitArray m_matches; /*!< Документы, прошедшие текущий фильтр */
+    quint32 m_nextDoc = 0;
+    int m_dead = 0;
+    QVector<SortKey> m_rowKeys; /*!< Ключ сортировки для каждой строки исходной модели */
+    QVector<QString> m_strings; /*!< Строковые ключи, каждый хранится один раз */
+    QHash<QString, int> m_stringIds;
+    int m_keyRole = -1; /*!< Роль, по которой построены m_rowKeys; -1 — не построены */
     bool m_showServiceMessages = true;
     SortFilterProxyModel* m_parent = nullptr;
 };
@@ -24,17 +63,11 @@ SortFilterProxyModel::Pimpl::Pimpl(SortFilterProxyModel *parent) :
 
 bool SortFilterProxyModel::Pimpl::filterIsOk(int sourceRow, const QModelIndex& sourceParent) const
 {
+    Q_UNUSED(sourceParent)
     if ( !m_filter.isEmpty() ){
-        if ( QAbstractItemModel* srcModel = static_cast<QAbstractItemModel*>(m_parent->sourceModel()) ){
-            QModelIndex index = srcModel->index(sourceRow,0, sourceParent);
-            for( int role: m_roles ){
-                if ( m_parent->filterAcceptRole( role ) ){
-                    QString srcData = index.data(role).toString();
-                    if ( srcData.contains( m_filter, Qt::CaseInsensitive) ){
-                        return true;
-                    }
-                }
-            }
+        if ( (sourceRow >= 0) && (sourceRow < m_rowDocs.size()) ){
+            const quint32 doc = m_rowDocs.at(sourceRow);
+            return ( doc < static_cast<quint32>(m_matches.size()) ) && m_matches.testBit(doc);
         }
         return false;
     }
@@ -59,6 +92,259 @@ bool SortFilterProxyModel::Pimpl::serviceIsOk(int sourceRow, const QModelIndex &
     }
 }
 
+QString SortFilterProxyModel::Pimpl::fold(const QString &text)
+{
+    return text.toCaseFolded();
+}
+
+QVector<quint64> SortFilterProxyModel::Pimpl::trigrams(const QString &folded)
+{
+    QVector<quint64> result;
+    for (int i = 0; i + 2 < folded.size(); ++i) {
+        result.append( (quint64(folded.at(i).unicode()) << 32) |
+                       (quint64(folded.at(i + 1).unicode()) << 16) |
+                        quint64(folded.at(i + 2).unicode()) );
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+QString SortFilterProxyModel::Pimpl::documentText(int sourceRow) const
+{
+    // те же роли, что проверялись раньше в filterIsOk; data() зовём один раз на строку.
+    // Текст сообщения берётся исходный: в отображаемом есть разметка подсветки ника
+    QStringList parts;
+    const QModelIndex index = m_source->index(sourceRow, 0);
+    for( int role: m_roles ){
+        if ( m_parent->filterAcceptRole( role ) ){
+            parts << index.data(role).toString();
+        }
+    }
+    return fold(parts.join(QLatin1Char('\n')));
+}
+
+quint32 SortFilterProxyModel::Pimpl::addDocument(const QString &text)
+{
+    const quint32 doc = m_nextDoc++;
+    m_texts.insert(doc, text);
+    for (quint64 gram : trigrams(text)) {
+        m_postings[gram].append(doc);
+    }
+    if (!m_filter.isEmpty()) {
+        m_matches.resize(static_cast<int>(m_nextDoc));
+        m_matches.setBit(static_cast<int>(doc), documentMatches(doc));
+    }
+    return doc;
+}
+
+void SortFilterProxyModel::Pimpl::removeDocument(quint32 doc)
+{
+    // из списков триграмм документ уйдёт при следующем сжатии
+    m_texts.remove(doc);
+    ++m_dead;
+}
+
+bool SortFilterProxyModel::Pimpl::documentMatches(quint32 doc) const
+{
+    const auto it = m_texts.constFind(doc);
+    return (it != m_texts.constEnd()) && it->contains(m_foldedFilter);
+}
+
+void SortFilterProxyModel::Pimpl::indexRows(int first, int last)
+{
+    QVector<quint32> docs;
+    docs.reserve(last - first + 1);
+    for (int row = first; row <= last; ++row) {
+        docs.append(addDocument(documentText(row)));
+    }
+    m_rowDocs.insert(first, docs.size(), 0);
+    std::copy(docs.cbegin(), docs.cend(), m_rowDocs.begin() + first);
+    if (m_keyRole >= 0) {
+        m_rowKeys.insert(first, docs.size(), SortKey());
+        updateKeys(first, last);
+    }
+}
+
+void SortFilterProxyModel::Pimpl::removeRows(int first, int last)
+{
+    for (int row = first; row <= last; ++row) {
+        removeDocument(m_rowDocs.at(row));
+    }
+    m_rowDocs.remove(first, last - first + 1);
+    if (m_keyRole >= 0) {
+        m_rowKeys.remove(first, last - first + 1);
+    }
+    if ( (m_dead > CompactThreshold) && (m_dead > m_texts.size()) ) {
+        compact();
+    }
+}
+
+void SortFilterProxyModel::Pimpl::reindexRows(int first, int last)
+{
+    for (int row = first; row <= last; ++row) {
+        removeDocument(m_rowDocs.at(row));
+        m_rowDocs[row] = addDocument(documentText(row));
+    }
+    if ( (m_dead > CompactThreshold) && (m_dead > m_texts.size()) ) {
+        compact();
+    }
+}
+
+void SortFilterProxyModel::Pimpl::rebuild()
+{
+    m_rowDocs.clear();
+    m_rowKeys.clear();
+    m_strings.clear();
+    m_stringIds.clear();
+    m_keyRole = -1;
+    m_texts.clear();
+    m_postings.clear();
+    m_matches.clear();
+    m_nextDoc = 0;
+    m_dead = 0;
+    if (m_source && (m_source->rowCount() > 0)) {
+        indexRows(0, m_source->rowCount() - 1);
+    }
+}
+
+void SortFilterProxyModel::Pimpl::compact()
+{
+    // перенумеровываем живые документы подряд, data() при этом не нужен
+    QVector<QString> texts;
+    texts.reserve(m_rowDocs.size());
+    for (quint32 doc : m_rowDocs) {
+        texts.append(m_texts.value(doc));
+    }
+    m_texts.clear();
+    m_postings.clear();
+    m_matches.clear();
+    m_nextDoc = 0;
+    m_dead = 0;
+    for (int row = 0; row < texts.size(); ++row) {
+        m_rowDocs[row] = addDocument(texts.at(row));
+    }
+}
+
+void SortFilterProxyModel::Pimpl::updateMatches()
+{
+    m_matches = QBitArray(static_cast<int>(m_nextDoc));
+    if (m_foldedFilter.isEmpty()) {
+        return;
+    }
+
+    const QVector<quint64> grams = trigrams(m_foldedFilter);
+    if (grams.isEmpty()) {
+        // короче триграммы: просто проходим по сохранённым строкам
+        for (auto it = m_texts.constBegin(); it != m_texts.constEnd(); ++it) {
+            if (it->contains(m_foldedFilter)) {
+                m_matches.setBit(static_cast<int>(it.key()));
+            }
+        }
+        return;
+    }
+
+    QVector<const QVector<quint32>*> lists;
+    for (quint64 gram : grams) {
+        const auto it = m_postings.constFind(gram);
+        if (it == m_postings.constEnd()) {
+            return;
+        }
+        lists.append(&it.value());
+    }
+    std::sort(lists.begin(), lists.end(), [](const QVector<quint32>* a, const QVector<quint32>* b){
+        return a->size() < b->size();
+    });
+
+    QBitArray candidates(static_cast<int>(m_nextDoc));
+    for (quint32 doc : *lists.first()) {
+        candidates.setBit(static_cast<int>(doc));
+    }
+    for (int i = 1; i < lists.size(); ++i) {
+        QBitArray bits(static_cast<int>(m_nextDoc));
+        for (quint32 doc : *lists.at(i)) {
+            bits.setBit(static_cast<int>(doc));
+        }
+        candidates &= bits;
+    }
+    // триграммы дают только кандидатов, подстроку проверяем на них
+    for (quint32 doc : *lists.first()) {
+        if (candidates.testBit(static_cast<int>(doc)) && documentMatches(doc)) {
+            m_matches.setBit(static_cast<int>(doc));
+        }
+    }
+}
+
+SortFilterProxyModel::Pimpl::SortKey SortFilterProxyModel::Pimpl::sortKey(int sourceRow)
+{
+    // строка "hh:mm:ss" не упорядочена через полночь, сортируем по метке времени
+    const int role = (m_keyRole == ChatDialogListModel::DATAROLE_DATE_TIME) ? int(ChatDialogListModel::DATAROLE_TIMESTAMP) : m_keyRole;
+    const QVariant value = m_source->index(sourceRow, 0).data(role);
+    SortKey key;
+    switch (value.userType()) {
+    case QMetaType::Bool:
+    case QMetaType::Short:
+    case QMetaType::UShort:
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+    case QMetaType::Double:
+        key.number = value.toLongLong();
+        break;
+    default:
+        key.text = intern(value.toString());
+        break;
+    }
+    return key;
+}
+
+int SortFilterProxyModel::Pimpl::intern(const QString &text)
+{
+    const auto it = m_stringIds.constFind(text);
+    if (it != m_stringIds.constEnd()) {
+        return it.value();
+    }
+    m_strings.append(text);
+    m_stringIds.insert(text, m_strings.size() - 1);
+    return m_strings.size() - 1;
+}
+
+int SortFilterProxyModel::Pimpl::compare(const SortKey &left, const SortKey &right) const
+{
+    if ( (left.text < 0) && (right.text < 0) ) {
+        return (left.number < right.number) ? -1 : (left.number > right.number ? 1 : 0);
+    }
+    if ( (left.text < 0) || (right.text < 0) ) {
+        return (left.text < 0) ? -1 : 1;
+    }
+    if (left.text == right.text) {
+        return 0;
+    }
+    return m_strings.at(left.text).compare(m_strings.at(right.text));
+}
+
+void SortFilterProxyModel::Pimpl::ensureKeys(int role)
+{
+    if ( (role == m_keyRole) && (m_rowKeys.size() == m_rowDocs.size()) ) {
+        return;
+    }
+    m_keyRole = role;
+    m_strings.clear();
+    m_stringIds.clear();
+    m_rowKeys.fill(SortKey(), m_rowDocs.size());
+    if (!m_rowKeys.isEmpty()) {
+        updateKeys(0, m_rowKeys.size() - 1);
+    }
+}
+
+void SortFilterProxyModel::Pimpl::updateKeys(int first, int last)
+{
+    for (int row = first; row <= last; ++row) {
+        m_rowKeys[row] = sortKey(row);
+    }
+}
+
 //-----------------------------------------------------------------------//
 //  SortFilterProxyModel                                                 //
 //-----------------------------------------------------------------------//
@@ -106,9 +392,20 @@ void SortFilterProxyModel::setSourceModel( QAbstractItemModel* model )
             this, &SortFilterProxyModel::onRowsCountChanged);
         disconnect(oldModel, &QAbstractItemModel::layoutChanged,
             this, &SortFilterProxyModel::onRowsCountChanged);
+        disconnect(oldModel, &QAbstractItemModel::rowsInserted,
+            this, &SortFilterProxyModel::onSourceRowsInserted);
+        disconnect(oldModel, &QAbstractItemModel::rowsRemoved,
+            this, &SortFilterProxyModel::onSourceRowsRemoved);
+        disconnect(oldModel, &QAbstractItemModel::dataChanged,
+            this, &SortFilterProxyModel::onSourceDataChanged);
+        disconnect(oldModel, &QAbstractItemModel::modelReset,
+            this, &SortFilterProxyModel::onSourceReset);
+        disconnect(oldModel, &QAbstractItemModel::layoutChanged,
+            this, &SortFilterProxyModel::onSourceReset);
     }
 
     m_d->m_roles.clear();
+    m_d->m_source = model;
     if ( model ){
         QHash< int, QByteArray > roles = model->roleNames();
         auto it  = roles.begin();
@@ -125,7 +422,19 @@ void SortFilterProxyModel::setSourceModel( QAbstractItemModel* model )
             this, &SortFilterProxyModel::onRowsCountChanged);
         connect(model, &QAbstractItemModel::layoutChanged,
             this, &SortFilterProxyModel::onRowsCountChanged);
+        // индекс обновляется до того, как базовый класс станет фильтровать изменённые строки
+        connect(model, &QAbstractItemModel::rowsInserted,
+            this, &SortFilterProxyModel::onSourceRowsInserted);
+        connect(model, &QAbstractItemModel::rowsRemoved,
+            this, &SortFilterProxyModel::onSourceRowsRemoved);
+        connect(model, &QAbstractItemModel::dataChanged,
+            this, &SortFilterProxyModel::onSourceDataChanged);
+        connect(model, &QAbstractItemModel::modelReset,
+            this, &SortFilterProxyModel::onSourceReset);
+        connect(model, &QAbstractItemModel::layoutChanged,
+            this, &SortFilterProxyModel::onSourceReset);
     }
+    m_d->rebuild();
     QSortFilterProxyModel::setSourceModel( model );
     emit sourceModelChanged(model);
 }
@@ -134,8 +443,10 @@ void SortFilterProxyModel::setFilter( const QString& filter )
 {
     if ( m_d->m_filter != filter ){
         m_d->m_filter = filter;
+        m_d->m_foldedFilter = Pimpl::fold(filter);
+        m_d->updateMatches();
         emit filterChanged(filter);
-        invalidate();
+        invalidateFilter();
     }
 }
 
@@ -204,11 +515,46 @@ void SortFilterProxyModel::onRowsCountChanged()
     emit stateContentChanged( stateContent() );
 }
 
+void SortFilterProxyModel::onSourceRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    if (!parent.isValid()) {
+        m_d->indexRows(first, last);
+    }
+}
+
+void SortFilterProxyModel::onSourceRowsRemoved(const QModelIndex &parent, int first, int last)
+{
+    if (!parent.isValid()) {
+        m_d->removeRows(first, last);
+    }
+}
+
+void SortFilterProxyModel::onSourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles)
+{
+    // модель перечисляет роли; пустой список по контракту Qt значит «все»
+    bool affected = roles.isEmpty();
+    for (int role : roles) {
+        affected = affected || filterAcceptRole(role);
+    }
+    if (affected && topLeft.isValid() && bottomRight.isValid()) {
+        m_d->reindexRows(topLeft.row(), bottomRight.row());
+    }
+    if ( (m_d->m_keyRole >= 0) && topLeft.isValid() && bottomRight.isValid() &&
+         (roles.isEmpty() || roles.contains(m_d->m_keyRole) || roles.contains(ChatDialogListModel::DATAROLE_TIMESTAMP)) ) {
+        m_d->updateKeys(topLeft.row(), bottomRight.row());
+    }
+}
+
+void SortFilterProxyModel::onSourceReset()
+{
+    m_d->rebuild();
+}
+
 
 bool SortFilterProxyModel::filterAcceptRole(int role ) const
 {
     return (role == ChatDialogListModel::DATAROLE_LOGIN) ||
-     (role == ChatDialogListModel::DATAROLE_MESSAGE) ||
+     (role == ChatDialogListModel::DATAROLE_TEXT) ||
      (role == ChatDialogListModel::DATAROLE_DATE_TIME);
 }
 
@@ -220,12 +566,16 @@ bool SortFilterProxyModel::filterAcceptsRow(int sourceRow, const QModelIndex& so
 
 bool SortFilterProxyModel::lessThan(const QModelIndex& sourceLeft, const QModelIndex& sourceRight ) const
 {
-    QVariant leftData = sourceLeft.data(sortRole());
-    int leftRow = sourceLeft.row();
+    const int leftRow = sourceLeft.row();
+    const int rightRow = sourceRight.row();
+    if ( (sortRole() < 0) || !m_d->m_source ) {
+        return leftRow < rightRow;
+    }
 
-    QVariant rightData = sourceRight.data(sortRole());
-    int rightRow = sourceRight.row();
+    // ключи достаются из модели один раз на строку, дальше сравниваются без QVariant
+    m_d->ensureKeys(sortRole());
+    const int order = m_d->compare(m_d->m_rowKeys.at(leftRow), m_d->m_rowKeys.at(rightRow));
 
-    return (sortOrder() == Qt::AscendingOrder) ? ( ( leftData < rightData ) || ( (leftData == rightData) && ( leftRow < rightRow ) ) ) :
-                                                 ( ( leftData < rightData ) || ( (leftData == rightData) && ( leftRow > rightRow ) ) );
+    return (sortOrder() == Qt::AscendingOrder) ? ( ( order < 0 ) || ( (order == 0) && ( leftRow < rightRow ) ) ) :
+                                                 ( ( order < 0 ) || ( (order == 0) && ( leftRow > rightRow ) ) );
 }
@@ -49,6 +49,10 @@ protected:
     bool lessThan(const QModelIndex& sourceLeft, const QModelIndex& sourceRight ) const override;
 private slots:
     void onRowsCountChanged();
+    void onSourceRowsInserted(const QModelIndex& parent, int first, int last);
+    void onSourceRowsRemoved(const QModelIndex& parent, int first, int last);
+    void onSourceDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles);
+    void onSourceReset();
 private:
     class Pimpl;
     Pimpl* m_d;
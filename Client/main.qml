@@ -39,8 +39,12 @@ Controls.ApplicationWindow {
         onNewTextMessage: {
             mainWindow.requestActivate();
             if (mainWindow.visibility == Window.Minimized) {
-                ++newCount;
-                tray.showMessage(qsTr("New messages"), qsTr("%1: %2").arg(login).arg(message))
+                newCount += count;
+                if (count > 1) {
+                    tray.showMessage(qsTr("New messages"), qsTr("%1: %2 (+%3)").arg(login).arg(message).arg(count - 1))
+                } else {
+                    tray.showMessage(qsTr("New messages"), qsTr("%1: %2").arg(login).arg(message))
+                }
             }
         }
         onConnectionStateChanged: {
@@ -130,7 +134,8 @@ Controls.ApplicationWindow {
                     centerIn: parent
                 }
                 color: "white"
-                text: dialogModel.chatters.length < 2 ? qsTr("Launch several instances of this program and start chatting!") : qsTr("Chat")
+                text: dialogModel.room.length > 0 ? qsTr("Room: %1").arg(dialogModel.room)
+                                                  : dialogModel.chatters.length < 2 ? qsTr("Launch several instances of this program and start chatting!") : qsTr("Chat")
                 font.pixelSize: 14
             }
         }
@@ -155,6 +160,12 @@ Controls.ApplicationWindow {
                 source: "search.svg"
                 onClicked: searchPopup.open()
             }
+            IconButton {
+                id: roomButton
+                anchors.verticalCenter: parent.verticalCenter
+                source: "group.svg"
+                onClicked: roomPopup.open()
+            }
         }
 
         ThinDivider {
@@ -223,6 +234,31 @@ Controls.ApplicationWindow {
         }
     }
 
+    Controls.Popup {
+        id: roomPopup
+        x: actionsRow.mapFromItem(roomButton, 0, roomButton.x).x + roomButton.width
+        y: actionsRow.mapFromItem(roomButton, 0, roomButton.y).y + roomButton.height
+        width: roomField.width + 30
+        height: roomField.implicitHeight + 30
+        focus: true
+        transformOrigin: Controls.Popup.TopLeft
+        Controls.TextField {
+            id: roomField
+            anchors.centerIn: parent
+            width: 200
+            maximumLength: 64
+            placeholderText: qsTr("Room (empty for lobby)")
+            onAccepted: {
+                dialogModel.joinRoom(text);
+                roomPopup.close();
+            }
+        }
+        onOpened: {
+            roomField.text = dialogModel.room
+            roomField.forceActiveFocus()
+        }
+    }
+
 
     Scrollbar {
         flickableItem: messagesListView
@@ -248,8 +284,26 @@ Controls.ApplicationWindow {
             color: subTextColor
         }
 
+        // fetchingOlder виден только во время самой вставки, а count меняется
+        // позже, когда ListView применит изменения модели
+        property bool keepPosition: false
+        Connections {
+            target: proxy
+            onRowsInserted: {
+                if (dialogModel.fetchingOlder) {
+                    messagesListView.keepPosition = true
+                }
+            }
+        }
         onCountChanged: {
-            messagesListView.positionViewAtEnd()
+            // подгруженные сверху строки не должны сбрасывать прокрутку вниз
+            if (!keepPosition) {
+                messagesListView.positionViewAtEnd()
+            }
+            keepPosition = false
+        }
+        onAtYBeginningChanged: {
+            dialogModel.viewAtTop = atYBeginning && interactive
         }
         spacing: 10
 
@@ -319,7 +373,7 @@ Controls.ApplicationWindow {
                             text: chat_message
                             wrapMode: Text.WrapAtWordBoundaryOrAnywhere
                             color: textColor
-                            textFormat: dialogModel.isEmptyHtml(chat_message) ? Text.PlainText : Text.AutoText
+                            textFormat: chat_empty ? Text.PlainText : Text.AutoText
                         }
                     }
                 }
@@ -0,0 +1,311 @@
+#include "CborPayload.h"
+
+#include <QCborStreamReader>
+#include <QCborStreamWriter>
+#include <QtEndian>
+
+namespace {
+
+void writeParticipant(QCborStreamWriter& writer, const CborPayload::Participant& participant)
+{
+    const bool hasId = participant.id >= 0;
+    const bool hasAddress = !participant.name.isEmpty();
+    writer.startMap((hasId ? 1 : 0) + (hasAddress ? 3 : 0));
+    if (hasId) {
+        writer.append(CborPayload::KeyId);
+        writer.append(participant.id);
+    }
+    if (hasAddress) {
+        writer.append(CborPayload::KeyName);
+        writer.append(QStringView(participant.name));
+        writer.append(CborPayload::KeyIp);
+        writer.append(QStringView(participant.ip));
+        writer.append(CborPayload::KeyPort);
+        writer.append(participant.port);
+    }
+    writer.endMap();
+}
+
+bool readString(QCborStreamReader& reader, QString* out)
+{
+    if (!reader.isString()) {
+        return false;
+    }
+    // длинная строка может прийти кусками
+    QString result;
+    auto chunk = reader.readString();
+    while (chunk.status == QCborStreamReader::Ok) {
+        result += chunk.data;
+        chunk = reader.readString();
+    }
+    if (chunk.status == QCborStreamReader::Error) {
+        return false;
+    }
+    *out = result;
+    return true;
+}
+
+bool readInteger(QCborStreamReader& reader, qint64* out)
+{
+    if (!reader.isInteger()) {
+        return false;
+    }
+    *out = reader.toInteger();
+    return reader.next();
+}
+
+bool readKey(QCborStreamReader& reader, quint64* key)
+{
+    if (!reader.isUnsignedInteger()) {
+        return false;
+    }
+    *key = reader.toUnsignedInteger();
+    return reader.next();
+}
+
+bool readMessage(QCborStreamReader& reader, CborPayload::Message* message)
+{
+    if (!reader.isMap() || !reader.enterContainer()) {
+        return false;
+    }
+    while (reader.hasNext()) {
+        quint64 key = 0;
+        qint64 number = 0;
+        if (!readKey(reader, &key)) {
+            return false;
+        }
+        bool ok = true;
+        switch (key) {
+        case CborPayload::KeyName:      ok = readString(reader, &message->name); break;
+        case CborPayload::KeyIp:        ok = readString(reader, &message->ip); break;
+        case CborPayload::KeyMessage:   ok = readString(reader, &message->text); break;
+        case CborPayload::KeyPort:      ok = readInteger(reader, &number); message->port = static_cast<int>(number); break;
+        case CborPayload::KeyTimestamp: ok = readInteger(reader, &message->timestamp); break;
+        case CborPayload::KeySequence:  ok = readInteger(reader, &message->sequence); break;
+        default:                        ok = reader.next(); break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return reader.leaveContainer();
+}
+
+bool readParticipant(QCborStreamReader& reader, CborPayload::Participant* participant)
+{
+    if (!reader.isMap() || !reader.enterContainer()) {
+        return false;
+    }
+    while (reader.hasNext()) {
+        quint64 key = 0;
+        qint64 number = 0;
+        if (!readKey(reader, &key)) {
+            return false;
+        }
+        bool ok = true;
+        switch (key) {
+        case CborPayload::KeyId:   ok = readInteger(reader, &participant->id); break;
+        case CborPayload::KeyName: ok = readString(reader, &participant->name); break;
+        case CborPayload::KeyIp:   ok = readString(reader, &participant->ip); break;
+        case CborPayload::KeyPort: ok = readInteger(reader, &number); participant->port = static_cast<int>(number); break;
+        default:                   ok = reader.next(); break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return reader.leaveContainer();
+}
+
+int reserveLength(const QCborStreamReader& reader, int payloadSize)
+{
+    // длина массива приходит от собеседника; элемент занимает хотя бы байт,
+    // поэтому больше элементов, чем байт в payload, не бывает
+    if (!reader.isLengthKnown()) {
+        return 0;
+    }
+    return static_cast<int>(qMin<quint64>(reader.length(), static_cast<quint64>(payloadSize)));
+}
+
+bool readParticipants(QCborStreamReader& reader, QVector<CborPayload::Participant>* participants, int payloadSize)
+{
+    if (!reader.isArray()) {
+        return false;
+    }
+    const int length = reserveLength(reader, payloadSize);
+    if (!reader.enterContainer()) {
+        return false;
+    }
+    participants->reserve(length);
+    while (reader.hasNext()) {
+        CborPayload::Participant participant;
+        if (!readParticipant(reader, &participant)) {
+            return false;
+        }
+        participants->append(participant);
+    }
+    return reader.leaveContainer();
+}
+
+}
+
+//-----------------------------------------------------------------------//
+//  CborPayload                                                          //
+//-----------------------------------------------------------------------//
+
+bool CborPayload::isCbor(const QByteArray &payload)
+{
+    // старшие типы 4 (массив) и 5 (словарь); JSON начинается с ASCII
+    if (payload.isEmpty()) {
+        return false;
+    }
+    const quint8 first = static_cast<quint8>(payload.at(0));
+    return (first >= 0x80) && (first <= 0xBF);
+}
+
+QByteArray CborPayload::encodeMessage(const Message &message)
+{
+    QByteArray result;
+    QCborStreamWriter writer(&result);
+    writer.startMap(6);
+    writer.append(KeyName);
+    writer.append(QStringView(message.name));
+    writer.append(KeyIp);
+    writer.append(QStringView(message.ip));
+    writer.append(KeyPort);
+    writer.append(message.port);
+    writer.append(KeyMessage);
+    writer.append(QStringView(message.text));
+    writer.append(KeyTimestamp);
+    writer.append(message.timestamp);
+    writer.append(KeySequence);
+    writer.append(message.sequence);
+    writer.endMap();
+    return result;
+}
+
+QByteArray CborPayload::encodeParticipant(const Participant &participant)
+{
+    QByteArray result;
+    QCborStreamWriter writer(&result);
+    writeParticipant(writer, participant);
+    return result;
+}
+
+QByteArray CborPayload::encodeParticipants(const QVector<Participant> &participants, qint64 version)
+{
+    QByteArray result;
+    QCborStreamWriter writer(&result);
+    // со снимком присутствия — словарь с версией, иначе просто массив
+    if (version >= 0) {
+        writer.startMap(2);
+        writer.append(KeyVersion);
+        writer.append(version);
+        writer.append(KeyParticipants);
+    }
+    writer.startArray(participants.size());
+    for (const Participant& participant : participants) {
+        writeParticipant(writer, participant);
+    }
+    writer.endArray();
+    if (version >= 0) {
+        writer.endMap();
+    }
+    return result;
+}
+
+QByteArray CborPayload::encodeArray(const QVector<QByteArray> &items)
+{
+    // заголовок массива определённой длины, дальше элементы как есть
+    QByteArray result;
+    int length = 9;
+    for (const QByteArray& item : items) {
+        length += item.size();
+    }
+    result.reserve(length);
+
+    const quint32 count = static_cast<quint32>(items.size());
+    if (count < 24) {
+        result.append(static_cast<char>(0x80 | count));
+    }
+    else if (count <= 0xFF) {
+        result.append(static_cast<char>(0x98));
+        result.append(static_cast<char>(count));
+    }
+    else if (count <= 0xFFFF) {
+        char header[3] = { static_cast<char>(0x99) };
+        qToBigEndian<quint16>(static_cast<quint16>(count), header + 1);
+        result.append(header, sizeof(header));
+    }
+    else {
+        char header[5] = { static_cast<char>(0x9A) };
+        qToBigEndian<quint32>(count, header + 1);
+        result.append(header, sizeof(header));
+    }
+    for (const QByteArray& item : items) {
+        result.append(item);
+    }
+    return result;
+}
+
+bool CborPayload::decodeMessage(const QByteArray &payload, Message *message)
+{
+    QCborStreamReader reader(payload);
+    return readMessage(reader, message);
+}
+
+bool CborPayload::decodeMessages(const QByteArray &payload, QVector<Message> *messages)
+{
+    QCborStreamReader reader(payload);
+    if (!reader.isArray()) {
+        return false;
+    }
+    const int length = reserveLength(reader, payload.size());
+    if (!reader.enterContainer()) {
+        return false;
+    }
+    messages->reserve(length);
+    while (reader.hasNext()) {
+        Message message;
+        if (!readMessage(reader, &message)) {
+            return false;
+        }
+        messages->append(message);
+    }
+    return reader.leaveContainer();
+}
+
+bool CborPayload::decodeParticipant(const QByteArray &payload, Participant *participant)
+{
+    QCborStreamReader reader(payload);
+    return readParticipant(reader, participant);
+}
+
+bool CborPayload::decodeParticipants(const QByteArray &payload, QVector<Participant> *participants, qint64 *version)
+{
+    QCborStreamReader reader(payload);
+    *version = -1;
+    if (reader.isArray()) {
+        return readParticipants(reader, participants, payload.size());
+    }
+
+    if (!reader.isMap() || !reader.enterContainer()) {
+        return false;
+    }
+    while (reader.hasNext()) {
+        quint64 key = 0;
+        if (!readKey(reader, &key)) {
+            return false;
+        }
+        bool ok = true;
+        switch (key) {
+        case KeyVersion:      ok = readInteger(reader, version); break;
+        case KeyParticipants: ok = readParticipants(reader, participants, payload.size()); break;
+        default:              ok = reader.next(); break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return reader.leaveContainer();
+}
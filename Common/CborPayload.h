@@ -0,0 +1,60 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+//-----------------------------------------------------------------------//
+//  CborPayload                                                          //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Двоичная замена JSON для MESSAGE, JOIN, LEAVE, PARTICIPANTS и HISTORY,
+ * согласуется возможностью "cbor". Объекты — CBOR-словари с целыми ключами,
+ * порт и время — целые числа. Пишется и читается потоком, без дерева.
+ * Первый байт такого payload не бывает '{' или '[', поэтому клиент различает
+ * форматы по самому кадру.
+ */
+namespace CborPayload {
+
+enum Key {
+    KeyId = 0,
+    KeyName = 1,
+    KeyIp = 2,
+    KeyPort = 3,
+    KeyMessage = 4,
+    KeyTimestamp = 5, /*!< мс от эпохи */
+    KeySequence = 6,
+    KeyVersion = 7,
+    KeyParticipants = 8
+};
+
+struct Participant {
+    qint64 id = -1; /*!< -1 — без id, как LEAVE для клиентов без "sessions" */
+    QString name; /*!< Пустое — только id, как LEAVE с "sessions" */
+    QString ip;
+    int port = 0;
+};
+
+struct Message {
+    qint64 sequence = 0;
+    QString name;
+    QString ip;
+    int port = 0;
+    QString text;
+    qint64 timestamp = 0;
+};
+
+bool isCbor(const QByteArray& payload);
+
+QByteArray encodeMessage(const Message& message);
+QByteArray encodeParticipant(const Participant& participant);
+QByteArray encodeParticipants(const QVector<Participant>& participants, qint64 version = -1);
+QByteArray encodeArray(const QVector<QByteArray>& items); /*!< Массив из уже закодированных элементов */
+
+bool decodeMessage(const QByteArray& payload, Message* message);
+bool decodeMessages(const QByteArray& payload, QVector<Message>* messages);
+bool decodeParticipant(const QByteArray& payload, Participant* participant);
+bool decodeParticipants(const QByteArray& payload, QVector<Participant>* participants, qint64* version);
+
+}
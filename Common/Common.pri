@@ -0,0 +1,9 @@
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += $$PWD/*.cpp
+
+HEADERS += $$PWD/*.h
+
+# сжатие кадров (Compression.cpp)
+LIBS += -lz
@@ -0,0 +1,132 @@
+#include "Compression.h"
+
+#include <zlib.h>
+
+#include <cstring>
+
+// окно 8 КБ вместо 32 КБ: контекст deflate занимает ~64 КБ на соединение
+static const int WindowBits = 13;
+static const int MemoryLevel = 6;
+static const int CompressionLevel = 6;
+static const char SyncTail[] = { '\x00', '\x00', '\xff', '\xff' };
+static const int SyncTailSize = 4;
+
+//-----------------------------------------------------------------------//
+//  DeflateStream                                                        //
+//-----------------------------------------------------------------------//
+
+DeflateStream::DeflateStream()
+{
+}
+
+DeflateStream::~DeflateStream()
+{
+    reset();
+}
+
+bool DeflateStream::compress(const QByteArray &data, QByteArray *out)
+{
+    if (!m_stream) {
+        m_stream = new z_stream;
+        m_stream->zalloc = Z_NULL;
+        m_stream->zfree = Z_NULL;
+        m_stream->opaque = Z_NULL;
+        if (deflateInit2(m_stream, CompressionLevel, Z_DEFLATED, -WindowBits, MemoryLevel, Z_DEFAULT_STRATEGY) != Z_OK) {
+            delete m_stream;
+            m_stream = nullptr;
+            return false;
+        }
+    }
+
+    out->resize(static_cast<int>(deflateBound(m_stream, static_cast<uLong>(data.size()))) + SyncTailSize + 8);
+    m_stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    m_stream->avail_in = static_cast<uInt>(data.size());
+    m_stream->next_out = reinterpret_cast<Bytef*>(out->data());
+    m_stream->avail_out = static_cast<uInt>(out->size());
+    if ( (deflate(m_stream, Z_SYNC_FLUSH) != Z_OK) || (m_stream->avail_in != 0) ) {
+        // поток испорчен, продолжать его нельзя: клиент его уже не разберёт
+        reset();
+        return false;
+    }
+
+    int size = out->size() - static_cast<int>(m_stream->avail_out);
+    if ( (size >= SyncTailSize) && (std::memcmp(out->constData() + size - SyncTailSize, SyncTail, SyncTailSize) == 0) ) {
+        size -= SyncTailSize;
+    }
+    out->resize(size);
+    return true;
+}
+
+void DeflateStream::reset()
+{
+    if (m_stream) {
+        deflateEnd(m_stream);
+        delete m_stream;
+        m_stream = nullptr;
+    }
+}
+
+//-----------------------------------------------------------------------//
+//  InflateStream                                                        //
+//-----------------------------------------------------------------------//
+
+InflateStream::InflateStream()
+{
+}
+
+InflateStream::~InflateStream()
+{
+    reset();
+}
+
+bool InflateStream::decompress(const QByteArray &data, QByteArray *out, int maxSize)
+{
+    if (!m_stream) {
+        m_stream = new z_stream;
+        m_stream->zalloc = Z_NULL;
+        m_stream->zfree = Z_NULL;
+        m_stream->opaque = Z_NULL;
+        m_stream->next_in = Z_NULL;
+        m_stream->avail_in = 0;
+        if (inflateInit2(m_stream, -WindowBits) != Z_OK) {
+            delete m_stream;
+            m_stream = nullptr;
+            return false;
+        }
+    }
+
+    const QByteArray input = data + QByteArray::fromRawData(SyncTail, SyncTailSize);
+    m_stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.constData()));
+    m_stream->avail_in = static_cast<uInt>(input.size());
+
+    out->resize(qMin(qMax(data.size() * 4, 256), maxSize));
+    int produced = 0;
+    forever {
+        m_stream->next_out = reinterpret_cast<Bytef*>(out->data() + produced);
+        m_stream->avail_out = static_cast<uInt>(out->size() - produced);
+        const int result = inflate(m_stream, Z_SYNC_FLUSH);
+        produced = out->size() - static_cast<int>(m_stream->avail_out);
+        if ( (result != Z_OK) && (result != Z_BUF_ERROR) ) {
+            return false;
+        }
+        if (m_stream->avail_in == 0 && m_stream->avail_out != 0) {
+            break;
+        }
+        // ограничение на случай "zip-бомбы"
+        if (out->size() >= maxSize) {
+            return false;
+        }
+        out->resize(qMin(out->size() * 2, maxSize));
+    }
+    out->resize(produced);
+    return true;
+}
+
+void InflateStream::reset()
+{
+    if (m_stream) {
+        inflateEnd(m_stream);
+        delete m_stream;
+        m_stream = nullptr;
+    }
+}
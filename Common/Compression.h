@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QByteArray>
+
+struct z_stream_s;
+
+//-----------------------------------------------------------------------//
+//  DeflateStream                                                        //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Поток raw deflate на одно соединение. Словарь общий для всех кадров
+ * соединения, поэтому повторяющиеся ключи и имена сжимаются почти в ноль.
+ * Каждый кадр заканчивается Z_SYNC_FLUSH, хвост 00 00 FF FF не передаётся
+ * (как в permessage-deflate) и дописывается на приёме.
+ * Контекст zlib создаётся при первом сжатии.
+ */
+class DeflateStream {
+public:
+    DeflateStream();
+    ~DeflateStream();
+    DeflateStream(const DeflateStream&) = delete;
+    DeflateStream& operator =(const DeflateStream&) = delete;
+public:
+    bool compress(const QByteArray& data, QByteArray* out);
+    void reset();
+private:
+    z_stream_s* m_stream = nullptr;
+};
+
+//-----------------------------------------------------------------------//
+//  InflateStream                                                        //
+//-----------------------------------------------------------------------//
+
+class InflateStream {
+public:
+    InflateStream();
+    ~InflateStream();
+    InflateStream(const InflateStream&) = delete;
+    InflateStream& operator =(const InflateStream&) = delete;
+public:
+    bool decompress(const QByteArray& data, QByteArray* out, int maxSize);
+    void reset();
+private:
+    z_stream_s* m_stream = nullptr;
+};
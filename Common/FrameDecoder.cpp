@@ -0,0 +1,147 @@
+#include "FrameDecoder.h"
+
+#include <QIODevice>
+#include <QtEndian>
+#include <cstring>
+
+static const int InitialBufferSize = 16 * 1024;
+static const int MaxHeaderSize = 32;
+
+//-----------------------------------------------------------------------//
+//  FrameDecoder                                                         //
+//-----------------------------------------------------------------------//
+
+FrameDecoder::FrameDecoder(int maxFrameSize) :
+    m_maxFrameSize(maxFrameSize)
+{
+    // reserve() не даёт QByteArray освобождать память при resize(0)
+    m_buffer.reserve(InitialBufferSize);
+}
+
+qint64 FrameDecoder::readFrom(QIODevice *device)
+{
+    compact();
+
+    const qint64 available = device->bytesAvailable();
+    if (available <= 0) {
+        return 0;
+    }
+
+    const int oldSize = m_buffer.size();
+    m_buffer.resize(oldSize + static_cast<int>(available));
+    const qint64 numRead = device->read(m_buffer.data() + oldSize, available);
+    m_buffer.resize(oldSize + static_cast<int>(qMax<qint64>(numRead, 0)));
+    return numRead;
+}
+
+void FrameDecoder::append(const char *data, int size)
+{
+    compact();
+    m_buffer.append(data, size);
+}
+
+FrameDecoder::Status FrameDecoder::next(Frame *frame)
+{
+    const char* begin = m_buffer.constData() + m_readPos;
+    const int available = m_buffer.size() - m_readPos;
+    if (available <= 0) {
+        return NeedMoreData;
+    }
+
+    if (static_cast<quint8>(*begin) & Protocol::BinaryTypeMarker) {
+        return nextBinary(begin, available, frame);
+    }
+    return nextText(begin, available, frame);
+}
+
+bool FrameDecoder::hasPendingData() const
+{
+    return m_readPos < m_buffer.size();
+}
+
+void FrameDecoder::clear()
+{
+    m_buffer.resize(0);
+    m_readPos = 0;
+}
+
+FrameDecoder::Status FrameDecoder::nextText(const char *begin, int available, Frame *frame)
+{
+    const int headerScan = qMin(available, MaxHeaderSize);
+    const char* tagEnd = static_cast<const char*>(std::memchr(begin, Protocol::SeparatorToken, headerScan));
+    if (!tagEnd) {
+        return (available >= MaxHeaderSize) ? Malformed : NeedMoreData;
+    }
+
+    const Protocol::DataType type = Protocol::dataTypeForTag(begin, static_cast<int>(tagEnd - begin));
+    if (type == Protocol::Undefined) {
+        return Malformed;
+    }
+
+    const char* lengthBegin = tagEnd + 1;
+    const char* lengthEnd = static_cast<const char*>(std::memchr(lengthBegin, Protocol::SeparatorToken, begin + headerScan - lengthBegin));
+    if (!lengthEnd) {
+        return (available >= MaxHeaderSize) ? Malformed : NeedMoreData;
+    }
+    if (lengthEnd == lengthBegin) {
+        return Malformed;
+    }
+
+    qint64 length = 0;
+    for (const char* it = lengthBegin; it != lengthEnd; ++it) {
+        if ( (*it < '0') || (*it > '9') ) {
+            return Malformed;
+        }
+        length = length * 10 + (*it - '0');
+        if (length > m_maxFrameSize) {
+            return Malformed;
+        }
+    }
+
+    const char* payload = lengthEnd + 1;
+    if (begin + available - payload < length) {
+        return NeedMoreData;
+    }
+
+    frame->type = type;
+    frame->flags = Protocol::NoFlags;
+    frame->payload = QByteArray::fromRawData(payload, static_cast<int>(length));
+    m_readPos = static_cast<int>(payload + length - m_buffer.constData());
+    return FrameReady;
+}
+
+FrameDecoder::Status FrameDecoder::nextBinary(const char *begin, int available, Frame *frame)
+{
+    if (available < Protocol::BinaryHeaderSize) {
+        return NeedMoreData;
+    }
+
+    const quint8 code = static_cast<quint8>(begin[0]) & ~Protocol::BinaryTypeMarker;
+    if (code >= Protocol::Undefined) {
+        return Malformed;
+    }
+
+    const quint32 length = qFromBigEndian<quint32>(begin + 2);
+    if (length > static_cast<quint32>(m_maxFrameSize)) {
+        return Malformed;
+    }
+    if (static_cast<quint32>(available - Protocol::BinaryHeaderSize) < length) {
+        return NeedMoreData;
+    }
+
+    const char* payload = begin + Protocol::BinaryHeaderSize;
+    frame->type = static_cast<Protocol::DataType>(code);
+    frame->flags = static_cast<quint8>(begin[1]);
+    frame->payload = QByteArray::fromRawData(payload, static_cast<int>(length));
+    m_readPos = static_cast<int>(payload + length - m_buffer.constData());
+    return FrameReady;
+}
+
+void FrameDecoder::compact()
+{
+    if (m_readPos > 0) {
+        // остаётся только хвост недочитанного кадра, он короткий
+        m_buffer.remove(0, m_readPos);
+        m_readPos = 0;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Protocol.h"
+
+#include <QByteArray>
+
+class QIODevice;
+
+//-----------------------------------------------------------------------//
+//  FrameDecoder                                                         //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Инкрементальный разбор кадров "TAG LEN payload" и двоичных кадров версии 2,
+ * тип кадра определяется по первому байту.
+ * Данные сокета читаются крупными порциями в один приёмный буфер, заголовки
+ * разбираются на месте, а содержимое кадра отдаётся как представление
+ * (QByteArray::fromRawData) внутрь этого буфера. Представление действительно
+ * до следующего вызова readFrom()/append(), дольше его нужно копировать.
+ */
+class FrameDecoder {
+public:
+    enum Status {
+        NeedMoreData, /*!< Кадр ещё не пришёл целиком */
+        FrameReady, /*!< Кадр разобран */
+        Malformed /*!< Неизвестный тег или неверная длина, соединение надо рвать */
+    };
+    struct Frame {
+        Protocol::DataType type = Protocol::Undefined;
+        quint8 flags = Protocol::NoFlags;
+        QByteArray payload;
+    };
+public:
+    explicit FrameDecoder(int maxFrameSize = Protocol::MaxBufferSize);
+public:
+    qint64 readFrom(QIODevice* device);
+    void append(const char* data, int size);
+    Status next(Frame* frame);
+    bool hasPendingData() const;
+    void clear();
+private:
+    Status nextText(const char* begin, int available, Frame* frame);
+    Status nextBinary(const char* begin, int available, Frame* frame);
+    void compact();
+private:
+    QByteArray m_buffer;
+    int m_readPos = 0;
+    int m_maxFrameSize = Protocol::MaxBufferSize;
+};
@@ -0,0 +1,147 @@
+#include "Protocol.h"
+
+#include <QByteArrayList>
+#include <QtEndian>
+#include <cstring>
+
+namespace {
+
+struct TagInfo {
+    const char* tag;
+    int size;
+    Protocol::DataType type;
+};
+
+// Отсортировано по длине тега, чтобы сравнение шло по длине, а не по строке
+const TagInfo Tags[] = {
+    { "PING",            4,  Protocol::Ping },
+    { "PONG",            4,  Protocol::Pong },
+    { "JOIN",            4,  Protocol::Join },
+    { "LEAVE",           5,  Protocol::Leave },
+    { "MISSED",          6,  Protocol::Missed },
+    { "MESSAGE",         7,  Protocol::PlainText },
+    { "HISTORY",         7,  Protocol::History },
+    { "NODE_UP",         7,  Protocol::NodeUp },
+    { "GREETING",        8,  Protocol::Greeting },
+    { "NAMEERROR",       9,  Protocol::NameError },
+    { "JOIN_ROOM",       9,  Protocol::JoinRoom },
+    { "NODE_SYNC",       9,  Protocol::NodeSync },
+    { "NODE_DOWN",       9,  Protocol::NodeDown },
+    { "LEAVE_ROOM",      10, Protocol::LeaveRoom },
+    { "NODE_HELLO",      10, Protocol::NodeHello },
+    { "PARTICIPANTS",    12, Protocol::Participants },
+    { "PRESENCE_ADD",    12, Protocol::PresenceAdd },
+    { "HISTORY_PAGE",    12, Protocol::HistoryPage },
+    { "NODE_MESSAGE",    12, Protocol::NodeMessage },
+    { "PRESENCE_SYNC",   13, Protocol::PresenceSync },
+    { "PRESENCE_REMOVE", 15, Protocol::PresenceRemove }
+};
+
+struct CapabilityInfo {
+    const char* name;
+    Protocol::Capability capability;
+};
+
+const CapabilityInfo Capabilities[] = {
+    { "v2",       Protocol::CapabilityBinaryFraming },
+    { "presence", Protocol::CapabilityPresence },
+    { "missed",   Protocol::CapabilityMissedMarker },
+    { "paging",   Protocol::CapabilityHistoryPaging },
+    { "deflate",  Protocol::CapabilityCompression },
+    { "rooms",    Protocol::CapabilityRooms },
+    { "sessions", Protocol::CapabilitySessions },
+    { "cbor",     Protocol::CapabilityCbor }
+};
+
+}
+
+//-----------------------------------------------------------------------//
+//  Protocol                                                             //
+//-----------------------------------------------------------------------//
+
+Protocol::DataType Protocol::dataTypeForTag(const char *tag, int size)
+{
+    for (const TagInfo& info : Tags) {
+        if (info.size > size) {
+            break;
+        }
+        if ( (info.size == size) && (std::memcmp(info.tag, tag, size) == 0) ) {
+            return info.type;
+        }
+    }
+    return Undefined;
+}
+
+QByteArray Protocol::tagForDataType(DataType type)
+{
+    for (const TagInfo& info : Tags) {
+        if (info.type == type) {
+            return QByteArray::fromRawData(info.tag, info.size);
+        }
+    }
+    return QByteArray();
+}
+
+quint32 Protocol::capabilitiesFromNames(const QByteArray &names)
+{
+    quint32 capabilities = NoCapabilities;
+    for (const QByteArray& name : names.split(CapabilitySeparator)) {
+        for (const CapabilityInfo& info : Capabilities) {
+            if (name == info.name) {
+                capabilities |= info.capability;
+            }
+        }
+    }
+    return capabilities;
+}
+
+QByteArray Protocol::capabilityNames(quint32 capabilities)
+{
+    QList<QByteArray> names;
+    for (const CapabilityInfo& info : Capabilities) {
+        if (capabilities & info.capability) {
+            names << QByteArray(info.name);
+        }
+    }
+    return names.join(CapabilitySeparator);
+}
+
+QByteArray Protocol::encodeHeader(DataType type, int size, Framing framing, quint8 flags)
+{
+    if (framing == BinaryFraming) {
+        QByteArray header(BinaryHeaderSize, Qt::Uninitialized);
+        header[0] = static_cast<char>(BinaryTypeMarker | type);
+        header[1] = static_cast<char>(flags);
+        qToBigEndian<quint32>(static_cast<quint32>(size), header.data() + 2);
+        return header;
+    }
+
+    const QByteArray tag = tagForDataType(type);
+    const QByteArray length = QByteArray::number(size);
+    QByteArray header;
+    header.reserve(tag.size() + length.size() + 2);
+    header.append(tag).append(SeparatorToken).append(length).append(SeparatorToken);
+    return header;
+}
+
+QByteArray Protocol::encodeFrame(DataType type, const QByteArray &payload, Framing framing, quint8 flags)
+{
+    QByteArray frame = encodeHeader(type, payload.size(), framing, flags);
+    frame.append(payload);
+    return frame;
+}
+
+QByteArray Protocol::controlFrame(DataType type, Framing framing)
+{
+    if (framing == BinaryFraming) {
+        return encodeHeader(type, 0, BinaryFraming);
+    }
+
+    // старые клиенты не умеют кадры нулевой длины
+    switch (type) {
+    case Ping:      return QByteArrayLiteral("PING 1 p");
+    case Pong:      return QByteArrayLiteral("PONG 1 p");
+    case NameError: return QByteArrayLiteral("NAMEERROR 1 e");
+    default:        return encodeFrame(type, QByteArrayLiteral("x"), TextFraming);
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <QByteArray>
+#include <QMetaType>
+
+//-----------------------------------------------------------------------//
+//  Protocol                                                             //
+//-----------------------------------------------------------------------//
+
+namespace Protocol {
+
+enum DataType {
+    PlainText,
+    Ping,
+    Pong,
+    Greeting,
+    History,
+    Participants,
+    Leave,
+    Join,
+    NameError,
+    PresenceAdd,
+    PresenceRemove,
+    PresenceSync,
+    Missed,
+    HistoryPage,
+    JoinRoom,
+    LeaveRoom,
+    NodeHello, /*!< Дальше только между серверами кластера */
+    NodeSync,
+    NodeUp,
+    NodeDown,
+    NodeMessage,
+    Undefined
+};
+
+enum Framing {
+    TextFraming, /*!< "TAG LEN payload", понимают все клиенты */
+    BinaryFraming /*!< Фиксированный двоичный заголовок, версия 2 */
+};
+
+enum FrameFlag {
+    NoFlags = 0x00,
+    FlagCompressed = 0x01 /*!< payload сжат потоком deflate соединения */
+};
+
+enum Capability {
+    NoCapabilities = 0x00,
+    CapabilityBinaryFraming = 0x01, /*!< "v2": двоичные заголовки кадров */
+    CapabilityPresence = 0x02, /*!< "presence": PRESENCE_ADD/PRESENCE_REMOVE вместо полного списка */
+    CapabilityMissedMarker = 0x04, /*!< "missed": кадр MISSED о пропущенных сообщениях */
+    CapabilityHistoryPaging = 0x08, /*!< "paging": запрос HISTORY_PAGE before=<seq> limit=<n> */
+    CapabilityCompression = 0x10, /*!< "deflate": сжатие крупных кадров сервера, только вместе с "v2" */
+    CapabilityRooms = 0x20, /*!< "rooms": JOIN_ROOM <имя>/LEAVE_ROOM, вне комнаты клиент в общей */
+    CapabilitySessions = 0x40, /*!< "sessions": LEAVE и PRESENCE_REMOVE содержат только "id" сессии */
+    CapabilityCbor = 0x80 /*!< "cbor": MESSAGE, JOIN, LEAVE, PARTICIPANTS и HISTORY в CBOR (CborPayload) */
+};
+
+static const char SeparatorToken = ' ';
+static const int MaxBufferSize = 1024000;
+static const int MaxRoomNameSize = 64;
+
+// Двоичный заголовок: [0x80 | type][flags][длина payload, u32 big endian].
+// Старший бит первого байта отличает его от текстового тега (A-Z).
+static const quint8 BinaryTypeMarker = 0x80;
+static const int BinaryHeaderSize = 6;
+
+// Возможности перечисляются через пробел во втором кадре GREETING:
+// старый сервер в состоянии ReadyForUse такой кадр просто игнорирует.
+static const char CapabilitySeparator = ' ';
+
+DataType dataTypeForTag(const char* tag, int size);
+QByteArray tagForDataType(DataType type);
+
+quint32 capabilitiesFromNames(const QByteArray& names);
+QByteArray capabilityNames(quint32 capabilities);
+
+QByteArray encodeHeader(DataType type, int size, Framing framing, quint8 flags = NoFlags);
+QByteArray encodeFrame(DataType type, const QByteArray& payload, Framing framing, quint8 flags = NoFlags);
+QByteArray controlFrame(DataType type, Framing framing);
+
+}
+
+Q_DECLARE_METATYPE(Protocol::DataType)
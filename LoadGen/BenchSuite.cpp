@@ -0,0 +1,465 @@
+#include "BenchSuite.h"
+#include "CborPayload.h"
+#include "CoarseClock.h"
+#include "Compression.h"
+#include "FrameDecoder.h"
+#include "HistoryRing.h"
+#include "Payloads.h"
+
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QVector>
+
+#include <cstdio>
+#include <functional>
+
+static const qint64 MinCaseTime = 200 * 1000 * 1000;
+static const int StreamFrames = 1000;
+// примерно столько приходит из сокета за одно чтение на loopback
+static const int ReadChunkSize = 64 * 1024;
+static const int MessageSizes[] = { 16, 256, 4096 };
+static const int ParticipantCounts[] = { 10, 100, 1000 };
+static const int HistoryLengths[] = { 20, 100, 1000 };
+
+//-----------------------------------------------------------------------//
+//  BenchSuite::Pimpl                                                    //
+//-----------------------------------------------------------------------//
+
+class BenchSuite::Pimpl {
+public:
+    struct Result {
+        QString name;
+        qint64 iterations = 0;
+        double nsPerItem = 0;
+        double mbPerSecond = 0;
+        double ratio = 0;
+        qint64 payloadBytes = 0;
+    };
+public:
+    void bench(const QString& name, int items, qint64 bytes, const std::function<void()>& op, double ratio = 0, qint64 payloadBytes = 0);
+    void benchDecoder(Protocol::Framing framing, int size);
+    static qint64 legacyDecode(QIODevice* device);
+    void printResult(const Result& result);
+    void writeCsv();
+    QJsonObject message(int size, int index);
+    QByteArray messagePayload(int size, int index);
+    CborPayload::Message messageRecord(int size, int index);
+    static CborPayload::Participant participantRecord(int index);
+    static QVector<CborPayload::Participant> participantRecords(int count);
+public:
+    CoarseClock m_clock;
+    QString m_filter;
+    QString m_csvPath;
+    QString m_label;
+    QVector<Result> m_results;
+    volatile qint64 m_sink = 0;
+};
+
+void BenchSuite::Pimpl::bench(const QString &name, int items, qint64 bytes, const std::function<void()> &op, double ratio, qint64 payloadBytes)
+{
+    if (!m_filter.isEmpty() && !name.contains(m_filter)) {
+        return;
+    }
+
+    // прогрев, затем удваиваем число повторов, пока не наберём MinCaseTime
+    op();
+    qint64 iterations = 1;
+    qint64 elapsed = 0;
+    QElapsedTimer timer;
+    forever {
+        timer.start();
+        for (qint64 i = 0; i < iterations; ++i) {
+            op();
+        }
+        elapsed = timer.nsecsElapsed();
+        if (elapsed >= MinCaseTime) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    Result result;
+    result.name = name;
+    result.iterations = iterations;
+    result.nsPerItem = static_cast<double>(elapsed) / (iterations * items);
+    result.mbPerSecond = bytes ? (bytes * iterations / (1024.0 * 1024.0)) / (elapsed / 1e9) : 0;
+    result.ratio = ratio;
+    result.payloadBytes = payloadBytes;
+    m_results.append(result);
+    printResult(result);
+}
+
+void BenchSuite::Pimpl::benchDecoder(Protocol::Framing framing, int size)
+{
+    QByteArray stream;
+    for (int i = 0; i < StreamFrames; ++i) {
+        stream += Protocol::encodeFrame(Protocol::PlainText, messagePayload(size, i), framing);
+    }
+
+    const QString name = QStringLiteral("decode/%1-frames/%2")
+            .arg(framing == Protocol::BinaryFraming ? QStringLiteral("binary") : QStringLiteral("text"))
+            .arg(size);
+    FrameDecoder decoder;
+    bench(name, StreamFrames, stream.size(), [&](){
+        FrameDecoder::Frame frame;
+        qint64 total = 0;
+        for (int offset = 0; offset < stream.size(); offset += ReadChunkSize) {
+            decoder.append(stream.constData() + offset, qMin(ReadChunkSize, stream.size() - offset));
+            while (decoder.next(&frame) == FrameDecoder::FrameReady) {
+                total += frame.payload.size();
+            }
+        }
+        m_sink = m_sink + total;
+    });
+
+    if (framing == Protocol::TextFraming) {
+        // для сравнения — разбор, который был в Connection до FrameDecoder
+        bench(QStringLiteral("decode/legacy-text-frames/%1").arg(size), StreamFrames, stream.size(), [&](){
+            QBuffer device(&stream);
+            device.open(QIODevice::ReadOnly);
+            m_sink = m_sink + legacyDecode(&device);
+        });
+    }
+}
+
+qint64 BenchSuite::Pimpl::legacyDecode(QIODevice *device)
+{
+    // readDataIntoBuffer/readProtocolHeader прежнего Connection: заголовок
+    // читается по байту, тег сверяется цепочкой сравнений QByteArray
+    qint64 total = 0;
+    QByteArray buffer;
+    auto readToken = [&]() -> bool {
+        buffer.clear();
+        while (device->bytesAvailable() > 0) {
+            buffer.append(device->read(1));
+            if (buffer.endsWith(' ')) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    while (readToken()) {
+        if ( (buffer != "PING ") && (buffer != "PONG ") &&
+             (buffer != "MESSAGE ") && (buffer != "GREETING ") ) {
+            break;
+        }
+        if (!readToken()) {
+            break;
+        }
+        buffer.chop(1);
+        const int length = buffer.toInt();
+        const QByteArray payload = device->read(length);
+        if (payload.size() != length) {
+            break;
+        }
+        total += payload.size();
+    }
+    return total;
+}
+
+void BenchSuite::Pimpl::printResult(const Result &result)
+{
+    if (result.mbPerSecond > 0) {
+        std::printf("%-36s %12.1f ns/item %10.1f MB/s %10lld iterations", qPrintable(result.name),
+                    result.nsPerItem, result.mbPerSecond, static_cast<long long>(result.iterations));
+    }
+    else {
+        std::printf("%-36s %12.1f ns/item %15s %10lld iterations", qPrintable(result.name),
+                    result.nsPerItem, "", static_cast<long long>(result.iterations));
+    }
+    if (result.ratio > 0) {
+        std::printf("   compressed to %5.1f%%", result.ratio * 100);
+    }
+    if (result.payloadBytes > 0) {
+        std::printf("   %8lld bytes", static_cast<long long>(result.payloadBytes));
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+void BenchSuite::Pimpl::writeCsv()
+{
+    QFile file(m_csvPath);
+    const bool isNew = !file.exists() || (file.size() == 0);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        std::fprintf(stderr, "Unable to write %s\n", qPrintable(m_csvPath));
+        return;
+    }
+
+    QTextStream out(&file);
+    if (isNew) {
+        out << "label,case,iterations,ns_per_item,mb_per_s,ratio,bytes\n";
+    }
+    for (const Result& result : m_results) {
+        out << m_label << ',' << result.name << ',' << result.iterations << ','
+            << result.nsPerItem << ',' << result.mbPerSecond << ',' << result.ratio << ','
+            << result.payloadBytes << '\n';
+    }
+}
+
+QJsonObject BenchSuite::Pimpl::message(int size, int index)
+{
+    // как Server::Pimpl::textMessage: запись, время и строка из CoarseClock
+    const CborPayload::Message record = messageRecord(size, index);
+    return Payloads::textMessage(record, m_clock.text(record.timestamp));
+}
+
+QByteArray BenchSuite::Pimpl::messagePayload(int size, int index)
+{
+    return QJsonDocument(message(size, index)).toJson(QJsonDocument::Compact);
+}
+
+CborPayload::Message BenchSuite::Pimpl::messageRecord(int size, int index)
+{
+    CborPayload::Message record;{
+        record.sequence = index + 1;
+        record.name = QStringLiteral("user%1").arg(index % 100);
+        record.ip = QStringLiteral("192.168.1.%1").arg(index % 250);
+        record.port = 40000 + index % 1000;
+        record.text = QString(size, QLatin1Char('x'));
+        record.timestamp = m_clock.now();
+    }
+    return record;
+}
+
+CborPayload::Participant BenchSuite::Pimpl::participantRecord(int index)
+{
+    CborPayload::Participant record;{
+        record.id = index + 1;
+        record.name = QStringLiteral("user%1").arg(index);
+        record.ip = QStringLiteral("192.168.1.%1").arg(index % 250);
+        record.port = 40000 + index;
+    }
+    return record;
+}
+
+QVector<CborPayload::Participant> BenchSuite::Pimpl::participantRecords(int count)
+{
+    QVector<CborPayload::Participant> records;
+    records.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        records.append(participantRecord(i));
+    }
+    return records;
+}
+
+//-----------------------------------------------------------------------//
+//  BenchSuite                                                           //
+//-----------------------------------------------------------------------//
+
+BenchSuite::BenchSuite()
+{
+    m_d = new Pimpl();
+}
+
+BenchSuite::~BenchSuite()
+{
+    delete m_d;
+}
+
+void BenchSuite::setFilter(const QString &filter)
+{
+    m_d->m_filter = filter;
+}
+
+void BenchSuite::setCsvPath(const QString &path, const QString &label)
+{
+    m_d->m_csvPath = path;
+    m_d->m_label = label;
+}
+
+int BenchSuite::run()
+{
+    m_d->m_results.clear();
+
+    // разбор входящего потока кадров
+    for (int size : MessageSizes) {
+        m_d->benchDecoder(Protocol::TextFraming, size);
+        m_d->benchDecoder(Protocol::BinaryFraming, size);
+    }
+
+    // сборка сообщений на сервере, те же функции Payloads, что у Server
+    for (int size : MessageSizes) {
+        // время и метка берутся заранее: оба случая меряют только кодирование
+        const CborPayload::Message record = m_d->messageRecord(size, 1);
+        const QString time = m_d->m_clock.text(record.timestamp);
+        const QByteArray payload = QJsonDocument(Payloads::textMessage(record, time)).toJson(QJsonDocument::Compact);
+        m_d->bench(QStringLiteral("encode/message/%1").arg(size), 1, payload.size(), [&](){
+            const QJsonObject message = Payloads::textMessage(record, time);
+            m_d->m_sink = m_d->m_sink + QJsonDocument(message).toJson(QJsonDocument::Compact).size();
+        }, 0, payload.size());
+        const QByteArray cbor = CborPayload::encodeMessage(record);
+        m_d->bench(QStringLiteral("encode/cbor-message/%1").arg(size), 1, cbor.size(), [&](){
+            m_d->m_sink = m_d->m_sink + CborPayload::encodeMessage(record).size();
+        }, 0, cbor.size());
+    }
+    {
+        const CborPayload::Participant record = Pimpl::participantRecord(1);
+        m_d->bench(QStringLiteral("encode/join"), 1, 0, [&](){
+            m_d->m_sink = m_d->m_sink + Payloads::joinMessage(record).size();
+        }, 0, Payloads::joinMessage(record).size());
+        m_d->bench(QStringLiteral("encode/cbor-join"), 1, 0, [&](){
+            m_d->m_sink = m_d->m_sink + CborPayload::encodeParticipant(record).size();
+        }, 0, CborPayload::encodeParticipant(record).size());
+        m_d->bench(QStringLiteral("encode/leave"), 1, 0, [&](){
+            m_d->m_sink = m_d->m_sink + Payloads::leaveMessage(record).size();
+        }, 0, Payloads::leaveMessage(record).size());
+    }
+    for (int count : ParticipantCounts) {
+        const QVector<CborPayload::Participant> records = Pimpl::participantRecords(count);
+        const qint64 jsonBytes = Payloads::participantsMessage(records).size();
+        m_d->bench(QStringLiteral("encode/participants/%1").arg(count), 1, 0, [&](){
+            m_d->m_sink = m_d->m_sink + Payloads::participantsMessage(records).size();
+        }, 0, jsonBytes);
+        const qint64 cborBytes = CborPayload::encodeParticipants(records).size();
+        m_d->bench(QStringLiteral("encode/cbor-participants/%1").arg(count), 1, 0, [&](){
+            m_d->m_sink = m_d->m_sink + CborPayload::encodeParticipants(records).size();
+        }, 0, cborBytes);
+    }
+
+    // снимок истории для нового подключения: прежний QJsonArray и кольцо,
+    // страница истории склеивается из готовых записей
+    for (int length : HistoryLengths) {
+        QJsonArray history;
+        QVector<QByteArray> page;
+        HistoryRing ring(length);
+        for (int i = 0; i < length; ++i) {
+            history.append(m_d->message(64, i));
+            page.append(m_d->messagePayload(64, i));
+            ring.append(i + 1, page.last());
+        }
+        m_d->bench(QStringLiteral("encode/history-json/%1").arg(length), 1, 0, [&](){
+            m_d->m_sink = m_d->m_sink + QJsonDocument(history).toJson(QJsonDocument::Compact).size();
+        });
+        m_d->bench(QStringLiteral("encode/history-page/%1").arg(length), 1, 0, [&](){
+            m_d->m_sink = m_d->m_sink + Payloads::historyMessage(page).size();
+        }, 0, Payloads::historyMessage(page).size());
+        quint64 sequence = length;
+        const QByteArray payload = m_d->messagePayload(64, 0);
+        m_d->bench(QStringLiteral("encode/history-ring/%1").arg(length), 1, 0, [&](){
+            // сообщение и затем подключение: снимок каждый раз собирается заново
+            ring.append(++sequence, payload);
+            m_d->m_sink = m_d->m_sink + ring.snapshotFrame().size();
+        });
+        m_d->bench(QStringLiteral("encode/history-ring-cached/%1").arg(length), 1, 0, [&](){
+            m_d->m_sink = m_d->m_sink + ring.snapshotFrame().size();
+        });
+
+        HistoryRing cborRing(length);
+        for (int i = 0; i < length; ++i) {
+            cborRing.append(i + 1, m_d->messagePayload(64, i), CborPayload::encodeMessage(m_d->messageRecord(64, i)));
+        }
+        const QByteArray cborPayload = CborPayload::encodeMessage(m_d->messageRecord(64, 0));
+        m_d->bench(QStringLiteral("encode/cbor-history-ring/%1").arg(length), 1, 0, [&](){
+            cborRing.append(++sequence, payload, cborPayload);
+            m_d->m_sink = m_d->m_sink + cborRing.cborSnapshot().size();
+        }, 0, cborRing.cborSnapshot().size());
+    }
+
+    // разбор JSON на клиенте
+    for (int size : MessageSizes) {
+        const QByteArray payload = m_d->messagePayload(size, 0);
+        m_d->bench(QStringLiteral("decode/json-message/%1").arg(size), 1, payload.size(), [&](){
+            const QJsonObject message = QJsonDocument::fromJson(payload).object();
+            m_d->m_sink = m_d->m_sink + message.value(QLatin1String("message")).toString().size();
+        }, 0, payload.size());
+        const QByteArray cbor = CborPayload::encodeMessage(m_d->messageRecord(size, 0));
+        m_d->bench(QStringLiteral("decode/cbor-message/%1").arg(size), 1, cbor.size(), [&](){
+            CborPayload::Message message;
+            CborPayload::decodeMessage(cbor, &message);
+            m_d->m_sink = m_d->m_sink + message.text.size();
+        }, 0, cbor.size());
+    }
+    for (int length : HistoryLengths) {
+        QJsonArray history;
+        for (int i = 0; i < length; ++i) {
+            history.append(m_d->message(64, i));
+        }
+        const QByteArray payload = QJsonDocument(history).toJson(QJsonDocument::Compact);
+        m_d->bench(QStringLiteral("decode/json-history/%1").arg(length), length, payload.size(), [&](){
+            m_d->m_sink = m_d->m_sink + QJsonDocument::fromJson(payload).array().size();
+        }, 0, payload.size());
+
+        QVector<QByteArray> items;
+        for (int i = 0; i < length; ++i) {
+            items.append(CborPayload::encodeMessage(m_d->messageRecord(64, i)));
+        }
+        const QByteArray cbor = CborPayload::encodeArray(items);
+        m_d->bench(QStringLiteral("decode/cbor-history/%1").arg(length), length, cbor.size(), [&](){
+            QVector<CborPayload::Message> messages;
+            CborPayload::decodeMessages(cbor, &messages);
+            m_d->m_sink = m_d->m_sink + messages.size();
+        }, 0, cbor.size());
+    }
+
+    // сжатие deflate: отдельный снимок новым потоком и поток сообщений одного
+    // соединения, где словарь накапливается
+    for (int count : ParticipantCounts) {
+        const QByteArray payload = Payloads::participantsMessage(Pimpl::participantRecords(count));
+        QByteArray compressed;
+        DeflateStream().compress(payload, &compressed);
+        m_d->bench(QStringLiteral("deflate/participants/%1").arg(count), 1, payload.size(), [&](){
+            DeflateStream stream;
+            QByteArray out;
+            stream.compress(payload, &out);
+            m_d->m_sink = m_d->m_sink + out.size();
+        }, static_cast<double>(compressed.size()) / payload.size());
+        m_d->bench(QStringLiteral("inflate/participants/%1").arg(count), 1, payload.size(), [&](){
+            InflateStream stream;
+            QByteArray out;
+            stream.decompress(compressed, &out, Protocol::MaxBufferSize);
+            m_d->m_sink = m_d->m_sink + out.size();
+        });
+    }
+    for (int length : HistoryLengths) {
+        QJsonArray history;
+        for (int i = 0; i < length; ++i) {
+            history.append(m_d->message(64, i));
+        }
+        const QByteArray payload = QJsonDocument(history).toJson(QJsonDocument::Compact);
+        QByteArray compressed;
+        DeflateStream().compress(payload, &compressed);
+        m_d->bench(QStringLiteral("deflate/history/%1").arg(length), 1, payload.size(), [&](){
+            DeflateStream stream;
+            QByteArray out;
+            stream.compress(payload, &out);
+            m_d->m_sink = m_d->m_sink + out.size();
+        }, static_cast<double>(compressed.size()) / payload.size());
+    }
+    for (int size : MessageSizes) {
+        QVector<QByteArray> messages;
+        qint64 rawBytes = 0;
+        for (int i = 0; i < StreamFrames; ++i) {
+            messages.append(m_d->messagePayload(size, i));
+            rawBytes += messages.last().size();
+        }
+        // доля считается на прогретом потоке, как у давно подключённого клиента
+        DeflateStream stream;
+        QByteArray out;
+        qint64 compressedBytes = 0;
+        for (int pass = 0; pass < 2; ++pass) {
+            compressedBytes = 0;
+            for (const QByteArray& message : messages) {
+                stream.compress(message, &out);
+                compressedBytes += out.size();
+            }
+        }
+        m_d->bench(QStringLiteral("deflate/message-stream/%1").arg(size), StreamFrames, rawBytes, [&](){
+            for (const QByteArray& message : messages) {
+                stream.compress(message, &out);
+                m_d->m_sink = m_d->m_sink + out.size();
+            }
+        }, static_cast<double>(compressedBytes) / rawBytes);
+    }
+
+    if (!m_d->m_csvPath.isEmpty()) {
+        m_d->writeCsv();
+    }
+    return m_d->m_results.isEmpty() ? 1 : 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <QString>
+
+//-----------------------------------------------------------------------//
+//  BenchSuite                                                           //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Микробенчмарки горячих путей протокола: разбор кадров (и для сравнения
+ * прежний побайтовый разбор заголовка), сборка JSON на сервере теми же
+ * функциями Payloads, снимок истории, разбор JSON на клиенте и сжатие deflate.
+ * Каждый случай крутится не меньше MinCaseTime, результат печатается
+ * таблицей и дописывается в CSV.
+ */
+class BenchSuite {
+public:
+    BenchSuite();
+    ~BenchSuite();
+public:
+    void setFilter(const QString& filter);
+    void setCsvPath(const QString& path, const QString& label);
+    int run();
+private:
+    class Pimpl;
+    Pimpl* m_d;
+};
@@ -0,0 +1,102 @@
+#include "LatencyHistogram.h"
+
+#include <QtMath>
+
+static const int SubBucketBits = 5;
+static const int SubBuckets = 1 << SubBucketBits;
+static const int BucketCount = SubBuckets * (64 - SubBucketBits + 1);
+
+//-----------------------------------------------------------------------//
+//  LatencyHistogram                                                     //
+//-----------------------------------------------------------------------//
+
+LatencyHistogram::LatencyHistogram() :
+    m_buckets(BucketCount, 0)
+{
+}
+
+void LatencyHistogram::record(qint64 value)
+{
+    value = qMax<qint64>(value, 0);
+    ++m_buckets[bucketFor(value)];
+    ++m_count;
+    m_max = qMax(m_max, value);
+    m_sum += value;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for (int i = 0; i < BucketCount; ++i) {
+        m_buckets[i] += other.m_buckets.at(i);
+    }
+    m_count += other.m_count;
+    m_max = qMax(m_max, other.m_max);
+    m_sum += other.m_sum;
+}
+
+void LatencyHistogram::clear()
+{
+    m_buckets.fill(0);
+    m_count = 0;
+    m_max = 0;
+    m_sum = 0;
+}
+
+quint64 LatencyHistogram::count() const
+{
+    return m_count;
+}
+
+qint64 LatencyHistogram::max() const
+{
+    return m_max;
+}
+
+double LatencyHistogram::mean() const
+{
+    return m_count ? m_sum / m_count : 0;
+}
+
+qint64 LatencyHistogram::percentile(double quantile) const
+{
+    if (!m_count) {
+        return 0;
+    }
+
+    const quint64 target = qMax<quint64>(1, static_cast<quint64>(qCeil(quantile * m_count)));
+    quint64 seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += m_buckets.at(i);
+        if (seen >= target) {
+            return qMin(upperBound(i), m_max);
+        }
+    }
+    return m_max;
+}
+
+int LatencyHistogram::bucketFor(qint64 value)
+{
+    if (value < SubBuckets) {
+        return static_cast<int>(value);
+    }
+
+    // старший бит задаёт октаву, следующие SubBucketBits — корзину внутри неё
+    int exponent = 63;
+    while (!(static_cast<quint64>(value) >> exponent)) {
+        --exponent;
+    }
+    const int shift = exponent - SubBucketBits;
+    const int sub = static_cast<int>((value >> shift) & (SubBuckets - 1));
+    return SubBuckets * (shift + 1) + sub;
+}
+
+qint64 LatencyHistogram::upperBound(int bucket)
+{
+    if (bucket < SubBuckets) {
+        return bucket;
+    }
+
+    const int shift = bucket / SubBuckets - 1;
+    const qint64 sub = bucket % SubBuckets;
+    return ((SubBuckets + sub + 1) << shift) - 1;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QtGlobal>
+#include <QVector>
+
+//-----------------------------------------------------------------------//
+//  LatencyHistogram                                                     //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Логарифмически-линейная гистограмма задержек в микросекундах: по
+ * SubBuckets корзин на каждую степень двойки, погрешность перцентилей
+ * не больше 1/SubBuckets при постоянном объёме памяти.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+public:
+    void record(qint64 value);
+    void merge(const LatencyHistogram& other);
+    void clear();
+    quint64 count() const;
+    qint64 max() const;
+    double mean() const;
+    qint64 percentile(double quantile) const;
+private:
+    static int bucketFor(qint64 value);
+    static qint64 upperBound(int bucket);
+private:
+    QVector<quint64> m_buckets;
+    quint64 m_count = 0;
+    qint64 m_max = 0;
+    double m_sum = 0;
+};
@@ -0,0 +1,31 @@
+QT += core network
+QT -= gui
+
+CONFIG += c++11
+
+TARGET = LoadGen
+CONFIG += console
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+SOURCES += *.cpp \
+    ../Client/ChatEvent.cpp \
+    ../Client/Connection.cpp \
+    ../Server/CoarseClock.cpp \
+    ../Server/HistoryRing.cpp \
+    ../Server/Payloads.cpp
+
+HEADERS += *h \
+    ../Client/ChatEvent.h \
+    ../Client/Connection.h \
+    ../Server/CoarseClock.h \
+    ../Server/HistoryRing.h \
+    ../Server/Payloads.h
+
+INCLUDEPATH += ../Client \
+    ../Server
+
+include(../Common/Common.pri)
+
+DEFINES += QT_DEPRECATED_WARNINGS
@@ -0,0 +1,329 @@
+#include "LoadGenerator.h"
+#include "Connection.h"
+#include "LatencyHistogram.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <QTimer>
+#include <QVector>
+
+#include <cstdio>
+
+static const int SendTick = 10;
+static const int DrainTime = 1000;
+// начало текста сообщения от генератора: "lg <клиент> <время отправки, нс> "
+static const char MarkerPrefix[] = "lg ";
+
+//-----------------------------------------------------------------------//
+//  LoadGenerator::Pimpl                                                 //
+//-----------------------------------------------------------------------//
+
+class LoadGenerator::Pimpl {
+public:
+    struct Client {
+        Connection* connection = nullptr;
+        qint64 connectStarted = 0;
+        bool ready = false;
+    };
+public:
+    Pimpl(const LoadGenerator::Options& options, LoadGenerator* parent);
+public:
+    void connectNext();
+    void onConnected(int index);
+    void onDisconnected(int index);
+    void onMessage(const ChatMessage& message);
+    void sendTick();
+    void stopSending();
+    void finish();
+    void printInterval();
+    void printSummary();
+    void writeCsv();
+    QString message(int index);
+    static double ms(qint64 usecs);
+public:
+    LoadGenerator::Options m_options;
+    QVector<Client> m_clients;
+    QVector<int> m_ready;
+    QElapsedTimer m_clock;
+    QTimer* m_rampTimer = nullptr;
+    QTimer* m_sendTimer = nullptr;
+    QTimer* m_reportTimer = nullptr;
+    LatencyHistogram m_latency;
+    LatencyHistogram m_intervalLatency;
+    LatencyHistogram m_connectTimes;
+    LatencyHistogram m_delivery;
+    QByteArray m_padding;
+    int m_nextClient = 0;
+    int m_nextSender = 0;
+    int m_connected = 0;
+    int m_disconnects = 0;
+    quint64 m_sent = 0;
+    quint64 m_received = 0;
+    quint64 m_intervalSent = 0;
+    quint64 m_intervalReceived = 0;
+    double m_sendBudget = 0;
+    qint64 m_lastTick = 0;
+    qint64 m_sendStarted = -1;
+    qint64 m_sendStopped = -1;
+    qint64 m_lastReport = 0;
+    bool m_stopping = false;
+    LoadGenerator* m_parent = nullptr;
+};
+
+LoadGenerator::Pimpl::Pimpl(const LoadGenerator::Options &options, LoadGenerator *parent) :
+    m_options(options),
+    m_parent(parent)
+{
+}
+
+void LoadGenerator::Pimpl::connectNext()
+{
+    if (m_nextClient >= m_clients.size()) {
+        m_rampTimer->stop();
+        return;
+    }
+
+    // таймер разгона тикает не точно, поэтому догоняем по расписанию
+    const int due = (m_options.rampUp > 0)
+            ? qMin(m_clients.size(), static_cast<int>(m_clock.elapsed() * m_clients.size() / (m_options.rampUp * 1000)) + 1)
+            : m_clients.size();
+    while (m_nextClient < due) {
+        const int index = m_nextClient++;
+        Client& client = m_clients[index];
+        client.connection = new Connection(m_parent);
+        client.connection->setGreetingMessage(QStringLiteral("loadgen-%1-%2")
+                                              .arg(QCoreApplication::applicationPid()).arg(index));
+        QObject::connect(client.connection, &Connection::connected,
+                         m_parent, [this, index](){ onConnected(index); });
+        QObject::connect(client.connection, &Connection::disconnected,
+                         m_parent, [this, index](){ onDisconnected(index); });
+        QObject::connect(client.connection, &Connection::newMessage,
+                         m_parent, [this](const ChatMessage& message){ onMessage(message); });
+        client.connectStarted = m_clock.nsecsElapsed();
+        client.connection->connectToHost(m_options.host, m_options.ports.at(index % m_options.ports.size()));
+    }
+}
+
+void LoadGenerator::Pimpl::onConnected(int index)
+{
+    Client& client = m_clients[index];
+    m_connectTimes.record((m_clock.nsecsElapsed() - client.connectStarted) / 1000);
+    client.ready = true;
+    m_ready.append(index);
+    ++m_connected;
+
+    if (m_sendStarted < 0) {
+        m_sendStarted = m_clock.nsecsElapsed();
+        m_lastTick = m_sendStarted;
+        m_sendTimer->start();
+        QTimer::singleShot(static_cast<int>(m_options.duration * 1000), m_parent, [this](){ stopSending(); });
+    }
+}
+
+void LoadGenerator::Pimpl::onDisconnected(int index)
+{
+    Client& client = m_clients[index];
+    if (!client.ready) {
+        return;
+    }
+    client.ready = false;
+    m_ready.removeOne(index);
+    if (!m_stopping) {
+        ++m_disconnects;
+    }
+}
+
+void LoadGenerator::Pimpl::onMessage(const ChatMessage &message)
+{
+    const QString& text = message.message;
+    if (!text.startsWith(QLatin1String(MarkerPrefix))) {
+        return;
+    }
+
+    const int timeStart = text.indexOf(QLatin1Char(' '), 3) + 1;
+    const int timeEnd = text.indexOf(QLatin1Char(' '), timeStart);
+    if ( (timeStart <= 0) || (timeEnd < 0) ) {
+        return;
+    }
+    const qint64 sentAt = text.midRef(timeStart, timeEnd - timeStart).toLongLong();
+    const qint64 latency = (m_clock.nsecsElapsed() - sentAt) / 1000;
+    m_latency.record(latency);
+    m_intervalLatency.record(latency);
+    // от метки сервера до получения, точность миллисекунда; часы общие только на одной машине
+    if (message.timestamp > 0) {
+        m_delivery.record(qMax<qint64>(QDateTime::currentMSecsSinceEpoch() - message.timestamp, 0) * 1000);
+    }
+    ++m_received;
+    ++m_intervalReceived;
+}
+
+void LoadGenerator::Pimpl::sendTick()
+{
+    const qint64 now = m_clock.nsecsElapsed();
+    m_sendBudget += m_options.rate * m_ready.size() * (now - m_lastTick) / 1e9;
+    m_lastTick = now;
+
+    // отправители идут по кругу, чтобы нагрузка ложилась на всех поровну
+    while ( (m_sendBudget >= 1) && !m_ready.isEmpty() ) {
+        m_nextSender = m_nextSender % m_ready.size();
+        const int index = m_ready.at(m_nextSender++);
+        if (m_clients.at(index).connection->sendMessage(message(index))) {
+            ++m_sent;
+            ++m_intervalSent;
+        }
+        m_sendBudget -= 1;
+    }
+}
+
+void LoadGenerator::Pimpl::stopSending()
+{
+    m_sendTimer->stop();
+    m_sendStopped = m_clock.nsecsElapsed();
+    // даём дойти уже отправленному
+    QTimer::singleShot(DrainTime, m_parent, [this](){ finish(); });
+}
+
+void LoadGenerator::Pimpl::finish()
+{
+    m_stopping = true;
+    m_reportTimer->stop();
+    printSummary();
+    if (!m_options.csvPath.isEmpty()) {
+        writeCsv();
+    }
+    for (const Client& client : m_clients) {
+        if (client.connection) {
+            client.connection->abort();
+        }
+    }
+    emit m_parent->finished();
+}
+
+void LoadGenerator::Pimpl::printInterval()
+{
+    const qint64 now = m_clock.elapsed();
+    const double seconds = qMax<qint64>(now - m_lastReport, 1) / 1000.0;
+    m_lastReport = now;
+
+    std::printf("%8.1fs  connected %6d  disconnects %5d  sent %9.0f/s  received %10.0f/s  "
+                "latency p50 %8.2f ms  p99 %8.2f ms  p999 %8.2f ms\n",
+                now / 1000.0, m_ready.size(), m_disconnects,
+                m_intervalSent / seconds, m_intervalReceived / seconds,
+                ms(m_intervalLatency.percentile(0.5)), ms(m_intervalLatency.percentile(0.99)),
+                ms(m_intervalLatency.percentile(0.999)));
+    std::fflush(stdout);
+    m_intervalSent = 0;
+    m_intervalReceived = 0;
+    m_intervalLatency.clear();
+}
+
+void LoadGenerator::Pimpl::printSummary()
+{
+    const double seconds = (m_sendStarted < 0) ? 0 : (m_sendStopped - m_sendStarted) / 1e9;
+    std::printf("\n");
+    std::printf("clients          %d requested, %d connected, %d disconnects\n",
+                m_clients.size(), m_connected, m_disconnects);
+    std::printf("connect time     p50 %.2f ms  p99 %.2f ms  max %.2f ms\n",
+                ms(m_connectTimes.percentile(0.5)), ms(m_connectTimes.percentile(0.99)), ms(m_connectTimes.max()));
+    std::printf("sent             %llu messages, %.0f msg/s\n",
+                static_cast<unsigned long long>(m_sent), seconds > 0 ? m_sent / seconds : 0.0);
+    std::printf("received         %llu messages, %.0f msg/s\n",
+                static_cast<unsigned long long>(m_received), seconds > 0 ? m_received / seconds : 0.0);
+    std::printf("fan-out latency  p50 %.2f ms  p99 %.2f ms  p999 %.2f ms  max %.2f ms  mean %.2f ms\n",
+                ms(m_latency.percentile(0.5)), ms(m_latency.percentile(0.99)),
+                ms(m_latency.percentile(0.999)), ms(m_latency.max()), m_latency.mean() / 1000.0);
+    if (m_delivery.count() > 0) {
+        std::printf("server to client p50 %.0f ms  p99 %.0f ms  max %.0f ms\n",
+                    ms(m_delivery.percentile(0.5)), ms(m_delivery.percentile(0.99)), ms(m_delivery.max()));
+    }
+    std::fflush(stdout);
+}
+
+void LoadGenerator::Pimpl::writeCsv()
+{
+    QFile file(m_options.csvPath);
+    const bool isNew = !file.exists() || (file.size() == 0);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        std::fprintf(stderr, "Unable to write %s\n", qPrintable(m_options.csvPath));
+        return;
+    }
+
+    // по строке на запуск, чтобы сравнивать сборки в одном файле
+    QTextStream out(&file);
+    if (isNew) {
+        out << "label,clients,connected,disconnects,rate,size,duration_s,sent,received,"
+               "sent_per_s,received_per_s,connect_p50_ms,connect_p99_ms,connect_max_ms,"
+               "latency_p50_ms,latency_p99_ms,latency_p999_ms,latency_max_ms\n";
+    }
+    const double seconds = (m_sendStarted < 0) ? 0 : (m_sendStopped - m_sendStarted) / 1e9;
+    out << m_options.label << ',' << m_clients.size() << ',' << m_connected << ',' << m_disconnects << ','
+        << m_options.rate << ',' << m_options.size << ',' << seconds << ','
+        << m_sent << ',' << m_received << ','
+        << (seconds > 0 ? m_sent / seconds : 0.0) << ',' << (seconds > 0 ? m_received / seconds : 0.0) << ','
+        << ms(m_connectTimes.percentile(0.5)) << ',' << ms(m_connectTimes.percentile(0.99)) << ','
+        << ms(m_connectTimes.max()) << ','
+        << ms(m_latency.percentile(0.5)) << ',' << ms(m_latency.percentile(0.99)) << ','
+        << ms(m_latency.percentile(0.999)) << ',' << ms(m_latency.max()) << '\n';
+}
+
+QString LoadGenerator::Pimpl::message(int index)
+{
+    QString text = QLatin1String(MarkerPrefix) + QString::number(index) + QLatin1Char(' ') +
+                   QString::number(m_clock.nsecsElapsed()) + QLatin1Char(' ');
+    if (text.size() < m_options.size) {
+        text += QLatin1String(m_padding.constData(), m_options.size - text.size());
+    }
+    return text;
+}
+
+double LoadGenerator::Pimpl::ms(qint64 usecs)
+{
+    return usecs / 1000.0;
+}
+
+//-----------------------------------------------------------------------//
+//  LoadGenerator                                                        //
+//-----------------------------------------------------------------------//
+
+LoadGenerator::LoadGenerator(const Options &options, QObject *parent) :
+    QObject(parent)
+{
+    m_d = new Pimpl(options, this);
+    m_d->m_clients.resize(qMax(options.clients, 0));
+    m_d->m_padding = QByteArray(qMax(options.size, 0), 'x');
+
+    m_d->m_rampTimer = new QTimer(this);
+    m_d->m_rampTimer->setInterval(SendTick);
+    connect(m_d->m_rampTimer, &QTimer::timeout,
+            this, [this](){ m_d->connectNext(); });
+
+    m_d->m_sendTimer = new QTimer(this);
+    m_d->m_sendTimer->setTimerType(Qt::PreciseTimer);
+    m_d->m_sendTimer->setInterval(SendTick);
+    connect(m_d->m_sendTimer, &QTimer::timeout,
+            this, [this](){ m_d->sendTick(); });
+
+    m_d->m_reportTimer = new QTimer(this);
+    connect(m_d->m_reportTimer, &QTimer::timeout,
+            this, [this](){ m_d->printInterval(); });
+}
+
+LoadGenerator::~LoadGenerator()
+{
+    delete m_d;
+}
+
+void LoadGenerator::start()
+{
+    m_d->m_clock.start();
+    m_d->connectNext();
+    if (m_d->m_nextClient < m_d->m_clients.size()) {
+        m_d->m_rampTimer->start();
+    }
+    if (m_d->m_options.reportInterval > 0) {
+        m_d->m_reportTimer->start(static_cast<int>(m_d->m_options.reportInterval * 1000));
+    }
+}
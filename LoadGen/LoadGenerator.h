@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QObject>
+#include <QVector>
+#include <QString>
+
+//-----------------------------------------------------------------------//
+//  LoadGenerator                                                        //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Рой консольных клиентов на том же Connection, что и у GUI-клиента.
+ * Каждое отправленное сообщение несёт отметку времени отправки, каждый
+ * получатель по ней считает задержку доставки (fan-out).
+ */
+class LoadGenerator : public QObject {
+    Q_OBJECT
+public:
+    struct Options {
+        QString host = QStringLiteral("127.0.0.1");
+        QVector<quint16> ports;     /*!< Клиенты распределяются по портам узлов по кругу */
+        int clients = 100;
+        double rampUp = 0;          /*!< За сколько секунд подключаются все клиенты */
+        double rate = 1;            /*!< Сообщений в секунду от каждого клиента */
+        int size = 64;              /*!< Размер текста сообщения в байтах */
+        double duration = 10;       /*!< Длительность отправки в секундах */
+        double reportInterval = 1;  /*!< Период промежуточного отчёта, 0 — без него */
+        QString csvPath;
+        QString label;
+    };
+public:
+    explicit LoadGenerator(const Options& options, QObject *parent = nullptr);
+    ~LoadGenerator();
+public:
+    void start();
+signals:
+    void finished();
+private:
+    class Pimpl;
+    Pimpl* m_d;
+};
@@ -0,0 +1,97 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+
+#include "BenchSuite.h"
+#include "LoadGenerator.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QObject::tr("Opens many chat connections to a Server and measures message fan-out."));
+    parser.addHelpOption();
+    QCommandLineOption hostOption(QStringLiteral("host"),
+                                  QObject::tr("Server address."),
+                                  QObject::tr("address"), QStringLiteral("127.0.0.1"));
+    QCommandLineOption portOption(QStringLiteral("port"),
+                                  QObject::tr("Server port, or a comma-separated list of cluster node ports."),
+                                  QObject::tr("port"));
+    QCommandLineOption clientsOption(QStringLiteral("clients"),
+                                     QObject::tr("Number of connections to open."),
+                                     QObject::tr("count"), QStringLiteral("100"));
+    QCommandLineOption rampUpOption(QStringLiteral("ramp-up"),
+                                    QObject::tr("Spread connection attempts over <seconds> (0 connects all at once)."),
+                                    QObject::tr("seconds"), QStringLiteral("0"));
+    QCommandLineOption rateOption(QStringLiteral("rate"),
+                                  QObject::tr("Messages per second sent by each connection."),
+                                  QObject::tr("rate"), QStringLiteral("1"));
+    QCommandLineOption sizeOption(QStringLiteral("size"),
+                                  QObject::tr("Message text size in bytes."),
+                                  QObject::tr("bytes"), QStringLiteral("64"));
+    QCommandLineOption durationOption(QStringLiteral("duration"),
+                                      QObject::tr("How long to send, starting from the first connection."),
+                                      QObject::tr("seconds"), QStringLiteral("10"));
+    QCommandLineOption intervalOption(QStringLiteral("interval"),
+                                      QObject::tr("Print running figures every <seconds> (0 disables)."),
+                                      QObject::tr("seconds"), QStringLiteral("1"));
+    QCommandLineOption csvOption(QStringLiteral("csv"),
+                                 QObject::tr("Append a summary row (or benchmark rows) to <file>."),
+                                 QObject::tr("file"));
+    QCommandLineOption labelOption(QStringLiteral("label"),
+                                   QObject::tr("Label of the run in the CSV row, e.g. a build id."),
+                                   QObject::tr("label"));
+    QCommandLineOption benchOption(QStringLiteral("bench"),
+                                   QObject::tr("Run the offline protocol microbenchmarks instead of connecting."));
+    QCommandLineOption benchFilterOption(QStringLiteral("bench-filter"),
+                                         QObject::tr("Run only benchmark cases whose name contains <text>."),
+                                         QObject::tr("text"));
+    parser.addOption(hostOption);
+    parser.addOption(portOption);
+    parser.addOption(clientsOption);
+    parser.addOption(rampUpOption);
+    parser.addOption(rateOption);
+    parser.addOption(sizeOption);
+    parser.addOption(durationOption);
+    parser.addOption(intervalOption);
+    parser.addOption(csvOption);
+    parser.addOption(labelOption);
+    parser.addOption(benchOption);
+    parser.addOption(benchFilterOption);
+    parser.process(a);
+
+    if (parser.isSet(benchOption)) {
+        BenchSuite suite;
+        suite.setFilter(parser.value(benchFilterOption));
+        suite.setCsvPath(parser.value(csvOption), parser.value(labelOption));
+        return suite.run();
+    }
+
+    LoadGenerator::Options options;
+    options.host = parser.value(hostOption);
+    for (const QString& port : parser.value(portOption).split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        if (port.toUInt()) {
+            options.ports.append(static_cast<quint16>(port.toUInt()));
+        }
+    }
+    options.clients = parser.value(clientsOption).toInt();
+    options.rampUp = parser.value(rampUpOption).toDouble();
+    options.rate = parser.value(rateOption).toDouble();
+    options.size = parser.value(sizeOption).toInt();
+    options.duration = parser.value(durationOption).toDouble();
+    options.reportInterval = parser.value(intervalOption).toDouble();
+    options.csvPath = parser.value(csvOption);
+    options.label = parser.value(labelOption);
+    if (options.ports.isEmpty()) {
+        qDebug() << QObject::tr("The server port is required, see --help.");
+        return -1;
+    }
+
+    LoadGenerator generator(options);
+    QObject::connect(&generator, &LoadGenerator::finished,
+                     &a, &QCoreApplication::quit, Qt::QueuedConnection);
+    generator.start();
+
+    return a.exec();
+}
@@ -0,0 +1,151 @@
+#include "BroadcastHub.h"
+#include "Metrics.h"
+#include "Worker.h"
+
+#include <QHash>
+
+//-----------------------------------------------------------------------//
+//  EncodedFrame                                                         //
+//-----------------------------------------------------------------------//
+
+EncodedFrame::EncodedFrame(Protocol::DataType type, const QByteArray &payload, quint32 requiredCapabilities) :
+    m_type(type),
+    m_requiredCapabilities(requiredCapabilities),
+    m_createdAt(Metrics::timestamp()),
+    m_payload(payload),
+    m_text(Protocol::encodeFrame(type, payload, Protocol::TextFraming)),
+    m_binary(Protocol::encodeFrame(type, payload, Protocol::BinaryFraming))
+{
+}
+
+Protocol::DataType EncodedFrame::type() const
+{
+    return m_type;
+}
+
+const QByteArray &EncodedFrame::payload() const
+{
+    return m_payload;
+}
+
+const QByteArray &EncodedFrame::encoded(Protocol::Framing framing) const
+{
+    return (framing == Protocol::BinaryFraming) ? m_binary : m_text;
+}
+
+quint32 EncodedFrame::requiredCapabilities() const
+{
+    return m_requiredCapabilities;
+}
+
+qint64 EncodedFrame::createdAt() const
+{
+    return m_createdAt;
+}
+
+const EncodedFrame *EncodedFrame::fallback() const
+{
+    return m_fallback.data();
+}
+
+void EncodedFrame::setFallback(const EncodedFrame &fallback)
+{
+    m_fallback = QSharedPointer<const EncodedFrame>::create(fallback);
+}
+
+const EncodedFrame *EncodedFrame::select(quint32 capabilities) const
+{
+    if ( (capabilities & m_requiredCapabilities) == m_requiredCapabilities ) {
+        return this;
+    }
+    return m_fallback ? m_fallback->select(capabilities) : nullptr;
+}
+
+//-----------------------------------------------------------------------//
+//  BroadcastHub::Pimpl                                                  //
+//-----------------------------------------------------------------------//
+
+class BroadcastHub::Pimpl {
+public:
+    struct Group {
+        Worker* worker = nullptr;
+        QVector<quint64> targets; /*!< id сессий */
+    };
+    struct Position {
+        int group = -1;
+        int index = -1;
+    };
+public:
+    QVector<Group> m_groups;
+    QHash<quint64, Position> m_positions;
+};
+
+//-----------------------------------------------------------------------//
+//  BroadcastHub                                                         //
+//-----------------------------------------------------------------------//
+
+BroadcastHub::BroadcastHub(const QVector<Worker *> &workers)
+{
+    m_d = new Pimpl;
+    m_d->m_groups.resize(workers.size());
+    for (int i = 0; i < workers.size(); ++i) {
+        m_d->m_groups[i].worker = workers.at(i);
+    }
+}
+
+BroadcastHub::~BroadcastHub()
+{
+    delete m_d;
+}
+
+void BroadcastHub::addTarget(Worker *worker, quint64 id)
+{
+    for (int i = 0; i < m_d->m_groups.size(); ++i) {
+        Pimpl::Group& group = m_d->m_groups[i];
+        if (group.worker == worker) {
+            Pimpl::Position position;
+            position.group = i;
+            position.index = group.targets.size();
+            group.targets.append(id);
+            m_d->m_positions.insert(id, position);
+            return;
+        }
+    }
+}
+
+void BroadcastHub::removeTarget(quint64 id)
+{
+    const Pimpl::Position position = m_d->m_positions.take(id);
+    if (position.group < 0) {
+        return;
+    }
+
+    // удаление перестановкой последнего элемента, массив остаётся плотным
+    QVector<quint64>& targets = m_d->m_groups[position.group].targets;
+    const quint64 last = targets.last();
+    targets[position.index] = last;
+    targets.removeLast();
+    if (last != id) {
+        m_d->m_positions[last].index = position.index;
+    }
+}
+
+int BroadcastHub::targetCount() const
+{
+    return m_d->m_positions.size();
+}
+
+void BroadcastHub::broadcast(Protocol::DataType type, const QByteArray &payload)
+{
+    broadcast(EncodedFrame(type, payload));
+}
+
+void BroadcastHub::broadcast(const EncodedFrame &frame)
+{
+    for (const Pimpl::Group& group : m_d->m_groups) {
+        if (group.targets.isEmpty()) {
+            continue;
+        }
+        group.worker->deliver(frame, group.targets);
+    }
+}
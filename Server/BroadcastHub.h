@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Protocol.h"
+
+#include <QByteArray>
+#include <QSharedPointer>
+#include <QVector>
+
+class Worker;
+
+//-----------------------------------------------------------------------//
+//  EncodedFrame                                                         //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Кадр, закодированный один раз под каждый формат кадров и разделяемый
+ * всеми получателями: копия EncodedFrame не копирует данные.
+ * Если получатель не заявил requiredCapabilities(), ему уходит fallback(),
+ * а при его отсутствии — ничего.
+ */
+class EncodedFrame {
+public:
+    EncodedFrame() = default;
+    EncodedFrame(Protocol::DataType type, const QByteArray& payload,
+                 quint32 requiredCapabilities = Protocol::NoCapabilities);
+public:
+    Protocol::DataType type() const;
+    const QByteArray& payload() const;
+    const QByteArray& encoded(Protocol::Framing framing) const;
+    quint32 requiredCapabilities() const;
+    qint64 createdAt() const;
+    const EncodedFrame* fallback() const;
+    void setFallback(const EncodedFrame& fallback);
+    const EncodedFrame* select(quint32 capabilities) const;
+private:
+    Protocol::DataType m_type = Protocol::Undefined;
+    quint32 m_requiredCapabilities = Protocol::NoCapabilities;
+    qint64 m_createdAt = 0;
+    QByteArray m_payload;
+    QByteArray m_text;
+    QByteArray m_binary;
+    QSharedPointer<const EncodedFrame> m_fallback;
+};
+
+//-----------------------------------------------------------------------//
+//  BroadcastHub                                                         //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Рассылка кадра всем подписчикам: кадр кодируется один раз, каждому
+ * воркеру уходит одна пачка со списком id его сессий. Живёт в основном потоке.
+ */
+class BroadcastHub {
+public:
+    explicit BroadcastHub(const QVector<Worker*>& workers);
+    ~BroadcastHub();
+public:
+    void addTarget(Worker* worker, quint64 id);
+    void removeTarget(quint64 id);
+    int targetCount() const;
+    void broadcast(Protocol::DataType type, const QByteArray& payload);
+    void broadcast(const EncodedFrame& frame);
+private:
+    class Pimpl;
+    Pimpl* m_d;
+};
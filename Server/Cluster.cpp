@@ -0,0 +1,193 @@
+#include "Cluster.h"
+#include "ClusterLink.h"
+
+#include <QHash>
+#include <QTimer>
+#include <QVector>
+
+static const int ReconnectInterval = 1000;
+
+//-----------------------------------------------------------------------//
+//  Cluster::Pimpl                                                       //
+//-----------------------------------------------------------------------//
+
+class Cluster::Pimpl {
+public:
+    struct Peer {
+        QString host;
+        quint16 port = 0;
+        ClusterLink* link = nullptr;
+        int node = -1;
+    };
+public:
+    Pimpl(Cluster* parent);
+public:
+    void dial();
+    void adopt(ClusterLink* link);
+    void onHello(ClusterLink* link, int node);
+    void onClosed(ClusterLink* link);
+    bool prefer(const ClusterLink* link, int node) const;
+public:
+    QVector<Peer> m_peers;
+    QHash<int, ClusterLink*> m_links;
+    QTimer* m_reconnectTimer = nullptr;
+    int m_nodeId = 0;
+    QByteArray m_secret;
+    Cluster* m_parent = nullptr;
+};
+
+Cluster::Pimpl::Pimpl(Cluster *parent) :
+    m_parent(parent)
+{
+}
+
+void Cluster::Pimpl::dial()
+{
+    for (Peer& peer : m_peers) {
+        if ( peer.link || ((peer.node >= 0) && m_links.contains(peer.node)) ) {
+            continue;
+        }
+        ClusterLink* link = new ClusterLink(true, m_parent);
+        peer.link = link;
+        adopt(link);
+        link->connectToHost(peer.host, peer.port);
+    }
+}
+
+void Cluster::Pimpl::adopt(ClusterLink *link)
+{
+    QObject::connect(link, &ClusterLink::helloReceived,
+                     m_parent, [this, link](int node){
+        onHello(link, node);
+    });
+    QObject::connect(link, &ClusterLink::frameReceived,
+                     m_parent, [this, link](Protocol::DataType type, const QByteArray& payload){
+        // кадры отброшенной дублирующей связи не учитываются
+        if (m_links.value(link->node()) == link) {
+            emit m_parent->frameReceived(link->node(), type, payload);
+        }
+    });
+    QObject::connect(link, &ClusterLink::stateChanged,
+                     m_parent, [this, link](QAbstractSocket::SocketState state){
+        if (state == QAbstractSocket::UnconnectedState) {
+            onClosed(link);
+        }
+    });
+    link->setSecret(m_secret);
+    link->sendHello(m_nodeId);
+}
+
+void Cluster::Pimpl::onHello(ClusterLink *link, int node)
+{
+    if (node == m_nodeId) {
+        link->abort();
+        return;
+    }
+    for (Peer& peer : m_peers) {
+        if (peer.link == link) {
+            peer.node = node;
+        }
+    }
+
+    ClusterLink* current = m_links.value(node);
+    if (current && !prefer(link, node)) {
+        link->abort();
+        return;
+    }
+    m_links.insert(node, link);
+    if (current) {
+        current->abort();
+    }
+    // и при замене связи: кадры, ушедшие по старой, могли потеряться
+    emit m_parent->nodeJoined(node);
+}
+
+void Cluster::Pimpl::onClosed(ClusterLink *link)
+{
+    for (Peer& peer : m_peers) {
+        if (peer.link == link) {
+            peer.link = nullptr;
+        }
+    }
+    const int node = link->node();
+    if ( (node >= 0) && (m_links.value(node) == link) ) {
+        m_links.remove(node);
+        emit m_parent->nodeLeft(node);
+    }
+    link->deleteLater();
+}
+
+bool Cluster::Pimpl::prefer(const ClusterLink *link, int node) const
+{
+    // обе стороны выбирают одну и ту же связь: открытую меньшим номером
+    const int opener = link->isOutbound() ? m_nodeId : node;
+    return opener == qMin(m_nodeId, node);
+}
+
+//-----------------------------------------------------------------------//
+//  Cluster                                                              //
+//-----------------------------------------------------------------------//
+
+Cluster::Cluster(int nodeId, const QByteArray &secret, QObject *parent) : QTcpServer(parent)
+{
+    m_d = new Pimpl(this);
+    m_d->m_nodeId = nodeId;
+    m_d->m_secret = secret;
+    m_d->m_reconnectTimer = new QTimer(this);
+    m_d->m_reconnectTimer->setInterval(ReconnectInterval);
+    connect(m_d->m_reconnectTimer, &QTimer::timeout,
+            this, [this](){
+        m_d->dial();
+    });
+    m_d->m_reconnectTimer->start();
+}
+
+Cluster::~Cluster()
+{
+    // связи закрываются вместе с объектом, об уходе узлов уже некому сообщать
+    for (ClusterLink* link : findChildren<ClusterLink*>()) {
+        link->disconnect(this);
+    }
+    delete m_d;
+}
+
+int Cluster::nodeId() const
+{
+    return m_d->m_nodeId;
+}
+
+int Cluster::nodeCount() const
+{
+    return m_d->m_links.size() + 1;
+}
+
+void Cluster::addPeer(const QString &host, quint16 port)
+{
+    Pimpl::Peer peer;
+    peer.host = host;
+    peer.port = port;
+    m_d->m_peers.append(peer);
+    m_d->dial();
+}
+
+void Cluster::broadcast(Protocol::DataType type, const QByteArray &payload)
+{
+    for (ClusterLink* link : m_d->m_links) {
+        link->relay(type, payload);
+    }
+}
+
+void Cluster::send(int node, Protocol::DataType type, const QByteArray &payload)
+{
+    if (ClusterLink* link = m_d->m_links.value(node)) {
+        link->relay(type, payload);
+    }
+}
+
+void Cluster::incomingConnection(qintptr socketDescriptor)
+{
+    ClusterLink* link = new ClusterLink(false, this);
+    link->setSocketDescriptor(socketDescriptor);
+    link->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    m_d->adopt(link);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <QTcpServer>
+
+#include "Protocol.h"
+
+//-----------------------------------------------------------------------//
+//  Cluster                                                              //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Связи сервера с остальными узлами кластера: слушает свой порт и сам
+ * подключается к перечисленным узлам, переподключаясь после обрывов.
+ * Кадры не пересылаются дальше, поэтому каждый узел должен знать все
+ * остальные. Если два узла подключились друг к другу одновременно,
+ * остаётся связь, которую открыл узел с меньшим номером. Узлы доказывают
+ * знание общего секрета в приветствии.
+ */
+class Cluster : public QTcpServer {
+    Q_OBJECT
+public:
+    Cluster(int nodeId, const QByteArray& secret, QObject *parent = nullptr);
+    ~Cluster();
+public:
+    int nodeId() const;
+    int nodeCount() const;
+    void addPeer(const QString& host, quint16 port);
+    void broadcast(Protocol::DataType type, const QByteArray& payload);
+    void send(int node, Protocol::DataType type, const QByteArray& payload);
+signals:
+    void nodeJoined(int node);
+    void nodeLeft(int node);
+    void frameReceived(int node, Protocol::DataType type, const QByteArray& payload);
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+private:
+    class Pimpl;
+    Pimpl* m_d;
+};
@@ -0,0 +1,196 @@
+#include "ClusterLink.h"
+#include "FrameDecoder.h"
+
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMessageAuthenticationCode>
+#include <QTimer>
+
+static const int HeartbeatInterval = 1000;
+static const int LinkTimeout = 5 * 1000;
+// пачка крупнее уходит сразу, не дожидаясь конца итерации
+static const int MaxBatchSize = 64 * 1024;
+
+//-----------------------------------------------------------------------//
+//  ClusterLink::Pimpl                                                   //
+//-----------------------------------------------------------------------//
+
+class ClusterLink::Pimpl {
+public:
+    Pimpl(ClusterLink* parent);
+public:
+    void processFrame(const FrameDecoder::Frame& frame);
+    void heartbeat();
+    void flush();
+    QByteArray signature(int node) const;
+public:
+    FrameDecoder m_decoder;
+    QByteArray m_batch;
+    QByteArray m_secret;
+    QTimer* m_heartbeatTimer = nullptr;
+    QElapsedTimer m_lastReceived;
+    QElapsedTimer m_lastSent;
+    int m_node = -1;
+    bool m_outbound = false;
+    bool m_flushScheduled = false;
+    ClusterLink* m_parent = nullptr;
+};
+
+ClusterLink::Pimpl::Pimpl(ClusterLink *parent) :
+    m_parent(parent)
+{
+}
+
+void ClusterLink::Pimpl::processFrame(const FrameDecoder::Frame &frame)
+{
+    switch (frame.type) {
+    case Protocol::Ping: {
+        break;
+    }
+    case Protocol::NodeHello: {
+        const QJsonObject hello = QJsonDocument::fromJson(frame.payload).object();
+        const int node = hello.value(QLatin1String("node")).toInt(-1);
+        const QByteArray auth = hello.value(QLatin1String("auth")).toString().toLatin1();
+        // без общего секрета узел не принимается: иначе любой, кто достучался
+        // до порта, мог бы писать от имени чужих участников
+        if ( (node < 0) || m_secret.isEmpty() || (auth != signature(node)) ) {
+            m_parent->abort();
+            return;
+        }
+        m_node = node;
+        emit m_parent->helloReceived(m_node);
+        break;
+    }
+    default:
+        // до приветствия узел неизвестен, и его кадры некому отдать
+        if (m_node >= 0) {
+            emit m_parent->frameReceived(frame.type, QByteArray(frame.payload.constData(), frame.payload.size()));
+        }
+        break;
+    }
+}
+
+QByteArray ClusterLink::Pimpl::signature(int node) const
+{
+    return QMessageAuthenticationCode::hash(QByteArray("node:") + QByteArray::number(node),
+                                            m_secret, QCryptographicHash::Sha256).toHex();
+}
+
+void ClusterLink::Pimpl::heartbeat()
+{
+    // тот же срок действует и на установку соединения
+    if (m_lastReceived.elapsed() > LinkTimeout) {
+        m_parent->abort();
+        return;
+    }
+    if ( (m_parent->state() == QAbstractSocket::ConnectedState) && (m_lastSent.elapsed() >= HeartbeatInterval) ) {
+        m_parent->relay(Protocol::Ping, QByteArray());
+    }
+}
+
+void ClusterLink::Pimpl::flush()
+{
+    m_flushScheduled = false;
+    if (m_batch.isEmpty() || (m_parent->state() != QAbstractSocket::ConnectedState)) {
+        return;
+    }
+    m_parent->write(m_batch);
+    m_batch.clear();
+    m_lastSent.restart();
+}
+
+//-----------------------------------------------------------------------//
+//  ClusterLink                                                          //
+//-----------------------------------------------------------------------//
+
+ClusterLink::ClusterLink(bool outbound, QObject *parent) : QTcpSocket(parent)
+{
+    m_d = new Pimpl(this);
+    m_d->m_outbound = outbound;
+    m_d->m_lastReceived.start();
+    m_d->m_lastSent.start();
+    m_d->m_heartbeatTimer = new QTimer(this);
+    m_d->m_heartbeatTimer->setInterval(HeartbeatInterval);
+    connect(m_d->m_heartbeatTimer, &QTimer::timeout,
+            this, [this](){
+        m_d->heartbeat();
+    });
+    connect(this, &ClusterLink::connected,
+            this, [this](){
+        setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        m_d->m_lastReceived.restart();
+        m_d->flush();
+    });
+    connect(this, &ClusterLink::readyRead,
+            this, &ClusterLink::processReadyRead);
+    m_d->m_heartbeatTimer->start();
+}
+
+ClusterLink::~ClusterLink()
+{
+    delete m_d;
+}
+
+bool ClusterLink::isOutbound() const
+{
+    return m_d->m_outbound;
+}
+
+int ClusterLink::node() const
+{
+    return m_d->m_node;
+}
+
+void ClusterLink::setSecret(const QByteArray &secret)
+{
+    m_d->m_secret = secret;
+}
+
+void ClusterLink::sendHello(int node)
+{
+    QJsonObject hello = QJsonObject{
+                            {QLatin1String("node"), node},
+                            {QLatin1String("auth"), QString::fromLatin1(m_d->signature(node))}
+                        };
+    relay(Protocol::NodeHello, QJsonDocument(hello).toJson(QJsonDocument::Compact));
+}
+
+void ClusterLink::relay(Protocol::DataType type, const QByteArray &payload)
+{
+    m_d->m_batch.append(Protocol::encodeFrame(type, payload, Protocol::BinaryFraming));
+    if (m_d->m_batch.size() >= MaxBatchSize) {
+        m_d->flush();
+        return;
+    }
+    if (!m_d->m_flushScheduled) {
+        m_d->m_flushScheduled = true;
+        QTimer::singleShot(0, this, [this](){
+            m_d->flush();
+        });
+    }
+}
+
+void ClusterLink::processReadyRead()
+{
+    if (m_d->m_decoder.readFrom(this) <= 0) {
+        return;
+    }
+    m_d->m_lastReceived.restart();
+
+    FrameDecoder::Frame frame;
+    forever {
+        const FrameDecoder::Status status = m_d->m_decoder.next(&frame);
+        if (status == FrameDecoder::NeedMoreData) {
+            break;
+        }
+        if (status == FrameDecoder::Malformed) {
+            abort();
+            return;
+        }
+        m_d->processFrame(frame);
+        if (state() != QAbstractSocket::ConnectedState) {
+            return;
+        }
+    }
+}
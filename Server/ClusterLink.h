@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QTcpSocket>
+
+#include "Protocol.h"
+
+//-----------------------------------------------------------------------//
+//  ClusterLink                                                          //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Постоянное соединение с другим сервером кластера, только двоичные кадры.
+ * Кадры копятся в пачку и уходят одной записью в конце итерации цикла
+ * событий, подтверждений нет: порядок и доставку обеспечивает TCP.
+ * Молчащий дольше LinkTimeout узел считается упавшим. Приветствие несёт
+ * HMAC номера узла на общем секрете; связь с неверной подписью рвётся.
+ */
+class ClusterLink : public QTcpSocket {
+    Q_OBJECT
+public:
+    explicit ClusterLink(bool outbound, QObject *parent = nullptr);
+    ~ClusterLink();
+public:
+    bool isOutbound() const;
+    int node() const;
+    void setSecret(const QByteArray& secret);
+    void sendHello(int node);
+    void relay(Protocol::DataType type, const QByteArray& payload);
+signals:
+    void helloReceived(int node);
+    void frameReceived(Protocol::DataType type, const QByteArray& payload);
+private slots:
+    void processReadyRead();
+private:
+    class Pimpl;
+    Pimpl* m_d;
+};
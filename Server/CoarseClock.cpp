@@ -0,0 +1,37 @@
+#include "CoarseClock.h"
+
+#include <QDateTime>
+
+static const qint64 ResyncInterval = 60 * 1000;
+
+//-----------------------------------------------------------------------//
+//  CoarseClock                                                          //
+//-----------------------------------------------------------------------//
+
+CoarseClock::CoarseClock()
+{
+    m_epoch = QDateTime::currentMSecsSinceEpoch();
+    m_timer.start();
+}
+
+qint64 CoarseClock::now()
+{
+    if (m_timer.elapsed() >= ResyncInterval) {
+        m_epoch = QDateTime::currentMSecsSinceEpoch();
+        m_timer.restart();
+    }
+
+    // после подводки системных часов метки не должны идти назад
+    m_last = qMax(m_last, m_epoch + m_timer.elapsed());
+    return m_last;
+}
+
+const QString &CoarseClock::text(qint64 msecs)
+{
+    const qint64 second = msecs / 1000;
+    if (second != m_textSecond) {
+        m_textSecond = second;
+        m_text = QDateTime::fromMSecsSinceEpoch(second * 1000).toString(QLatin1String("dd.MM.yyyy hh:mm:ss"));
+    }
+    return m_text;
+}
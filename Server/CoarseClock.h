@@ -0,0 +1,27 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QString>
+
+//-----------------------------------------------------------------------//
+//  CoarseClock                                                          //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Метки времени для сообщений. Системные часы читаются раз в минуту, между
+ * чтениями время идёт по монотонному таймеру и назад не откатывается.
+ * Строка старого формата пересобирается не чаще раза в секунду.
+ */
+class CoarseClock {
+public:
+    CoarseClock();
+public:
+    qint64 now();
+    const QString& text(qint64 msecs);
+private:
+    QElapsedTimer m_timer;
+    qint64 m_epoch = 0;
+    qint64 m_last = 0;
+    qint64 m_textSecond = -1;
+    QString m_text;
+};
@@ -1,14 +1,30 @@
 #include "Connection.h"
-#include <QTimer>
-#include <QTime>
-#include <QTimerEvent>
+#include "BroadcastHub.h"
+#include "Compression.h"
+#include "FrameDecoder.h"
+#include "Metrics.h"
+#include "WriteCoalescer.h"
 #include <QHostAddress>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <limits>
 
 static const int TransferTimeout = 30 * 1000;
 static const int PongTimeout = 30 * 1000;
 static const int PingInterval = 100;
-static const char SeparatorToken = ' ';
-static const int MaxBufferSize = 1024000;
+static const quint32 SupportedCapabilities = Protocol::CapabilityBinaryFraming |
+                                             Protocol::CapabilityPresence |
+                                             Protocol::CapabilityMissedMarker |
+                                             Protocol::CapabilityHistoryPaging |
+                                             Protocol::CapabilityCompression |
+                                             Protocol::CapabilityRooms |
+                                             Protocol::CapabilitySessions |
+                                             Protocol::CapabilityCbor;
+// больше сообщений за один HISTORY_PAGE не отдаётся
+static const int MaxHistoryPageSize = 200;
+// во сколько раз сверх верхней отметки очередь может вырасти до отключения
+static const int HardLimitFactor = 4;
 
 //-----------------------------------------------------------------------//
 //  Connection::Pimpl                                                    //
@@ -18,143 +34,322 @@ class Connection::Pimpl {
 public:
     Pimpl(Connection* parent);
 public:
-    int readDataIntoBuffer(int maxSize = MaxBufferSize);
-    int dataLengthForCurrentDataType();
-    bool readProtocolHeader();
-    bool hasEnoughData();
-    void processData();
+    bool processFrame(const FrameDecoder::Frame& frame);
+    bool processGreeting(const QByteArray& greeting);
+    void processCapabilities(const QByteArray& offer);
+    void processHistoryPage(const QByteArray& request);
+    void setState(Connection::ConnectionState state);
+    void countOut(Protocol::DataType type);
+    void send(const QByteArray& data);
+    void flush();
+    QByteArray compressed(Protocol::DataType type, const QByteArray& payload);
+    qint64 pingDue() const;
+    void touch();
+    bool admit(const EncodedFrame& frame);
+    void drop(const EncodedFrame& frame);
+    void onDrained();
 public:
     QString m_username = tr("unknown");
     QString m_userIp;
     quint16 m_userPort = 0;
-    QTimer* m_pingTimer = nullptr;
-    QTime m_pongTime;
-    QByteArray m_buffer;
+    FrameDecoder m_decoder;
+    Protocol::Framing m_framing = Protocol::TextFraming;
+    quint32 m_capabilities = Protocol::NoCapabilities;
     Connection::ConnectionState m_state = Connection::WaitingForGreeting;
-    Connection::DataType m_currentDataType = Connection::Undefined;
-    int m_numBytesForCurrentDataType = -1;
-    int m_transferTimerId = 0;
+    TimingWheel* m_wheel = nullptr;
+    Metrics* m_metrics = nullptr;
+    WriteCoalescer* m_coalescer = nullptr;
+    QByteArray m_pending;
+    qint64 m_coalesceWindow = 0;
+    int m_coalesceBytes = 16 * 1024;
+    qint64 m_lastFlush = std::numeric_limits<qint64>::min() / 2;
+    bool m_flushScheduled = false;
+    DeflateStream m_deflate;
+    int m_compressThreshold = 0;
+    qint64 m_lastReceived = 0;
+    qint64 m_lastPingSent = 0;
+    bool m_idleOnlyPing = false;
+    Connection::SlowConsumerPolicy m_policy = Connection::CollapseMissed;
+    qint64 m_highWatermark = 1024 * 1024;
+    qint64 m_lowWatermark = 256 * 1024;
+    bool m_congested = false;
+    quint64 m_droppedFrames = 0;
+    int m_missedMessages = 0;
+    bool m_presenceDropped = false;
+    QByteArray m_droppedParticipants;
     Connection* m_parent = nullptr;
 };
 Connection::Pimpl::Pimpl(Connection* parent) :
     m_parent(parent)
 {}
 
-int Connection::Pimpl::readDataIntoBuffer(int maxSize)
+bool Connection::Pimpl::processFrame(const FrameDecoder::Frame &frame)
 {
-    if (maxSize > MaxBufferSize) {
-        return 0;
+    if (m_metrics) {
+        m_metrics->frameIn(frame.type);
     }
-
-    int numBytesBeforeRead = m_buffer.size();
-    if (numBytesBeforeRead == MaxBufferSize) {
-        m_parent->abort();
-        return 0;
+    if (m_state != Connection::ReadyForUse) {
+        if (frame.type != Protocol::Greeting) {
+            m_parent->abort();
+            return false;
+        }
+        return processGreeting(frame.payload);
     }
 
-    while (m_parent->bytesAvailable() > 0 && m_buffer.size() < maxSize) {
-        m_buffer.append(m_parent->read(1));
-        if (m_buffer.endsWith(SeparatorToken)) {
-            break;
+    switch (frame.type) {
+    case Protocol::PlainText: {
+        // кадр указывает внутрь приёмного буфера, а сигнал уходит в другой поток
+        emit m_parent->writeMessage(QByteArray(frame.payload.constData(), frame.payload.size()));
+        break;
+    }
+    case Protocol::Ping: {
+        send(Protocol::controlFrame(Protocol::Pong, m_framing));
+        countOut(Protocol::Pong);
+        break;
+    }
+    case Protocol::Pong: {
+        // приход любых данных уже отмечен в touch()
+        break;
+    }
+    case Protocol::Greeting: {
+        processCapabilities(frame.payload);
+        break;
+    }
+    case Protocol::PresenceSync: {
+        emit m_parent->presenceSyncRequested();
+        break;
+    }
+    case Protocol::HistoryPage: {
+        processHistoryPage(frame.payload);
+        break;
+    }
+    case Protocol::JoinRoom: {
+        const QString room = QString::fromUtf8(frame.payload).trimmed();
+        if (room.size() <= Protocol::MaxRoomNameSize) {
+            emit m_parent->roomRequested(room);
         }
+        break;
     }
-    return m_buffer.size() - numBytesBeforeRead;
+    case Protocol::LeaveRoom: {
+        // вышедший из комнаты возвращается в общую
+        emit m_parent->roomRequested(QString());
+        break;
+    }
+    default:
+        break;
+    }
+    return true;
 }
 
-int Connection::Pimpl::dataLengthForCurrentDataType()
+bool Connection::Pimpl::processGreeting(const QByteArray &greeting)
 {
-    if ( (m_parent->bytesAvailable() <= 0) || (readDataIntoBuffer() <= 0) || !m_buffer.endsWith(SeparatorToken) ) {
-        return 0;
+    m_username = QString::fromUtf8(greeting);
+    m_userIp = m_parent->peerAddress().toString();
+    m_userPort = m_parent->peerPort();
+    emit m_parent->changeConnectionName(m_username);
+
+    if (!m_parent->isValid()) {
+        m_parent->abort();
+        return false;
     }
 
-    m_buffer.chop(1);
-    int number = m_buffer.toInt();
-    m_buffer.clear();
-    return number;
+    m_lastPingSent = m_lastReceived;
+    setState(Connection::ReadyForUse);
+    return true;
 }
 
-bool Connection::Pimpl::readProtocolHeader()
+void Connection::Pimpl::processCapabilities(const QByteArray &offer)
 {
-    if (m_transferTimerId) {
-        m_parent->killTimer(m_transferTimerId);
-        m_transferTimerId = 0;
+    m_capabilities = Protocol::capabilitiesFromNames(offer) & SupportedCapabilities;
+    // флаг сжатия есть только в двоичном заголовке
+    if ( (m_compressThreshold <= 0) || !(m_capabilities & Protocol::CapabilityBinaryFraming) ) {
+        m_capabilities &= ~Protocol::CapabilityCompression;
     }
 
-    if (readDataIntoBuffer() <= 0) {
-        m_transferTimerId = m_parent->startTimer(TransferTimeout);
-        return false;
+    // ответ уходит ещё в текущем формате, клиент переключается, получив его
+    m_parent->sendFrame(Protocol::Greeting, Protocol::capabilityNames(m_capabilities));
+    if (m_capabilities & Protocol::CapabilityBinaryFraming) {
+        m_framing = Protocol::BinaryFraming;
     }
+    emit m_parent->capabilitiesNegotiated(m_capabilities);
+}
 
-    if (m_buffer == "PING ") {
-        m_currentDataType = Ping;
+void Connection::Pimpl::processHistoryPage(const QByteArray &request)
+{
+    // "before=<seq> limit=<n>", любой из параметров можно опустить
+    quint64 before = std::numeric_limits<quint64>::max();
+    int limit = MaxHistoryPageSize;
+    for (const QByteArray& param : request.split(Protocol::SeparatorToken)) {
+        if (param.startsWith("before=")) {
+            before = param.mid(7).toULongLong();
+        }
+        else if (param.startsWith("limit=")) {
+            limit = qBound(1, param.mid(6).toInt(), MaxHistoryPageSize);
+        }
     }
-    else if (m_buffer == "PONG ") {
-        m_currentDataType = Pong;
+    emit m_parent->historyPageRequested(before, limit);
+}
+
+void Connection::Pimpl::setState(Connection::ConnectionState state)
+{
+    if (m_metrics) {
+        m_metrics->stateChanged(m_state, state);
     }
-    else if (m_buffer == "MESSAGE ") {
-        m_currentDataType = PlainText;
+    m_state = state;
+}
+
+void Connection::Pimpl::countOut(Protocol::DataType type)
+{
+    if (m_metrics) {
+        m_metrics->frameOut(type);
     }
-    else if (m_buffer == "GREETING ") {
-        m_currentDataType = Greeting;
+}
+
+void Connection::Pimpl::send(const QByteArray &data)
+{
+    if (!m_coalescer || (m_coalesceWindow <= 0)) {
+        m_parent->write(data);
+        if (m_metrics) {
+            m_metrics->socketWrite();
+        }
+        return;
     }
-    else {
-        m_currentDataType = Undefined;
-        m_parent->abort();
-        return false;
+
+    // кадр после паузы уходит сразу, копятся только идущие следом за ним,
+    // так что одиночное сообщение окном не задерживается
+    const qint64 now = Metrics::timestamp();
+    if ( m_pending.isEmpty() && (now - m_lastFlush >= m_coalesceWindow) ) {
+        m_pending = data;
+        flush();
+        return;
     }
 
-    m_buffer.clear();
-    m_numBytesForCurrentDataType = dataLengthForCurrentDataType();
-    return true;
+    m_pending.append(data);
+    if (m_pending.size() >= m_coalesceBytes) {
+        flush();
+    }
+    else if (!m_flushScheduled) {
+        m_flushScheduled = true;
+        m_coalescer->schedule(m_parent, now + m_coalesceWindow);
+    }
 }
 
-bool Connection::Pimpl::hasEnoughData()
+void Connection::Pimpl::flush()
 {
-    if (m_transferTimerId) {
-        m_parent->killTimer(m_transferTimerId);
-        m_transferTimerId = 0;
+    if (m_pending.isEmpty()) {
+        return;
     }
+    m_parent->write(m_pending);
+    m_pending.clear();
+    m_lastFlush = Metrics::timestamp();
+    if (m_metrics) {
+        m_metrics->socketWrite();
+    }
+}
 
-    if (m_numBytesForCurrentDataType <= 0) {
-        m_numBytesForCurrentDataType = dataLengthForCurrentDataType();
+QByteArray Connection::Pimpl::compressed(Protocol::DataType type, const QByteArray &payload)
+{
+    // короткие кадры не сжимаются, а до переключения на v2 сжимать нельзя
+    if ( !(m_capabilities & Protocol::CapabilityCompression) || (m_framing != Protocol::BinaryFraming) ||
+         (payload.size() < m_compressThreshold) ) {
+        return QByteArray();
     }
 
-    if ( (m_parent->bytesAvailable() < m_numBytesForCurrentDataType) || (m_numBytesForCurrentDataType <= 0) ) {
-        m_transferTimerId = m_parent->startTimer(TransferTimeout);
-        return false;
+    QByteArray data;
+    if (!m_deflate.compress(payload, &data)) {
+        m_parent->abort();
+        return QByteArray();
     }
+    return Protocol::encodeHeader(type, data.size(), m_framing, Protocol::FlagCompressed) + data;
+}
 
-    return true;
+qint64 Connection::Pimpl::pingDue() const
+{
+    // в режиме idle-only недавно писавший клиент не пингуется
+    const qint64 lastActivity = m_idleOnlyPing ? qMax(m_lastReceived, m_lastPingSent) : m_lastPingSent;
+    return lastActivity + PingInterval;
 }
 
-void Connection::Pimpl::processData()
+void Connection::Pimpl::touch()
 {
-    m_buffer = m_parent->read(m_numBytesForCurrentDataType);
-    if (m_buffer.size() != m_numBytesForCurrentDataType) {
+    if (m_wheel) {
+        m_lastReceived = m_wheel->now();
+    }
+}
+
+bool Connection::Pimpl::admit(const EncodedFrame &frame)
+{
+    if (!m_congested) {
+        return true;
+    }
+    if ( (m_policy == Connection::DisconnectSlowConsumer) ||
+         (m_parent->queuedBytes() > m_highWatermark * HardLimitFactor) ) {
         m_parent->abort();
-        return;
+        return false;
     }
 
-    switch (m_currentDataType) {
-    case PlainText: {
-        emit m_parent->writeMessage(m_buffer);
+    switch (frame.type()) {
+    case Protocol::PlainText:
+        if (m_policy == Connection::DropNonEssential) {
+            return true;
+        }
         break;
-    }
-    case Ping: {
-        m_parent->write("PONG 1 p");
+    case Protocol::Join:
+    case Protocol::Leave:
+    case Protocol::Participants:
+    case Protocol::PresenceAdd:
+    case Protocol::PresenceRemove:
         break;
+    default:
+        // служебные кадры не копятся и нужны для работы соединения
+        return true;
     }
-    case Pong: {
-        m_pongTime.restart();
+
+    drop(frame);
+    return false;
+}
+
+void Connection::Pimpl::drop(const EncodedFrame &frame)
+{
+    ++m_droppedFrames;
+    switch (frame.type()) {
+    case Protocol::PlainText:
+        ++m_missedMessages;
+        break;
+    case Protocol::PresenceAdd:
+    case Protocol::PresenceRemove:
+        m_presenceDropped = true;
+        break;
+    case Protocol::Participants:
+        // из полных списков важен только последний
+        m_droppedParticipants = frame.encoded(m_framing);
         break;
-    }
     default:
         break;
     }
+}
 
-    m_currentDataType = Undefined;
-    m_numBytesForCurrentDataType = 0;
-    m_buffer.clear();
+void Connection::Pimpl::onDrained()
+{
+    m_congested = false;
+    if (!m_droppedParticipants.isEmpty()) {
+        send(m_droppedParticipants);
+        countOut(Protocol::Participants);
+        m_droppedParticipants.clear();
+    }
+    if (m_presenceDropped) {
+        m_presenceDropped = false;
+        emit m_parent->presenceSyncRequested();
+    }
+    if (m_missedMessages > 0) {
+        if (m_capabilities & Protocol::CapabilityMissedMarker) {
+            QJsonObject marker = QJsonObject{
+                                    {QLatin1String("count"), m_missedMessages}
+                                 };
+            m_parent->sendFrame(Protocol::Missed, QJsonDocument(marker).toJson(QJsonDocument::Compact));
+        }
+        m_missedMessages = 0;
+    }
 }
 
 //-----------------------------------------------------------------------//
@@ -165,105 +360,191 @@ Connection::Connection(qintptr socketDescriptor, QObject *parent) : QTcpSocket(p
 {
     m_d = new Pimpl(this);
     setSocketDescriptor(socketDescriptor);
-    m_d->m_pingTimer = new QTimer(this);
-    m_d->m_pingTimer->setInterval(PingInterval);
 
     connect(this, &Connection::readyRead,
             this, &Connection::processReadyRead);
-    connect(this, &Connection::disconnected,
-            m_d->m_pingTimer, &QTimer::stop);
-    connect(m_d->m_pingTimer, &QTimer::timeout,
-            this, &Connection::sendPing);
+    connect(this, &Connection::bytesWritten,
+            this, [this](qint64 bytes){
+        if (m_d->m_metrics) {
+            m_d->m_metrics->bytesOut(bytes);
+        }
+        if (m_d->m_congested && (queuedBytes() <= m_d->m_lowWatermark)) {
+            m_d->onDrained();
+        }
+    });
 }
 
 Connection::~Connection()
 {
+    if (m_d->m_metrics) {
+        m_d->m_metrics->stateChanged(m_d->m_state, -1);
+    }
     delete m_d;
 }
 
-void Connection::onWrite(const QByteArray &text)
+void Connection::sendFrame(Protocol::DataType type, const QByteArray &payload)
 {
-    write(text);
+    const QByteArray frame = m_d->compressed(type, payload);
+    m_d->send(frame.isEmpty() ? Protocol::encodeFrame(type, payload, m_d->m_framing) : frame);
+    m_d->countOut(type);
 }
 
-void Connection::onNameError(Connection *conn)
+void Connection::writeFrame(const EncodedFrame &frame)
 {
-    if (conn == this) {
-        write("NAMEERROR 1 e");
-        disconnectFromHost();
+    const EncodedFrame* selected = frame.select(m_d->m_capabilities);
+    if (!selected || !m_d->admit(*selected)) {
+        return;
+    }
+
+    // сжатый кадр у каждого соединения свой, общий буфер годится только для несжатого
+    const QByteArray compressed = m_d->compressed(selected->type(), selected->payload());
+    m_d->send(compressed.isEmpty() ? selected->encoded(m_d->m_framing) : compressed);
+    m_d->countOut(selected->type());
+    if (queuedBytes() > m_d->m_highWatermark) {
+        m_d->m_congested = true;
     }
 }
 
-void Connection::timerEvent(QTimerEvent *timerEvent)
+void Connection::rejectName()
 {
-    if (timerEvent->timerId() == m_d->m_transferTimerId) {
-        abort();
-        killTimer(m_d->m_transferTimerId);
-        m_d->m_transferTimerId = 0;
-    }
+    m_d->send(Protocol::controlFrame(Protocol::NameError, m_d->m_framing));
+    m_d->countOut(Protocol::NameError);
+    m_d->flush();
+    disconnectFromHost();
 }
 
-void Connection::processReadyRead()
+void Connection::setTimingWheel(TimingWheel *wheel)
 {
-    if (m_d->m_state == WaitingForGreeting) {
-        if (!m_d->readProtocolHeader()) {
-            return;
-        }
-        if (m_d->m_currentDataType != Greeting) {
-            abort();
-            return;
-        }
-        m_d->m_state = ReadingGreeting;
+    m_d->m_wheel = wheel;
+    m_d->touch();
+    m_d->m_lastPingSent = m_d->m_lastReceived;
+    wheel->schedule(this);
+}
+
+void Connection::setMetrics(Metrics *metrics)
+{
+    // состояние соединения переносится в счётчики нового потока
+    if (m_d->m_metrics) {
+        m_d->m_metrics->stateChanged(m_d->m_state, -1);
+    }
+    m_d->m_metrics = metrics;
+    if (m_d->m_metrics) {
+        m_d->m_metrics->stateChanged(-1, m_d->m_state);
     }
+}
 
-    if (m_d->m_state == ReadingGreeting) {
-        if (!m_d->hasEnoughData()) {
-            return;
-        }
+void Connection::setWriteCoalescer(WriteCoalescer *coalescer)
+{
+    m_d->m_coalescer = coalescer;
+}
 
-        m_d->m_buffer = read(m_d->m_numBytesForCurrentDataType);
-        if (m_d->m_buffer.size() != m_d->m_numBytesForCurrentDataType) {
-            abort();
-            return;
-        }
+void Connection::setWriteCoalescing(int windowMs, int maxBytes)
+{
+    m_d->m_coalesceWindow = qMax(windowMs, 0) * 1000;
+    m_d->m_coalesceBytes = maxBytes;
+}
 
-        m_d->m_username = QString(m_d->m_buffer);
-        m_d->m_userIp = peerAddress().toString();
-        m_d->m_userPort = peerPort();
-        emit changeConnectionName(m_d->m_username);
-        m_d->m_currentDataType = Undefined;
-        m_d->m_numBytesForCurrentDataType = 0;
-        m_d->m_buffer.clear();
+void Connection::setCompressionThreshold(int bytes)
+{
+    m_d->m_compressThreshold = bytes;
+}
 
-        if (!isValid()) {
-            abort();
-            return;
-        }
+void Connection::flushPending()
+{
+    m_d->m_flushScheduled = false;
+    m_d->flush();
+}
 
-        m_d->m_pingTimer->start();
-        m_d->m_pongTime.start();
-        m_d->m_state = ReadyForUse;
-    }
+void Connection::setIdleOnlyPing(bool idleOnly)
+{
+    m_d->m_idleOnlyPing = idleOnly;
+}
 
-    do {
-        if (m_d->m_currentDataType == Undefined) {
-            if (!m_d->readProtocolHeader()) {
-                return;
-            }
-        }
-        if (!m_d->hasEnoughData()) {
-            return;
-        }
-        m_d->processData();
-    } while (bytesAvailable() > 0);
+void Connection::setOutboundPolicy(SlowConsumerPolicy policy, qint64 highWatermark, qint64 lowWatermark)
+{
+    m_d->m_policy = policy;
+    m_d->m_highWatermark = highWatermark;
+    m_d->m_lowWatermark = qMin(lowWatermark, highWatermark);
+}
+
+qint64 Connection::queuedBytes() const
+{
+    return bytesToWrite() + m_d->m_pending.size();
+}
+
+quint64 Connection::droppedFrames() const
+{
+    return m_d->m_droppedFrames;
+}
+
+qint64 Connection::nextDeadline() const
+{
+    qint64 deadline = -1;
+    if (m_d->m_decoder.hasPendingData()) {
+        deadline = m_d->m_lastReceived + TransferTimeout;
+    }
+    if (m_d->m_state == ReadyForUse) {
+        const qint64 due = qMin(m_d->pingDue(), m_d->m_lastReceived + PongTimeout);
+        deadline = (deadline < 0) ? due : qMin(deadline, due);
+    }
+    return deadline;
 }
 
-void Connection::sendPing()
+void Connection::expire(qint64 now)
 {
-    if (m_d->m_pongTime.elapsed() > PongTimeout) {
+    if (state() != QAbstractSocket::ConnectedState) {
+        return;
+    }
+
+    if ( m_d->m_decoder.hasPendingData() && (now >= m_d->m_lastReceived + TransferTimeout) ) {
+        abort();
+        return;
+    }
+    if (m_d->m_state != ReadyForUse) {
+        return;
+    }
+    if (now >= m_d->m_lastReceived + PongTimeout) {
         abort();
         return;
     }
+    if (now >= m_d->pingDue()) {
+        m_d->send(Protocol::controlFrame(Protocol::Ping, m_d->m_framing));
+        m_d->countOut(Protocol::Ping);
+        m_d->m_lastPingSent = now;
+    }
+}
+
+void Connection::processReadyRead()
+{
+    const qint64 received = m_d->m_decoder.readFrom(this);
+    if (received <= 0) {
+        return;
+    }
+    if (m_d->m_metrics) {
+        m_d->m_metrics->bytesIn(received);
+    }
+    m_d->touch();
+
+    FrameDecoder::Frame frame;
+    forever {
+        const FrameDecoder::Status status = m_d->m_decoder.next(&frame);
+        if (status == FrameDecoder::NeedMoreData) {
+            break;
+        }
+        if (status == FrameDecoder::Malformed) {
+            abort();
+            return;
+        }
+        if (!m_d->processFrame(frame)) {
+            return;
+        }
+    }
 
-    write("PING 1 p");
+    if ( (m_d->m_state == WaitingForGreeting) && m_d->m_decoder.hasPendingData() ) {
+        m_d->setState(ReadingGreeting);
+    }
+    if (m_d->m_wheel) {
+        // обычно срок уже стоит раньше и вызов ничего не меняет
+        m_d->m_wheel->schedule(this);
+    }
 }
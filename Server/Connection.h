@@ -2,11 +2,18 @@
 
 #include <QTcpSocket>
 
+#include "Protocol.h"
+#include "TimingWheel.h"
+
+class EncodedFrame;
+class Metrics;
+class WriteCoalescer;
+
 //-----------------------------------------------------------------------//
 //  Connection                                                           //
 //-----------------------------------------------------------------------//
 
-class Connection : public QTcpSocket {
+class Connection : public QTcpSocket, public TimingWheel::Client {
     Q_OBJECT
 public:
     enum ConnectionState {
@@ -14,27 +21,41 @@ public:
         ReadingGreeting,
         ReadyForUse
     };
-    enum DataType {
-        PlainText,
-        Ping,
-        Pong,
-        Greeting,
-        Undefined
+    enum SlowConsumerPolicy {
+        DisconnectSlowConsumer, /*!< Отстающий клиент отключается */
+        DropNonEssential, /*!< Пропускаются JOIN/LEAVE/PARTICIPANTS/PRESENCE */
+        CollapseMissed /*!< Пропускается всё, потом приходит "пропущено N сообщений" */
     };
 public:
     explicit Connection(qintptr socketDescriptor, QObject *parent = nullptr);
     ~Connection();
+public:
+    void sendFrame(Protocol::DataType type, const QByteArray& payload);
+    void writeFrame(const EncodedFrame& frame);
+    void rejectName();
+    void setTimingWheel(TimingWheel* wheel);
+    void setMetrics(Metrics* metrics);
+    void setWriteCoalescer(WriteCoalescer* coalescer);
+    void setWriteCoalescing(int windowMs, int maxBytes);
+    void setCompressionThreshold(int bytes);
+    void flushPending();
+    void setIdleOnlyPing(bool idleOnly);
+    void setOutboundPolicy(SlowConsumerPolicy policy, qint64 highWatermark, qint64 lowWatermark);
+    qint64 queuedBytes() const;
+    quint64 droppedFrames() const;
+public:
+    // TimingWheel::Client interface
+    qint64 nextDeadline() const override;
+    void expire(qint64 now) override;
 signals:
     void changeConnectionName(const QString& name);
+    void capabilitiesNegotiated(quint32 capabilities);
+    void presenceSyncRequested();
+    void historyPageRequested(quint64 before, int limit);
+    void roomRequested(const QString& room);
     void writeMessage(const QByteArray& text);
-public slots:
-    void onWrite(const QByteArray& text);
-    void onNameError(Connection* conn);
-protected:
-    void timerEvent(QTimerEvent *timerEvent) override;
 private slots:
     void processReadyRead();
-    void sendPing();
 private:
     class Pimpl;
     Pimpl* m_d;
@@ -0,0 +1,128 @@
+#include "FanOutBench.h"
+#include "BroadcastHub.h"
+#include "Worker.h"
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QVector>
+
+#include <cstdio>
+#include <functional>
+
+static const qint64 MinCaseTime = 200 * 1000 * 1000;
+static const int RecipientCounts[] = { 1000, 10000, 50000 };
+static const int MessageSize = 256;
+
+//-----------------------------------------------------------------------//
+//  FanOutBench::Pimpl                                                   //
+//-----------------------------------------------------------------------//
+
+class FanOutBench::Pimpl {
+public:
+    void bench(const QString& name, int recipients, const std::function<void()>& op);
+    void drain();
+public:
+    QVector<Worker*> m_workers;
+    QString m_filter;
+    int m_cases = 0;
+    QAtomicInteger<qint64> m_sink;
+};
+
+void FanOutBench::Pimpl::bench(const QString &name, int recipients, const std::function<void()> &op)
+{
+    if (!m_filter.isEmpty() && !name.contains(m_filter)) {
+        return;
+    }
+
+    // каждый повтор ждёт, пока воркеры разберут всё отправленное
+    op();
+    drain();
+    qint64 iterations = 1;
+    qint64 elapsed = 0;
+    QElapsedTimer timer;
+    forever {
+        timer.start();
+        for (qint64 i = 0; i < iterations; ++i) {
+            op();
+            drain();
+        }
+        elapsed = timer.nsecsElapsed();
+        if (elapsed >= MinCaseTime) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    const double perMessage = static_cast<double>(elapsed) / iterations;
+    std::printf("%-36s %12.1f us/message %10.1f ns/recipient %10lld iterations\n", qPrintable(name),
+                perMessage / 1000, perMessage / recipients, static_cast<long long>(iterations));
+    std::fflush(stdout);
+    ++m_cases;
+}
+
+void FanOutBench::Pimpl::drain()
+{
+    // очередь воркера упорядочена: пустой вызов вернётся после всех прежних
+    for (Worker* worker : m_workers) {
+        QMetaObject::invokeMethod(worker, [](){}, Qt::BlockingQueuedConnection);
+    }
+}
+
+//-----------------------------------------------------------------------//
+//  FanOutBench                                                          //
+//-----------------------------------------------------------------------//
+
+FanOutBench::FanOutBench(int workerCount)
+{
+    m_d = new Pimpl;
+    if (workerCount <= 0) {
+        workerCount = qMax(QThread::idealThreadCount(), 1);
+    }
+    for (int i = 0; i < workerCount; ++i) {
+        Worker* worker = new Worker(i);
+        worker->start();
+        m_d->m_workers.append(worker);
+    }
+}
+
+FanOutBench::~FanOutBench()
+{
+    qDeleteAll(m_d->m_workers);
+    delete m_d;
+}
+
+void FanOutBench::setFilter(const QString &filter)
+{
+    m_d->m_filter = filter;
+}
+
+int FanOutBench::run()
+{
+    m_d->m_cases = 0;
+    const QByteArray payload(MessageSize, 'x');
+    const int workerCount = m_d->m_workers.size();
+
+    for (int recipients : RecipientCounts) {
+        BroadcastHub hub(m_d->m_workers);
+        for (int i = 0; i < recipients; ++i) {
+            hub.addTarget(m_d->m_workers.at(i % workerCount), static_cast<quint64>(i + 1));
+        }
+        m_d->bench(QStringLiteral("fanout/hub/%1").arg(recipients), recipients, [&](){
+            hub.broadcast(Protocol::PlainText, payload);
+        });
+
+        // как до BroadcastHub: сигнал writeMessage ставил в очередь потока
+        // каждого соединения отдельное событие с готовым кадром
+        Pimpl* d = m_d;
+        m_d->bench(QStringLiteral("fanout/per-connection/%1").arg(recipients), recipients, [&](){
+            const QByteArray frame = Protocol::encodeFrame(Protocol::PlainText, payload, Protocol::TextFraming);
+            for (int i = 0; i < recipients; ++i) {
+                QMetaObject::invokeMethod(d->m_workers.at(i % workerCount), [d, frame](){
+                    d->m_sink.fetchAndAddRelaxed(frame.size());
+                }, Qt::QueuedConnection);
+            }
+        });
+    }
+    return (m_d->m_cases > 0) ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <QString>
+
+//-----------------------------------------------------------------------//
+//  FanOutBench                                                          //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Задержка рассылки одного сообщения на 1k, 10k и 50k получателей: через
+ * BroadcastHub (кодирование один раз, пачка на воркер) и прежним способом,
+ * событием на каждое соединение. Получатели — id без сокетов, поэтому замер
+ * до того момента, как все воркеры разобрали свои очереди, без записи в сокет.
+ */
+class FanOutBench {
+public:
+    explicit FanOutBench(int workerCount);
+    ~FanOutBench();
+public:
+    void setFilter(const QString& filter);
+    int run();
+private:
+    class Pimpl;
+    Pimpl* m_d;
+};
@@ -0,0 +1,152 @@
+#include "HistoryRing.h"
+
+//-----------------------------------------------------------------------//
+//  HistoryRing                                                          //
+//-----------------------------------------------------------------------//
+
+HistoryRing::HistoryRing(int capacity)
+{
+    setCapacity(capacity);
+}
+
+int HistoryRing::capacity() const
+{
+    return m_entries.size();
+}
+
+void HistoryRing::setCapacity(int capacity)
+{
+    capacity = qMax(capacity, 1);
+    if (capacity == m_entries.size()) {
+        return;
+    }
+
+    // самые новые записи переезжают в начало нового кольца
+    QVector<Entry> entries(capacity);
+    const int kept = qMin(m_size, capacity);
+    for (int i = 0; i < kept; ++i) {
+        entries[i] = at(m_size - kept + i);
+    }
+    m_entries = entries;
+    m_head = 0;
+    m_size = kept;
+    m_snapshotValid = false;
+    m_cborSnapshotValid = false;
+}
+
+int HistoryRing::size() const
+{
+    return m_size;
+}
+
+bool HistoryRing::isEmpty() const
+{
+    return m_size == 0;
+}
+
+quint64 HistoryRing::firstSequence() const
+{
+    return m_size ? at(0).sequence : 0;
+}
+
+void HistoryRing::append(quint64 sequence, const QByteArray &payload, const QByteArray &cbor)
+{
+    const int tail = (m_head + m_size) % m_entries.size();
+    m_entries[tail].sequence = sequence;
+    m_entries[tail].payload = payload;
+    m_entries[tail].cbor = cbor;
+    if (m_size < m_entries.size()) {
+        ++m_size;
+    }
+    else {
+        m_head = (m_head + 1) % m_entries.size();
+    }
+    m_snapshotValid = false;
+    m_cborSnapshotValid = false;
+}
+
+void HistoryRing::clear()
+{
+    for (Entry& entry : m_entries) {
+        entry = Entry();
+    }
+    m_head = 0;
+    m_size = 0;
+    m_snapshotValid = false;
+    m_cborSnapshotValid = false;
+}
+
+QVector<HistoryRing::Entry> HistoryRing::readBefore(quint64 before, int limit) const
+{
+    // номера в кольце возрастают, конец ищется двоичным поиском
+    int low = 0;
+    int high = m_size;
+    while (low < high) {
+        const int middle = (low + high) / 2;
+        if (at(middle).sequence < before) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    QVector<Entry> entries;
+    const int first = qMax(low - qMax(limit, 0), 0);
+    entries.reserve(low - first);
+    for (int i = first; i < low; ++i) {
+        entries.append(at(i));
+    }
+    return entries;
+}
+
+const QByteArray &HistoryRing::snapshot() const
+{
+    if (!m_snapshotValid) {
+        int length = 2;
+        for (int i = 0; i < m_size; ++i) {
+            length += at(i).payload.size() + 1;
+        }
+
+        m_snapshot.clear();
+        m_snapshot.reserve(length);
+        m_snapshot.append('[');
+        for (int i = 0; i < m_size; ++i) {
+            if (i) {
+                m_snapshot.append(',');
+            }
+            m_snapshot.append(at(i).payload);
+        }
+        m_snapshot.append(']');
+        // новые подключения до согласования возможностей говорят текстом
+        m_snapshotFrame = m_size ? Protocol::encodeFrame(Protocol::History, m_snapshot, Protocol::TextFraming)
+                                 : QByteArray();
+        m_snapshotValid = true;
+    }
+    return m_snapshot;
+}
+
+const QByteArray &HistoryRing::snapshotFrame() const
+{
+    snapshot();
+    return m_snapshotFrame;
+}
+
+const QByteArray &HistoryRing::cborSnapshot() const
+{
+    if (!m_cborSnapshotValid) {
+        QVector<QByteArray> items;
+        items.reserve(m_size);
+        for (int i = 0; i < m_size; ++i) {
+            items.append(at(i).cbor);
+        }
+        m_cborSnapshot = CborPayload::encodeArray(items);
+        m_cborSnapshotValid = true;
+    }
+    return m_cborSnapshot;
+}
+
+const HistoryRing::Entry &HistoryRing::at(int i) const
+{
+    return m_entries.at((m_head + i) % m_entries.size());
+}
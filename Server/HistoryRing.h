@@ -0,0 +1,51 @@
+#pragma once
+
+#include "CborPayload.h"
+#include "Protocol.h"
+
+#include <QByteArray>
+#include <QVector>
+
+//-----------------------------------------------------------------------//
+//  HistoryRing                                                          //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Последние capacity() сообщений в уже закодированном виде. Снимок истории
+ * для нового подключения собирается склейкой и кэшируется до следующего
+ * изменения кольца, так что поток подключений его не перекодирует.
+ * Рядом с JSON хранится CBOR-вариант записи для клиентов с "cbor".
+ */
+class HistoryRing {
+public:
+    struct Entry {
+        quint64 sequence = 0;
+        QByteArray payload;
+        QByteArray cbor;
+    };
+public:
+    explicit HistoryRing(int capacity = 100);
+public:
+    int capacity() const;
+    void setCapacity(int capacity);
+    int size() const;
+    bool isEmpty() const;
+    quint64 firstSequence() const;
+    void append(quint64 sequence, const QByteArray& payload, const QByteArray& cbor = QByteArray());
+    void clear();
+    QVector<Entry> readBefore(quint64 before, int limit) const;
+    const QByteArray& snapshot() const;
+    const QByteArray& snapshotFrame() const;
+    const QByteArray& cborSnapshot() const;
+private:
+    const Entry& at(int i) const;
+private:
+    QVector<Entry> m_entries;
+    int m_head = 0;
+    int m_size = 0;
+    mutable QByteArray m_snapshot;
+    mutable QByteArray m_snapshotFrame;
+    mutable QByteArray m_cborSnapshot;
+    mutable bool m_snapshotValid = false;
+    mutable bool m_cborSnapshotValid = false;
+};
@@ -0,0 +1,573 @@
+#include "MessageLog.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTimer>
+#include <QtEndian>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const qint64 SegmentSize = 16 * 1024 * 1024;
+static const qint64 IndexInterval = 4 * 1024;
+static const int SyncInterval = 200;
+// запись: [u32 длина payload][u64 номер][payload], little endian
+static const int RecordHeaderSize = 12;
+// запись индекса: [u64 номер][u64 смещение]
+static const int IndexEntrySize = 16;
+
+//-----------------------------------------------------------------------//
+//  MessageLog::Pimpl                                                    //
+//-----------------------------------------------------------------------//
+
+class MessageLog::Pimpl {
+public:
+    struct IndexEntry {
+        quint64 sequence = 0;
+        qint64 offset = 0;
+    };
+    struct Segment {
+        quint64 baseSequence = 0;
+        quint64 lastSequence = 0;
+        qint64 size = 0;
+        qint64 lastIndexedOffset = -1;
+        QString path;
+        QString indexPath;
+        QVector<IndexEntry> index;
+        QFile* mapFile = nullptr;
+        uchar* map = nullptr;
+        qint64 mappedSize = 0;
+    };
+public:
+    Pimpl(MessageLog* parent);
+public:
+    bool loadSegment(Segment& segment, bool isLast);
+    bool openActive();
+    void closeActive();
+    bool roll(quint64 baseSequence);
+    bool discardTail();
+    void applyRetention();
+    void removeOldest();
+    const uchar* mapped(Segment& segment);
+    void unmap(Segment& segment);
+    int segmentFor(quint64 sequence) const;
+    qint64 indexLookup(const Segment& segment, quint64 sequence) const;
+    void readRange(quint64 start, quint64 end, QVector<Record>* records);
+    static bool readRecord(const uchar* data, qint64 size, qint64 offset, quint64* sequence, qint64* length);
+    static QString segmentName(quint64 baseSequence, const QString& suffix);
+    static void fsyncFile(QFile& file);
+public:
+    QDir m_directory;
+    QVector<Segment> m_segments;
+    QFile m_logFile;
+    QFile m_indexFile;
+    QTimer* m_syncTimer = nullptr;
+    quint64 m_nextSequence = 1;
+    qint64 m_maxBytes = 0;
+    qint64 m_maxAge = 0;
+    bool m_isOpen = false;
+    bool m_dirty = false;
+    MessageLog* m_parent = nullptr;
+};
+
+MessageLog::Pimpl::Pimpl(MessageLog *parent) :
+    m_parent(parent)
+{
+}
+
+bool MessageLog::Pimpl::loadSegment(Segment &segment, bool isLast)
+{
+    QFile indexFile(segment.indexPath);
+    if (indexFile.open(QIODevice::ReadOnly)) {
+        const QByteArray data = indexFile.readAll();
+        const int count = data.size() / IndexEntrySize;
+        segment.index.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            const char* entry = data.constData() + i * IndexEntrySize;
+            IndexEntry indexEntry;
+            indexEntry.sequence = qFromLittleEndian<quint64>(entry);
+            indexEntry.offset = static_cast<qint64>(qFromLittleEndian<quint64>(entry + 8));
+            segment.index.append(indexEntry);
+        }
+    }
+
+    segment.size = QFileInfo(segment.path).size();
+    segment.lastSequence = segment.baseSequence - 1;
+    if (!isLast) {
+        return true;
+    }
+
+    // хвост последнего сегмента мог не дописаться: разбираем его от последней
+    // записи индекса и отрезаем оборванную запись
+    while (!segment.index.isEmpty() && (segment.index.last().offset >= segment.size)) {
+        segment.index.removeLast();
+    }
+    const uchar* data = mapped(segment);
+    if (!data && (segment.size > 0)) {
+        return false;
+    }
+    qint64 offset = 0;
+    if (!segment.index.isEmpty()) {
+        offset = segment.index.last().offset;
+        segment.lastSequence = segment.index.last().sequence - 1;
+    }
+    quint64 sequence = 0;
+    qint64 length = 0;
+    bool found = false;
+    while (data && readRecord(data, segment.size, offset, &sequence, &length)) {
+        segment.lastSequence = sequence;
+        offset += RecordHeaderSize + length;
+        found = true;
+    }
+    if (!found && (offset > 0)) {
+        // оборвана сама запись под последним элементом индекса: номер
+        // последней целой записи узнаём, перечитав сегмент с начала
+        offset = 0;
+        segment.lastSequence = segment.baseSequence - 1;
+        while (readRecord(data, segment.size, offset, &sequence, &length)) {
+            segment.lastSequence = sequence;
+            offset += RecordHeaderSize + length;
+        }
+    }
+
+    if (offset != segment.size) {
+        unmap(segment);
+        QFile file(segment.path);
+        if (!file.resize(offset)) {
+            return false;
+        }
+        segment.size = offset;
+        while (!segment.index.isEmpty() && (segment.index.last().offset >= segment.size)) {
+            segment.index.removeLast();
+        }
+        // индекс переписывается, чтобы не ссылаться за конец сегмента
+        QFile rewritten(segment.indexPath);
+        if (rewritten.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            for (const IndexEntry& entry : segment.index) {
+                char raw[IndexEntrySize];
+                qToLittleEndian<quint64>(entry.sequence, raw);
+                qToLittleEndian<quint64>(static_cast<quint64>(entry.offset), raw + 8);
+                rewritten.write(raw, IndexEntrySize);
+            }
+        }
+    }
+    if (!segment.index.isEmpty()) {
+        segment.lastIndexedOffset = segment.index.last().offset;
+    }
+    return true;
+}
+
+bool MessageLog::Pimpl::openActive()
+{
+    Segment& active = m_segments.last();
+    m_logFile.setFileName(active.path);
+    m_indexFile.setFileName(active.indexPath);
+    return m_logFile.open(QIODevice::WriteOnly | QIODevice::Append) &&
+           m_indexFile.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+void MessageLog::Pimpl::closeActive()
+{
+    if (m_logFile.isOpen()) {
+        m_logFile.flush();
+        fsyncFile(m_logFile);
+        m_logFile.close();
+    }
+    if (m_indexFile.isOpen()) {
+        m_indexFile.flush();
+        fsyncFile(m_indexFile);
+        m_indexFile.close();
+    }
+    m_dirty = false;
+}
+
+bool MessageLog::Pimpl::roll(quint64 baseSequence)
+{
+    closeActive();
+
+    Segment segment;
+    segment.baseSequence = baseSequence;
+    segment.lastSequence = baseSequence - 1;
+    segment.path = m_directory.filePath(segmentName(baseSequence, QStringLiteral("log")));
+    segment.indexPath = m_directory.filePath(segmentName(baseSequence, QStringLiteral("index")));
+    m_segments.append(segment);
+    if (!openActive()) {
+        return false;
+    }
+
+    applyRetention();
+    return true;
+}
+
+bool MessageLog::Pimpl::discardTail()
+{
+    // close() сбрасывает буфер QFile, даже если дописать его не удалось
+    Segment& active = m_segments.last();
+    m_logFile.close();
+    unmap(active);
+    QFile file(active.path);
+    if (!file.resize(active.size)) {
+        return false;
+    }
+    return m_logFile.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+void MessageLog::Pimpl::applyRetention()
+{
+    if (m_maxBytes > 0) {
+        qint64 total = 0;
+        for (const Segment& segment : m_segments) {
+            total += segment.size;
+        }
+        while ( (m_segments.size() > 1) && (total > m_maxBytes) ) {
+            total -= m_segments.first().size;
+            removeOldest();
+        }
+    }
+
+    if (m_maxAge > 0) {
+        // сегмент старше срока целиком, если в него давно не писали
+        const QDateTime limit = QDateTime::currentDateTime().addSecs(-m_maxAge);
+        while ( (m_segments.size() > 1) && (QFileInfo(m_segments.first().path).lastModified() < limit) ) {
+            removeOldest();
+        }
+    }
+}
+
+void MessageLog::Pimpl::removeOldest()
+{
+    Segment segment = m_segments.takeFirst();
+    unmap(segment);
+    QFile::remove(segment.path);
+    QFile::remove(segment.indexPath);
+}
+
+const uchar *MessageLog::Pimpl::mapped(Segment &segment)
+{
+    if (segment.size <= 0) {
+        return nullptr;
+    }
+    if (segment.map && (segment.mappedSize >= segment.size)) {
+        return segment.map;
+    }
+
+    // сегмент вырос: отображение перестраивается под новый размер
+    unmap(segment);
+    segment.mapFile = new QFile(segment.path);
+    if (!segment.mapFile->open(QIODevice::ReadOnly)) {
+        unmap(segment);
+        return nullptr;
+    }
+    segment.map = segment.mapFile->map(0, segment.size);
+    segment.mappedSize = segment.map ? segment.size : 0;
+    return segment.map;
+}
+
+void MessageLog::Pimpl::unmap(Segment &segment)
+{
+    if (segment.mapFile) {
+        if (segment.map) {
+            segment.mapFile->unmap(segment.map);
+        }
+        delete segment.mapFile;
+    }
+    segment.mapFile = nullptr;
+    segment.map = nullptr;
+    segment.mappedSize = 0;
+}
+
+int MessageLog::Pimpl::segmentFor(quint64 sequence) const
+{
+    int low = 0;
+    int high = m_segments.size() - 1;
+    while (low < high) {
+        const int middle = (low + high + 1) / 2;
+        if (m_segments.at(middle).baseSequence <= sequence) {
+            low = middle;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+qint64 MessageLog::Pimpl::indexLookup(const Segment &segment, quint64 sequence) const
+{
+    // последняя запись индекса с номером не больше искомого
+    int low = 0;
+    int high = segment.index.size() - 1;
+    qint64 offset = 0;
+    while (low <= high) {
+        const int middle = (low + high) / 2;
+        if (segment.index.at(middle).sequence <= sequence) {
+            offset = segment.index.at(middle).offset;
+            low = middle + 1;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+    return offset;
+}
+
+void MessageLog::Pimpl::readRange(quint64 start, quint64 end, QVector<Record> *records)
+{
+    // записи с номерами из [start, end) по возрастанию
+    for (int i = segmentFor(start); i < m_segments.size(); ++i) {
+        Segment& segment = m_segments[i];
+        const uchar* data = mapped(segment);
+        if (!data) {
+            continue;
+        }
+        qint64 offset = indexLookup(segment, start);
+        quint64 sequence = 0;
+        qint64 length = 0;
+        while (readRecord(data, segment.size, offset, &sequence, &length)) {
+            if (sequence >= end) {
+                return;
+            }
+            if (sequence >= start) {
+                Record record;
+                record.sequence = sequence;
+                record.payload = QByteArray(reinterpret_cast<const char*>(data + offset + RecordHeaderSize),
+                                            static_cast<int>(length));
+                records->append(record);
+            }
+            offset += RecordHeaderSize + length;
+        }
+    }
+}
+
+bool MessageLog::Pimpl::readRecord(const uchar *data, qint64 size, qint64 offset, quint64 *sequence, qint64 *length)
+{
+    if (offset + RecordHeaderSize > size) {
+        return false;
+    }
+    *length = qFromLittleEndian<quint32>(data + offset);
+    *sequence = qFromLittleEndian<quint64>(data + offset + 4);
+    return offset + RecordHeaderSize + *length <= size;
+}
+
+QString MessageLog::Pimpl::segmentName(quint64 baseSequence, const QString &suffix)
+{
+    return QStringLiteral("%1.%2").arg(baseSequence, 20, 10, QLatin1Char('0')).arg(suffix);
+}
+
+void MessageLog::Pimpl::fsyncFile(QFile &file)
+{
+#ifdef Q_OS_WIN
+    _commit(file.handle());
+#else
+    ::fsync(file.handle());
+#endif
+}
+
+//-----------------------------------------------------------------------//
+//  MessageLog                                                           //
+//-----------------------------------------------------------------------//
+
+MessageLog::MessageLog(QObject *parent) :
+    QObject(parent)
+{
+    m_d = new Pimpl(this);
+    m_d->m_syncTimer = new QTimer(this);
+    m_d->m_syncTimer->setSingleShot(true);
+    m_d->m_syncTimer->setInterval(SyncInterval);
+    connect(m_d->m_syncTimer, &QTimer::timeout,
+            this, &MessageLog::sync);
+}
+
+MessageLog::~MessageLog()
+{
+    close();
+    delete m_d;
+}
+
+bool MessageLog::open(const QString &directory)
+{
+    close();
+
+    m_d->m_directory = QDir(directory);
+    if (!m_d->m_directory.mkpath(QStringLiteral("."))) {
+        return false;
+    }
+
+    const QStringList names = m_d->m_directory.entryList(QStringList{ QStringLiteral("*.log") },
+                                                         QDir::Files, QDir::Name);
+    for (const QString& name : names) {
+        bool ok = false;
+        const quint64 baseSequence = QFileInfo(name).completeBaseName().toULongLong(&ok);
+        if (!ok) {
+            continue;
+        }
+        Pimpl::Segment segment;
+        segment.baseSequence = baseSequence;
+        segment.path = m_d->m_directory.filePath(name);
+        segment.indexPath = m_d->m_directory.filePath(Pimpl::segmentName(baseSequence, QStringLiteral("index")));
+        m_d->m_segments.append(segment);
+    }
+
+    for (int i = 0; i < m_d->m_segments.size(); ++i) {
+        const bool isLast = (i == m_d->m_segments.size() - 1);
+        if (!m_d->loadSegment(m_d->m_segments[i], isLast)) {
+            close();
+            return false;
+        }
+        if (!isLast) {
+            // номера растут: сегмент кончается перед началом следующего
+            m_d->m_segments[i].lastSequence = m_d->m_segments.at(i + 1).baseSequence - 1;
+        }
+    }
+
+    if (m_d->m_segments.isEmpty()) {
+        m_d->m_nextSequence = 1;
+        m_d->m_isOpen = m_d->roll(1);
+    }
+    else {
+        m_d->m_nextSequence = m_d->m_segments.last().lastSequence + 1;
+        m_d->m_isOpen = m_d->openActive();
+        m_d->applyRetention();
+    }
+    return m_d->m_isOpen;
+}
+
+void MessageLog::close()
+{
+    m_d->m_syncTimer->stop();
+    m_d->closeActive();
+    for (Pimpl::Segment& segment : m_d->m_segments) {
+        m_d->unmap(segment);
+    }
+    m_d->m_segments.clear();
+    m_d->m_isOpen = false;
+}
+
+bool MessageLog::isOpen() const
+{
+    return m_d->m_isOpen;
+}
+
+void MessageLog::setRetention(qint64 maxBytes, qint64 maxAgeSeconds)
+{
+    m_d->m_maxBytes = maxBytes;
+    m_d->m_maxAge = maxAgeSeconds;
+    if (m_d->m_isOpen) {
+        m_d->applyRetention();
+    }
+}
+
+quint64 MessageLog::firstSequence() const
+{
+    return m_d->m_segments.isEmpty() ? m_d->m_nextSequence : m_d->m_segments.first().baseSequence;
+}
+
+quint64 MessageLog::nextSequence() const
+{
+    return m_d->m_nextSequence;
+}
+
+qint64 MessageLog::size() const
+{
+    qint64 total = 0;
+    for (const Pimpl::Segment& segment : m_d->m_segments) {
+        total += segment.size;
+    }
+    return total;
+}
+
+bool MessageLog::append(quint64 sequence, const QByteArray &payload)
+{
+    if (!m_d->m_isOpen || (sequence < m_d->m_nextSequence)) {
+        return false;
+    }
+    if (m_d->m_segments.last().size >= SegmentSize) {
+        if (!m_d->roll(sequence)) {
+            m_d->m_isOpen = false;
+            return false;
+        }
+    }
+
+    Pimpl::Segment& active = m_d->m_segments.last();
+    char header[RecordHeaderSize];
+    qToLittleEndian<quint32>(static_cast<quint32>(payload.size()), header);
+    qToLittleEndian<quint64>(sequence, header + 4);
+    if ( (m_d->m_logFile.write(header, RecordHeaderSize) != RecordHeaderSize) ||
+         (m_d->m_logFile.write(payload) != payload.size()) ) {
+        // оборванная запись сдвинула бы все следующие смещения, отрезаем её;
+        // если и это не вышло — закрываемся, как при ошибке roll
+        if (!m_d->discardTail()) {
+            m_d->m_isOpen = false;
+        }
+        return false;
+    }
+
+    if ( (active.lastIndexedOffset < 0) || (active.size - active.lastIndexedOffset >= IndexInterval) ) {
+        Pimpl::IndexEntry entry;
+        entry.sequence = sequence;
+        entry.offset = active.size;
+        active.index.append(entry);
+        active.lastIndexedOffset = active.size;
+
+        char raw[IndexEntrySize];
+        qToLittleEndian<quint64>(entry.sequence, raw);
+        qToLittleEndian<quint64>(static_cast<quint64>(entry.offset), raw + 8);
+        m_d->m_indexFile.write(raw, IndexEntrySize);
+    }
+
+    active.size += RecordHeaderSize + payload.size();
+    active.lastSequence = sequence;
+    m_d->m_nextSequence = sequence + 1;
+    if (!m_d->m_dirty) {
+        m_d->m_dirty = true;
+        m_d->m_syncTimer->start();
+    }
+    return true;
+}
+
+QVector<MessageLog::Record> MessageLog::readBefore(quint64 before, int limit)
+{
+    QVector<Record> records;
+    if (!m_d->m_isOpen || (limit <= 0)) {
+        return records;
+    }
+
+    before = qMin(before, m_d->m_nextSequence);
+    const quint64 first = firstSequence();
+
+    // в отображение должно попасть то, что ещё лежит в буфере QFile
+    m_d->m_logFile.flush();
+
+    // после неудачной записи в номерах есть пропуски, поэтому страница
+    // набирается по числу записей: отступаем назад, пока их не хватает
+    quint64 end = before;
+    while ( (records.size() < limit) && (end > first) ) {
+        const quint64 missing = static_cast<quint64>(limit - records.size());
+        const quint64 start = (end - first > missing) ? end - missing : first;
+        QVector<Record> older;
+        m_d->readRange(start, end, &older);
+        records = older + records;
+        end = start;
+    }
+    return records;
+}
+
+void MessageLog::sync()
+{
+    m_d->m_syncTimer->stop();
+    if (m_d->m_dirty) {
+        m_d->m_logFile.flush();
+        m_d->m_indexFile.flush();
+        Pimpl::fsyncFile(m_d->m_logFile);
+        Pimpl::fsyncFile(m_d->m_indexFile);
+        m_d->m_dirty = false;
+    }
+    if (m_d->m_maxAge > 0) {
+        m_d->applyRetention();
+    }
+}
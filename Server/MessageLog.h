@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QObject>
+#include <QVector>
+
+//-----------------------------------------------------------------------//
+//  MessageLog                                                           //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Журнал сообщений на диске: только дозапись, файлы-сегменты по
+ * SegmentSize байт и разреженный индекс "номер → смещение" рядом с каждым.
+ * Чтение идёт через отображение сегментов в память, fsync выполняется
+ * пачками по таймеру. При открытии разбирается только хвост последнего
+ * сегмента после последней записи индекса.
+ */
+class MessageLog : public QObject {
+    Q_OBJECT
+public:
+    struct Record {
+        quint64 sequence = 0;
+        QByteArray payload;
+    };
+public:
+    explicit MessageLog(QObject *parent = nullptr);
+    ~MessageLog();
+public:
+    bool open(const QString& directory);
+    void close();
+    bool isOpen() const;
+    void setRetention(qint64 maxBytes, qint64 maxAgeSeconds);
+    quint64 firstSequence() const;
+    quint64 nextSequence() const;
+    qint64 size() const;
+    bool append(quint64 sequence, const QByteArray& payload);
+    QVector<Record> readBefore(quint64 before, int limit);
+    void sync();
+private:
+    class Pimpl;
+    Pimpl* m_d;
+};
@@ -0,0 +1,123 @@
+#include "Metrics.h"
+
+#include <QElapsedTimer>
+
+// верхние границы корзин задержки рассылки, мкс
+static const qint64 LatencyBounds[Metrics::LatencyBucketCount] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000
+};
+
+//-----------------------------------------------------------------------//
+//  Metrics                                                              //
+//-----------------------------------------------------------------------//
+
+Metrics::Metrics()
+{
+}
+
+void Metrics::frameIn(Protocol::DataType type)
+{
+    m_framesIn[type].fetchAndAddRelaxed(1);
+}
+
+void Metrics::frameOut(Protocol::DataType type)
+{
+    m_framesOut[type].fetchAndAddRelaxed(1);
+}
+
+void Metrics::bytesIn(qint64 bytes)
+{
+    m_bytesIn.fetchAndAddRelaxed(static_cast<quint64>(bytes));
+}
+
+void Metrics::bytesOut(qint64 bytes)
+{
+    m_bytesOut.fetchAndAddRelaxed(static_cast<quint64>(bytes));
+}
+
+void Metrics::socketWrite()
+{
+    m_socketWrites.fetchAndAddRelaxed(1);
+}
+
+void Metrics::stateChanged(int from, int to)
+{
+    // -1 означает "нет состояния": соединение появилось, ушло или переехало
+    if (from >= 0) {
+        m_connections[from].fetchAndAddRelaxed(-1);
+    }
+    if (to >= 0) {
+        m_connections[to].fetchAndAddRelaxed(1);
+    }
+}
+
+void Metrics::fanOut(qint64 usecs)
+{
+    int bucket = 0;
+    while ( (bucket < LatencyBucketCount) && (usecs > LatencyBounds[bucket]) ) {
+        ++bucket;
+    }
+    if (bucket < LatencyBucketCount) {
+        m_fanOutBuckets[bucket].fetchAndAddRelaxed(1);
+    }
+    m_fanOutCount.fetchAndAddRelaxed(1);
+    m_fanOutSum.fetchAndAddRelaxed(static_cast<quint64>(qMax<qint64>(usecs, 0)));
+}
+
+quint64 Metrics::framesIn(Protocol::DataType type) const
+{
+    return m_framesIn[type].load();
+}
+
+quint64 Metrics::framesOut(Protocol::DataType type) const
+{
+    return m_framesOut[type].load();
+}
+
+quint64 Metrics::bytesInTotal() const
+{
+    return m_bytesIn.load();
+}
+
+quint64 Metrics::bytesOutTotal() const
+{
+    return m_bytesOut.load();
+}
+
+quint64 Metrics::socketWrites() const
+{
+    return m_socketWrites.load();
+}
+
+qint64 Metrics::connections(int state) const
+{
+    return m_connections[state].load();
+}
+
+quint64 Metrics::fanOutBucket(int bucket) const
+{
+    return m_fanOutBuckets[bucket].load();
+}
+
+quint64 Metrics::fanOutCount() const
+{
+    return m_fanOutCount.load();
+}
+
+quint64 Metrics::fanOutSum() const
+{
+    return m_fanOutSum.load();
+}
+
+qint64 Metrics::latencyBound(int bucket)
+{
+    return LatencyBounds[bucket];
+}
+
+qint64 Metrics::timestamp()
+{
+    static QElapsedTimer clock;
+    static const bool started = (clock.start(), true);
+    Q_UNUSED(started);
+    return clock.nsecsElapsed() / 1000;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Protocol.h"
+
+#include <QAtomicInteger>
+
+//-----------------------------------------------------------------------//
+//  Metrics                                                              //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Счётчики одного потока: у основного потока и у каждого воркера свой
+ * экземпляр, MetricsServer при опросе складывает их. Запись — одна атомарная
+ * операция без барьеров и блокировок, в свой экземпляр почти всегда пишет
+ * один поток, поэтому кэш-линии между ядрами не гоняются.
+ */
+class Metrics {
+public:
+    enum {
+        DataTypeCount = Protocol::Undefined + 1,
+        StateCount = 3, /*!< Connection::ConnectionState */
+        LatencyBucketCount = 13 /*!< Без +Inf, его значение равно count */
+    };
+public:
+    Metrics();
+    Metrics(const Metrics&) = delete;
+    Metrics& operator =(const Metrics&) = delete;
+public:
+    void frameIn(Protocol::DataType type);
+    void frameOut(Protocol::DataType type);
+    void bytesIn(qint64 bytes);
+    void bytesOut(qint64 bytes);
+    void stateChanged(int from, int to);
+    void fanOut(qint64 usecs);
+    void socketWrite();
+public:
+    quint64 framesIn(Protocol::DataType type) const;
+    quint64 framesOut(Protocol::DataType type) const;
+    quint64 bytesInTotal() const;
+    quint64 bytesOutTotal() const;
+    quint64 socketWrites() const;
+    qint64 connections(int state) const;
+    quint64 fanOutBucket(int bucket) const;
+    quint64 fanOutCount() const;
+    quint64 fanOutSum() const;
+public:
+    static qint64 latencyBound(int bucket);
+    static qint64 timestamp();
+private:
+    QAtomicInteger<quint64> m_framesIn[DataTypeCount];
+    QAtomicInteger<quint64> m_framesOut[DataTypeCount];
+    QAtomicInteger<quint64> m_bytesIn;
+    QAtomicInteger<quint64> m_bytesOut;
+    QAtomicInteger<quint64> m_socketWrites;
+    QAtomicInteger<qint64> m_connections[StateCount];
+    QAtomicInteger<quint64> m_fanOutBuckets[LatencyBucketCount];
+    QAtomicInteger<quint64> m_fanOutCount;
+    QAtomicInteger<quint64> m_fanOutSum;
+};
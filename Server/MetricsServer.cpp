@@ -0,0 +1,238 @@
+#include "MetricsServer.h"
+#include "Metrics.h"
+#include "Server.h"
+#include "Worker.h"
+
+#include <QElapsedTimer>
+#include <QTcpSocket>
+#include <QTimer>
+
+static const int LagProbeInterval = 50;
+static const int MaxRequestSize = 8 * 1024;
+static const int RequestTimeout = 5 * 1000;
+
+//-----------------------------------------------------------------------//
+//  MetricsServer::Pimpl                                                 //
+//-----------------------------------------------------------------------//
+
+class MetricsServer::Pimpl {
+public:
+    Pimpl(Server* server, MetricsServer* parent);
+public:
+    void processRequest(QTcpSocket* socket);
+    static void header(QByteArray& out, const char* name, const char* type, const char* help);
+    static void sample(QByteArray& out, const char* name, const QByteArray& labels, double value);
+public:
+    Server* m_server = nullptr;
+    QTimer* m_lagTimer = nullptr;
+    QElapsedTimer m_lagClock;
+    int m_loopLag = 0;
+    MetricsServer* m_parent = nullptr;
+};
+
+MetricsServer::Pimpl::Pimpl(Server *server, MetricsServer *parent) :
+    m_server(server),
+    m_parent(parent)
+{
+}
+
+void MetricsServer::Pimpl::processRequest(QTcpSocket *socket)
+{
+    const QByteArray request = socket->peek(MaxRequestSize);
+    if (!request.contains("\r\n\r\n")) {
+        if (request.size() >= MaxRequestSize) {
+            socket->abort();
+        }
+        return;
+    }
+
+    // разбираем только строку запроса, заголовки не нужны
+    const QList<QByteArray> line = request.left(request.indexOf("\r\n")).split(' ');
+    QByteArray response;
+    if ( (line.size() >= 2) && (line.at(0) == "GET") &&
+         ((line.at(1) == "/metrics") || (line.at(1) == "/")) ) {
+        const QByteArray body = m_parent->render();
+        response = "HTTP/1.0 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                   "Connection: close\r\n\r\n" + body;
+    }
+    else {
+        response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    socket->readAll();
+    socket->write(response);
+    socket->disconnectFromHost();
+}
+
+void MetricsServer::Pimpl::header(QByteArray &out, const char *name, const char *type, const char *help)
+{
+    out.append("# HELP ").append(name).append(' ').append(help).append('\n');
+    out.append("# TYPE ").append(name).append(' ').append(type).append('\n');
+}
+
+void MetricsServer::Pimpl::sample(QByteArray &out, const char *name, const QByteArray &labels, double value)
+{
+    out.append(name);
+    if (!labels.isEmpty()) {
+        out.append('{').append(labels).append('}');
+    }
+    out.append(' ').append(QByteArray::number(value, 'g', 15)).append('\n');
+}
+
+//-----------------------------------------------------------------------//
+//  MetricsServer                                                        //
+//-----------------------------------------------------------------------//
+
+MetricsServer::MetricsServer(Server *server, QObject *parent) :
+    QTcpServer(parent)
+{
+    m_d = new Pimpl(server, this);
+
+    // основной поток без своего таймера: задержку считаем тут же
+    m_d->m_lagTimer = new QTimer(this);
+    m_d->m_lagTimer->setTimerType(Qt::PreciseTimer);
+    m_d->m_lagTimer->setInterval(LagProbeInterval);
+    connect(m_d->m_lagTimer, &QTimer::timeout,
+            this, [this](){
+        m_d->m_loopLag = static_cast<int>(qMax<qint64>(m_d->m_lagClock.restart() - LagProbeInterval, 0));
+    });
+    m_d->m_lagClock.start();
+    m_d->m_lagTimer->start();
+}
+
+MetricsServer::~MetricsServer()
+{
+    delete m_d;
+}
+
+QByteArray MetricsServer::render() const
+{
+    QVector<const Metrics*> shards{ &m_d->m_server->metrics() };
+    for (const Worker* worker : m_d->m_server->workers()) {
+        shards.append(&worker->metrics());
+    }
+
+    QByteArray out;
+    out.reserve(8 * 1024);
+
+    static const char* const StateNames[Metrics::StateCount] = {
+        "WaitingForGreeting", "ReadingGreeting", "ReadyForUse"
+    };
+    Pimpl::header(out, "chat_connections", "gauge", "Open client connections by protocol state.");
+    for (int state = 0; state < Metrics::StateCount; ++state) {
+        qint64 total = 0;
+        for (const Metrics* shard : shards) {
+            total += shard->connections(state);
+        }
+        Pimpl::sample(out, "chat_connections", QByteArray("state=\"") + StateNames[state] + '"', total);
+    }
+
+    Pimpl::header(out, "chat_frames_in_total", "counter", "Frames received from clients by type.");
+    for (int type = 0; type < Metrics::DataTypeCount; ++type) {
+        quint64 total = 0;
+        for (const Metrics* shard : shards) {
+            total += shard->framesIn(static_cast<Protocol::DataType>(type));
+        }
+        if (total) {
+            Pimpl::sample(out, "chat_frames_in_total",
+                          "type=\"" + Protocol::tagForDataType(static_cast<Protocol::DataType>(type)) + '"', total);
+        }
+    }
+    Pimpl::header(out, "chat_frames_out_total", "counter", "Frames queued to clients by type.");
+    for (int type = 0; type < Metrics::DataTypeCount; ++type) {
+        quint64 total = 0;
+        for (const Metrics* shard : shards) {
+            total += shard->framesOut(static_cast<Protocol::DataType>(type));
+        }
+        if (total) {
+            Pimpl::sample(out, "chat_frames_out_total",
+                          "type=\"" + Protocol::tagForDataType(static_cast<Protocol::DataType>(type)) + '"', total);
+        }
+    }
+
+    quint64 bytesIn = 0;
+    quint64 bytesOut = 0;
+    quint64 socketWrites = 0;
+    for (const Metrics* shard : shards) {
+        bytesIn += shard->bytesInTotal();
+        bytesOut += shard->bytesOutTotal();
+        socketWrites += shard->socketWrites();
+    }
+    Pimpl::header(out, "chat_bytes_in_total", "counter", "Bytes read from client sockets.");
+    Pimpl::sample(out, "chat_bytes_in_total", QByteArray(), bytesIn);
+    Pimpl::header(out, "chat_bytes_out_total", "counter", "Bytes written to client sockets.");
+    Pimpl::sample(out, "chat_bytes_out_total", QByteArray(), bytesOut);
+    Pimpl::header(out, "chat_socket_writes_total", "counter", "write() calls on client sockets, after coalescing.");
+    Pimpl::sample(out, "chat_socket_writes_total", QByteArray(), socketWrites);
+
+    Pimpl::header(out, "chat_fanout_latency_seconds", "histogram",
+                  "Time from encoding a frame to handing it to the sockets of one worker.");
+    quint64 cumulative = 0;
+    for (int bucket = 0; bucket < Metrics::LatencyBucketCount; ++bucket) {
+        for (const Metrics* shard : shards) {
+            cumulative += shard->fanOutBucket(bucket);
+        }
+        Pimpl::sample(out, "chat_fanout_latency_seconds_bucket",
+                      "le=\"" + QByteArray::number(Metrics::latencyBound(bucket) / 1e6, 'g', 6) + '"', cumulative);
+    }
+    quint64 count = 0;
+    quint64 sum = 0;
+    for (const Metrics* shard : shards) {
+        count += shard->fanOutCount();
+        sum += shard->fanOutSum();
+    }
+    Pimpl::sample(out, "chat_fanout_latency_seconds_bucket", "le=\"+Inf\"", count);
+    Pimpl::sample(out, "chat_fanout_latency_seconds_sum", QByteArray(), sum / 1e6);
+    Pimpl::sample(out, "chat_fanout_latency_seconds_count", QByteArray(), count);
+
+    Pimpl::header(out, "chat_history_messages", "gauge", "Messages held in the in-memory history rings of all rooms.");
+    Pimpl::sample(out, "chat_history_messages", QByteArray(), m_d->m_server->historySize());
+    Pimpl::header(out, "chat_log_bytes", "gauge", "Size of the on-disk message log.");
+    Pimpl::sample(out, "chat_log_bytes", QByteArray(), m_d->m_server->logSize());
+    Pimpl::header(out, "chat_rooms", "gauge", "Rooms with at least one member, including the lobby.");
+    Pimpl::sample(out, "chat_rooms", QByteArray(), m_d->m_server->roomCount());
+    Pimpl::header(out, "chat_cluster_nodes", "gauge", "Cluster nodes reachable from this one, including itself.");
+    Pimpl::sample(out, "chat_cluster_nodes", QByteArray(), m_d->m_server->clusterNodes());
+
+    Pimpl::header(out, "chat_outbound_queue_bytes", "gauge", "Bytes waiting in the outbound queues of a worker.");
+    for (const Worker* worker : m_d->m_server->workers()) {
+        Pimpl::sample(out, "chat_outbound_queue_bytes",
+                      "worker=\"" + QByteArray::number(worker->index()) + '"', worker->queuedBytes());
+    }
+    Pimpl::header(out, "chat_outbound_queue_max_bytes", "gauge", "Deepest single outbound queue of a worker.");
+    for (const Worker* worker : m_d->m_server->workers()) {
+        Pimpl::sample(out, "chat_outbound_queue_max_bytes",
+                      "worker=\"" + QByteArray::number(worker->index()) + '"', worker->maxQueuedBytes());
+    }
+    Pimpl::header(out, "chat_dropped_frames_total", "counter", "Frames dropped by the slow-consumer policy.");
+    for (const Worker* worker : m_d->m_server->workers()) {
+        Pimpl::sample(out, "chat_dropped_frames_total",
+                      "worker=\"" + QByteArray::number(worker->index()) + '"', worker->droppedFrames());
+    }
+
+    Pimpl::header(out, "chat_event_loop_lag_seconds", "gauge", "How late the last periodic timer of a thread fired.");
+    Pimpl::sample(out, "chat_event_loop_lag_seconds", "thread=\"main\"", m_d->m_loopLag / 1e3);
+    for (const Worker* worker : m_d->m_server->workers()) {
+        Pimpl::sample(out, "chat_event_loop_lag_seconds",
+                      "thread=\"worker" + QByteArray::number(worker->index()) + '"', worker->loopLag() / 1e3);
+    }
+    return out;
+}
+
+void MetricsServer::incomingConnection(qintptr socketDescriptor)
+{
+    QTcpSocket* socket = new QTcpSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        delete socket;
+        return;
+    }
+
+    connect(socket, &QTcpSocket::readyRead,
+            this, [this, socket](){
+        m_d->processRequest(socket);
+    });
+    connect(socket, &QTcpSocket::disconnected,
+            socket, &QTcpSocket::deleteLater);
+    QTimer::singleShot(RequestTimeout, socket, &QTcpSocket::abort);
+}
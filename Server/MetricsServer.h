@@ -0,0 +1,28 @@
+#pragma once
+
+#include <QTcpServer>
+
+class Server;
+
+//-----------------------------------------------------------------------//
+//  MetricsServer                                                        //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Отдельный порт, отдающий счётчики сервера в текстовом формате Prometheus
+ * на GET /metrics. Живёт в основном потоке и заодно замеряет задержку его
+ * цикла событий.
+ */
+class MetricsServer : public QTcpServer {
+    Q_OBJECT
+public:
+    explicit MetricsServer(Server* server, QObject *parent = nullptr);
+    ~MetricsServer();
+public:
+    QByteArray render() const;
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+private:
+    class Pimpl;
+    Pimpl* m_d;
+};
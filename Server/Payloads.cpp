@@ -0,0 +1,84 @@
+#include "Payloads.h"
+
+#include <QJsonDocument>
+
+//-----------------------------------------------------------------------//
+//  Payloads                                                             //
+//-----------------------------------------------------------------------//
+
+QJsonObject Payloads::participant(const CborPayload::Participant &participant)
+{
+    return QJsonObject{
+                { QLatin1String("id"), participant.id },
+                { QLatin1String("name"), participant.name },
+                { QLatin1String("ip"), participant.ip },
+                { QLatin1String("port"), participant.port }
+            };
+}
+
+QJsonArray Payloads::participantsArray(const QVector<CborPayload::Participant> &participants)
+{
+    QJsonArray array;
+    for (const CborPayload::Participant& participant : participants) {
+        array.append(Payloads::participant(participant));
+    }
+    return array;
+}
+
+QByteArray Payloads::participantsMessage(const QVector<CborPayload::Participant> &participants)
+{
+    QJsonDocument doc(participantsArray(participants));
+    return doc.toJson(QJsonDocument::Compact);
+}
+
+QJsonObject Payloads::textMessage(const CborPayload::Message &message, const QString &time)
+{
+    return QJsonObject{
+                {QLatin1String("name"), message.name},
+                {QLatin1String("ip"), message.ip},
+                {QLatin1String("port"), message.port},
+                {QLatin1String("message"), message.text},
+                {QLatin1String("time"), time},
+                {QLatin1String("ts"), message.timestamp},
+                {QLatin1String("seq"), message.sequence}
+            };
+}
+
+QByteArray Payloads::historyMessage(const QVector<QByteArray> &messages)
+{
+    // записи уже готовый JSON, массив склеивается без разбора
+    int length = 2;
+    for (const QByteArray& message : messages) {
+        length += message.size() + 1;
+    }
+
+    QByteArray result;
+    result.reserve(length);
+    result.append('[');
+    for (int i = 0; i < messages.size(); ++i) {
+        if (i) {
+            result.append(',');
+        }
+        result.append(messages.at(i));
+    }
+    result.append(']');
+    return result;
+}
+
+QByteArray Payloads::joinMessage(const CborPayload::Participant &participant)
+{
+    // id запоминается клиентом, дальше LEAVE ссылается только на него
+    QJsonDocument doc(Payloads::participant(participant));
+    return doc.toJson(QJsonDocument::Compact);
+}
+
+QByteArray Payloads::leaveMessage(const CborPayload::Participant &participant)
+{
+    QJsonObject message = QJsonObject{
+                            {QLatin1String("name"), participant.name},
+                            {QLatin1String("ip"), participant.ip},
+                            {QLatin1String("port"), participant.port}
+                          };
+    QJsonDocument doc(message);
+    return doc.toJson(QJsonDocument::Compact);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <QByteArray>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+
+#include "CborPayload.h"
+
+//-----------------------------------------------------------------------//
+//  Payloads                                                             //
+//-----------------------------------------------------------------------//
+
+/*!
+ * JSON-payload сервера для MESSAGE, PARTICIPANTS, HISTORY, JOIN и LEAVE.
+ * Собираются из тех же записей, что и CBOR-варианты, поэтому сервер и
+ * LoadGen --bench меряют одни и те же функции.
+ */
+namespace Payloads {
+
+QJsonObject participant(const CborPayload::Participant& participant);
+QJsonArray participantsArray(const QVector<CborPayload::Participant>& participants);
+QByteArray participantsMessage(const QVector<CborPayload::Participant>& participants);
+QJsonObject textMessage(const CborPayload::Message& message, const QString& time); /*!< time — строка старого формата */
+QByteArray historyMessage(const QVector<QByteArray>& messages); /*!< JSON-массив из уже собранных сообщений */
+QByteArray joinMessage(const CborPayload::Participant& participant);
+QByteArray leaveMessage(const CborPayload::Participant& participant);
+
+}
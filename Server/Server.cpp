@@ -3,12 +3,18 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QJsonValue>
-#include <QDateTime>
 
+#include "BroadcastHub.h"
+#include "CborPayload.h"
+#include "CoarseClock.h"
+#include "Cluster.h"
 #include "Connection.h"
+#include "HistoryRing.h"
+#include "MessageLog.h"
+#include "Metrics.h"
+#include "Payloads.h"
 #include "Server.h"
-
-static const int MaxHistorySize = 20;
+#include "Worker.h"
 
 //-----------------------------------------------------------------------//
 //  Server::Pimpl                                                        //
@@ -18,30 +24,107 @@ class Server::Pimpl {
 public:
     Pimpl(Server* parent);
 public:
-    struct ParticipantInfo {
-        bool operator ==(const ParticipantInfo& other){
-            return (address == other.address) && (port == other.port) &&
-                    (conn == other.conn) && (name == other.name);
-        }
+    struct Room;
+    /*!
+     * Всё, что сервер знает о подключении. Сигналы соединения ссылаются на
+     * сессию по id, поэтому запоздавший сигнал уже удалённой сессии просто
+     * не находит её в таблице. Старшие 32 бита id — номер узла кластера;
+     * у сессий других узлов нет соединения и воркера.
+     */
+    struct Session {
+        quint64 id = 0;
         QHostAddress address;
         int port = 0;
         Connection* conn = nullptr;
         QString name;
+        quint32 capabilities = Protocol::NoCapabilities;
+        Worker* worker = nullptr;
+        Room* room = nullptr;
+        int node() const { return static_cast<int>(id >> 32); }
+        bool isLocal() const { return conn != nullptr; }
+    };
+    /*!
+     * Комната: свои участники, история и подписчики. Рассылка в комнате
+     * обходит только её плотный массив подписчиков, поэтому стоимость
+     * сообщения зависит от размера комнаты, а не от числа подключений.
+     */
+    struct Room {
+        QString name;
+        QMap<QString, Session*> participants;
+        BroadcastHub* hub = nullptr;
+        HistoryRing history;
+        MessageLog* log = nullptr;
+        quint64 nextSequence = 1;
+        quint64 presenceVersion = 0;
+        int members = 0;
+        int presenceClients = 0;
+        int cborClients = 0; /*!< Пока 0, CBOR-вариант кадров не собирается */
     };
 public:
-    void removeConnection(Connection *connection);
-    void addConnection(const QHostAddress& address, int port, Connection* conn);
-    void addParticipant(const QString& name, Connection* conn);
-    QByteArray participantsMessage();
-    QByteArray textMessage(const QString& text, Connection* conn);
-    QByteArray joinMessage(Connection* conn);
-    QByteArray leaveMessage(Connection* conn);
-    QByteArray historyMessage();
+    Session* addSession(const QHostAddress& address, int port, Connection* conn);
+    void removeSession(quint64 id);
+    void addParticipant(const QString& name, Session* session);
+    void announce(Session* session);
+    void changeSessionName(const QString& name, Session* session);
+    void setCapabilities(quint32 capabilities, Session* session);
+    void joinRoom(const QString& name, Session* session);
+    void enterRoom(Room* room, Session* session);
+    void leaveRoom(Session* session);
+    Room* room(const QString& name);
+    void dropRoom(Room* room);
+    bool openRoomLog(Room* room);
+    void send(Session* session, const EncodedFrame& frame);
+    void broadcastPresence(Room* room, Protocol::DataType type, const Session* session);
+    void sendPresenceSnapshot(Session* session);
+    void sendHistoryPage(Session* session, quint64 before, int limit);
+    void loadHistory(Room* room);
+    EncodedFrame storeMessage(Room* room, const QJsonObject& message);
+    EncodedFrame withCbor(const QByteArray& cbor, const EncodedFrame& json);
+    void countClient(Room* room, const Session* session, int delta);
+    Worker* pickWorker();
+    QByteArray participantsMessage(const Room* room);
+    QByteArray presenceSnapshotMessage(const Room* room);
+    QByteArray presenceMessage(const Room* room, const Session* session);
+    QByteArray presenceRemoveMessage(const Room* room, const Session* session);
+    QByteArray roomMessage(const Room* room);
+    EncodedFrame textMessage(const QString& text, Session* session);
+    QByteArray sessionMessage(const Session* session);
+    static CborPayload::Participant participantRecord(const Session* session);
+    static QVector<CborPayload::Participant> participantRecords(const Room* room);
+    static CborPayload::Message messageRecord(const QJsonObject& message);
     bool nameIsOk(const QString& name);
 public:
-    QMultiMap<QString, ParticipantInfo> m_participants;
-    QHash<Connection*, ParticipantInfo> m_connections;
-    QJsonArray m_history;
+    void relaySession(const Session* session);
+    void relayMessage(const Room* room, const QJsonObject& message);
+    void applyRemoteSession(const QJsonObject& remote);
+    void deliverRemoteMessage(const QJsonObject& relayed);
+    void onNodeJoined(int node);
+    void onNodeLeft(int node);
+    void onNodeFrame(Protocol::DataType type, const QByteArray& payload);
+    QJsonObject nodeSession(const Session* session);
+public:
+    QHash<quint64, Session*> m_sessions;
+    QHash<QString, Session*> m_names;
+    quint32 m_nextSession = 1;
+    int m_nodeId = 0;
+    Cluster* m_cluster = nullptr;
+    QHash<QString, Room*> m_rooms;
+    Room* m_lobby = nullptr;
+    int m_historyCapacity = 100;
+    QString m_logDirectory;
+    qint64 m_logMaxBytes = 0;
+    qint64 m_logMaxAge = 0;
+    Metrics m_metrics;
+    CoarseClock m_clock;
+    QVector<Worker*> m_workers;
+    int m_nextWorker = 0;
+    bool m_idleOnlyPing = false;
+    Connection::SlowConsumerPolicy m_slowConsumerPolicy = Connection::CollapseMissed;
+    qint64 m_highWatermark = 1024 * 1024;
+    qint64 m_lowWatermark = 256 * 1024;
+    int m_coalesceWindow = 0;
+    int m_coalesceBytes = 16 * 1024;
+    int m_compressThreshold = 256;
     Server* m_parent = nullptr;
 };
 
@@ -50,189 +133,809 @@ Server::Pimpl::Pimpl(Server *parent) :
 {
 }
 
-void Server::Pimpl::removeConnection(Connection *connection)
+Server::Pimpl::Session *Server::Pimpl::addSession(const QHostAddress &address, int port, Connection *conn)
+{
+    Session* session = new Session;
+    session->id = (static_cast<quint64>(m_nodeId) << 32) | m_nextSession++;
+    session->address = address;
+    session->port = port;
+    session->conn = conn;
+    m_sessions.insert(session->id, session);
+    return session;
+}
+
+void Server::Pimpl::removeSession(quint64 id)
+{
+    Session* session = m_sessions.take(id);
+    if (!session) {
+        return;
+    }
+    leaveRoom(session);
+    if (!session->name.isEmpty()) {
+        // имя могло уже перейти к победившей сессии другого узла
+        if (m_names.value(session->name) == session) {
+            m_names.remove(session->name);
+        }
+        if (session->isLocal() && m_cluster) {
+            m_cluster->broadcast(Protocol::NodeDown, sessionMessage(session));
+        }
+    }
+    delete session;
+}
+
+void Server::Pimpl::addParticipant(const QString &name, Session *session)
+{
+    session->name = name;
+    m_names.insert(name, session);
+    announce(session);
+    relaySession(session);
+}
+
+void Server::Pimpl::announce(Session *session)
+{
+    Room* room = session->room;
+    room->participants.insert(session->name, session);
+    const CborPayload::Participant record = participantRecord(session);
+    EncodedFrame frame(Protocol::Join, Payloads::joinMessage(record));
+    if (room->cborClients > 0) {
+        frame = withCbor(CborPayload::encodeParticipant(record), frame);
+    }
+    room->hub->broadcast(frame);
+    broadcastPresence(session->room, Protocol::PresenceAdd, session);
+}
+
+void Server::Pimpl::changeSessionName(const QString &name, Session *session)
+{
+    if (nameIsOk(name)) {
+        addParticipant(name, session);
+    }
+    else {
+        session->worker->rejectName(session->id);
+    }
+}
+
+void Server::Pimpl::setCapabilities(quint32 capabilities, Session *session)
+{
+    countClient(session->room, session, -1);
+    session->capabilities = capabilities;
+    countClient(session->room, session, 1);
+    if (capabilities & Protocol::CapabilityPresence) {
+        sendPresenceSnapshot(session);
+    }
+}
+
+void Server::Pimpl::joinRoom(const QString &name, Session *session)
+{
+    if (!(session->capabilities & Protocol::CapabilityRooms)) {
+        return;
+    }
+
+    Room* target = room(name);
+    const bool moved = (session->room != target);
+    if (moved) {
+        leaveRoom(session);
+        enterRoom(target, session);
+    }
+
+    // подтверждение, затем состав и история новой комнаты
+    send(session, EncodedFrame(Protocol::JoinRoom, roomMessage(target)));
+    if (session->capabilities & Protocol::CapabilityPresence) {
+        sendPresenceSnapshot(session);
+    }
+    else if (session->capabilities & Protocol::CapabilityCbor) {
+        send(session, EncodedFrame(Protocol::Participants, CborPayload::encodeParticipants(participantRecords(target))));
+    }
+    else {
+        send(session, EncodedFrame(Protocol::Participants, participantsMessage(target)));
+    }
+    if (!target->history.isEmpty()) {
+        const bool cbor = session->capabilities & Protocol::CapabilityCbor;
+        send(session, EncodedFrame(Protocol::History, cbor ? target->history.cborSnapshot() : target->history.snapshot()));
+    }
+    if (moved && !session->name.isEmpty()) {
+        announce(session);
+        relaySession(session);
+    }
+}
+
+void Server::Pimpl::enterRoom(Room *room, Session *session)
+{
+    session->room = room;
+    if (!session->isLocal()) {
+        return;
+    }
+    ++room->members;
+    countClient(room, session, 1);
+    room->hub->addTarget(session->worker, session->id);
+}
+
+void Server::Pimpl::leaveRoom(Session *session)
+{
+    Room* room = session->room;
+    if (!room) {
+        return;
+    }
+
+    if (session->isLocal()) {
+        room->hub->removeTarget(session->id);
+        --room->members;
+        countClient(room, session, -1);
+    }
+    session->room = nullptr;
+    if (!session->name.isEmpty()) {
+        if (room->participants.value(session->name) == session) {
+            room->participants.remove(session->name);
+        }
+        EncodedFrame frame(Protocol::Leave, sessionMessage(session), Protocol::CapabilitySessions);
+        frame.setFallback(EncodedFrame(Protocol::Leave, Payloads::leaveMessage(participantRecord(session))));
+        if (room->cborClients > 0) {
+            CborPayload::Participant gone;
+            gone.id = static_cast<qint64>(session->id);
+            frame = withCbor(CborPayload::encodeParticipant(gone), frame);
+        }
+        room->hub->broadcast(frame);
+        broadcastPresence(room, Protocol::PresenceRemove, session);
+    }
+    // комнату держат и участники с других узлов
+    if ( (room->members == 0) && room->participants.isEmpty() && (room != m_lobby) ) {
+        dropRoom(room);
+    }
+}
+
+Server::Pimpl::Room *Server::Pimpl::room(const QString &name)
+{
+    if (name.isEmpty()) {
+        return m_lobby;
+    }
+    Room* room = m_rooms.value(name);
+    if (room) {
+        return room;
+    }
+
+    room = new Room;
+    room->name = name;
+    room->hub = new BroadcastHub(m_workers);
+    room->history.setCapacity(m_historyCapacity);
+    m_rooms.insert(name, room);
+    openRoomLog(room);
+    return room;
+}
+
+void Server::Pimpl::dropRoom(Room *room)
+{
+    // пустая комната не держит память, история остаётся в журнале
+    m_rooms.remove(room->name);
+    delete room->hub;
+    delete room->log;
+    delete room;
+}
+
+bool Server::Pimpl::openRoomLog(Room *room)
+{
+    if (m_logDirectory.isEmpty()) {
+        return false;
+    }
+
+    // у общей комнаты прежний каталог, остальные лежат рядом по hex имени
+    QString directory = m_logDirectory;
+    if (room != m_lobby) {
+        directory += QStringLiteral("/rooms/") + QString::fromLatin1(room->name.toUtf8().toHex());
+    }
+    if (!room->log) {
+        room->log = new MessageLog();
+    }
+    room->log->setRetention(m_logMaxBytes, m_logMaxAge);
+    if (!room->log->open(directory)) {
+        delete room->log;
+        room->log = nullptr;
+        return false;
+    }
+    loadHistory(room);
+    return true;
+}
+
+void Server::Pimpl::send(Session *session, const EncodedFrame &frame)
+{
+    // адресный кадр идёт прямо в поток сессии, мимо списков рассылки
+    if (session->isLocal()) {
+        session->worker->send(session->id, frame);
+    }
+}
+
+void Server::Pimpl::broadcastPresence(Room *room, Protocol::DataType type, const Session *session)
+{
+    ++room->presenceVersion;
+    EncodedFrame frame(type, presenceMessage(room, session), Protocol::CapabilityPresence);
+    // полный список строится только если остались клиенты без дельт
+    if (room->members > room->presenceClients) {
+        frame.setFallback(EncodedFrame(Protocol::Participants, participantsMessage(room)));
+    }
+    if (type == Protocol::PresenceRemove) {
+        EncodedFrame compact(type, presenceRemoveMessage(room, session),
+                             Protocol::CapabilityPresence | Protocol::CapabilitySessions);
+        compact.setFallback(frame);
+        room->hub->broadcast(compact);
+        return;
+    }
+    room->hub->broadcast(frame);
+}
+
+void Server::Pimpl::sendPresenceSnapshot(Session *session)
+{
+    if (!session->room) {
+        return;
+    }
+    if (session->capabilities & Protocol::CapabilityCbor) {
+        const QByteArray snapshot = CborPayload::encodeParticipants(participantRecords(session->room),
+                                                                     static_cast<qint64>(session->room->presenceVersion));
+        send(session, EncodedFrame(Protocol::Participants, snapshot, Protocol::CapabilityPresence));
+        return;
+    }
+    send(session, EncodedFrame(Protocol::Participants, presenceSnapshotMessage(session->room), Protocol::CapabilityPresence));
+}
+
+void Server::Pimpl::sendHistoryPage(Session *session, quint64 before, int limit)
 {
-    if (!m_connections.value(connection).name.isEmpty()) {
-        emit m_parent->writeMessage(leaveMessage(connection));
+    const Room* room = session->room;
+    if (!room) {
+        return;
+    }
+
+    // свежие страницы отдаются из кольца, за более старыми идём в журнал
+    const bool cbor = session->capabilities & Protocol::CapabilityCbor;
+    QVector<QByteArray> payloads;
+    const QVector<HistoryRing::Entry> entries = room->history.readBefore(before, limit);
+    if ( (entries.size() < limit) && room->log && room->log->isOpen() &&
+         (room->history.isEmpty() || (room->history.firstSequence() > room->log->firstSequence())) ) {
+        for (const MessageLog::Record& record : room->log->readBefore(before, limit)) {
+            // журнал хранит JSON, для CBOR старые записи перекодируются при чтении
+            payloads.append(cbor ? CborPayload::encodeMessage(messageRecord(QJsonDocument::fromJson(record.payload).object()))
+                                 : record.payload);
+        }
     }
-    ParticipantInfo info = m_connections.take(connection);
-    for (auto it = m_participants.begin(); it != m_participants.end(); ++it){
-        if (it.value() == info) {
-            m_participants.remove(it.key(), it.value());
-            break;
+    else {
+        for (const HistoryRing::Entry& entry : entries) {
+            payloads.append(cbor ? entry.cbor : entry.payload);
         }
     }
-    emit m_parent->writeMessage(participantsMessage());
+    const QByteArray page = cbor ? CborPayload::encodeArray(payloads) : Payloads::historyMessage(payloads);
+    send(session, EncodedFrame(Protocol::HistoryPage, page, Protocol::CapabilityHistoryPaging));
 }
 
-void Server::Pimpl::addConnection(const QHostAddress &address, int port, Connection *conn)
+void Server::Pimpl::loadHistory(Room *room)
 {
-    ParticipantInfo info;
-    info.address = address;
-    info.port = port;
-    info.conn = conn;
-    m_connections.insert(conn, info);
+    room->nextSequence = room->log->nextSequence();
+    room->history.clear();
+    for (const MessageLog::Record& record : room->log->readBefore(room->nextSequence, room->history.capacity())) {
+        const QJsonObject message = QJsonDocument::fromJson(record.payload).object();
+        room->history.append(record.sequence, record.payload, CborPayload::encodeMessage(messageRecord(message)));
+    }
 }
 
-void Server::Pimpl::addParticipant(const QString &name, Connection *conn)
+EncodedFrame Server::Pimpl::storeMessage(Room *room, const QJsonObject &message)
 {
-    m_connections[conn].name = name;
-    m_connections[conn].address = conn->peerAddress();
-    m_connections[conn].port = conn->peerPort();
-    m_participants.insert(name, m_connections.value(conn));
-    emit m_parent->writeMessage(joinMessage(conn));
-    emit m_parent->writeMessage(participantsMessage());
+    // CBOR-запись кладётся в кольцо всегда: клиент с "cbor" может войти позже
+    const QByteArray payload = QJsonDocument(message).toJson(QJsonDocument::Compact);
+    const QByteArray cbor = CborPayload::encodeMessage(messageRecord(message));
+    room->history.append(room->nextSequence, payload, cbor);
+    if (room->log && room->log->isOpen() && !room->log->append(room->nextSequence, payload)) {
+        qDebug() << Server::tr("Unable to write message %1 to the message log.").arg(room->nextSequence);
+        if (!room->log->isOpen()) {
+            qDebug() << Server::tr("The message log is closed, history is kept in memory only.");
+        }
+    }
+    ++room->nextSequence;
+
+    EncodedFrame frame(Protocol::PlainText, payload);
+    return (room->cborClients > 0) ? withCbor(cbor, frame) : frame;
 }
 
-QByteArray Server::Pimpl::participantsMessage()
+EncodedFrame Server::Pimpl::withCbor(const QByteArray &cbor, const EncodedFrame &json)
 {
-    QJsonArray participants;
-    for (const auto& part : m_participants) {
-        participants.append( QJsonObject{
-                                { QLatin1String("name"), part.name },
-                                { QLatin1String("ip"), part.address.toString() },
-                                { QLatin1String("port"), part.port }
-                            });
+    EncodedFrame frame(json.type(), cbor, json.requiredCapabilities() | Protocol::CapabilityCbor);
+    frame.setFallback(json);
+    return frame;
+}
+
+void Server::Pimpl::countClient(Room *room, const Session *session, int delta)
+{
+    if (!room || !session->isLocal()) {
+        return;
+    }
+    if (session->capabilities & Protocol::CapabilityPresence) {
+        room->presenceClients += delta;
+    }
+    if (session->capabilities & Protocol::CapabilityCbor) {
+        room->cborClients += delta;
+    }
+}
+
+Worker* Server::Pimpl::pickWorker()
+{
+    // наименее загруженный, при равенстве — по кругу
+    Worker* best = nullptr;
+    for (int i = 0; i < m_workers.size(); ++i) {
+        Worker* worker = m_workers.at((m_nextWorker + i) % m_workers.size());
+        if (!best || (worker->connectionCount() < best->connectionCount())) {
+            best = worker;
+        }
     }
-    QJsonDocument doc(participants);
-    //qDebug() << participants;
-    QByteArray msg = doc.toJson(QJsonDocument::Compact);
-    QByteArray data = "PARTICIPANTS " + QByteArray::number(msg.size()) + ' ' + msg;
-    return data;
+    m_nextWorker = (m_nextWorker + 1) % m_workers.size();
+    return best;
+}
+
+QByteArray Server::Pimpl::participantsMessage(const Room *room)
+{
+    return Payloads::participantsMessage(participantRecords(room));
 }
 
-QByteArray Server::Pimpl::textMessage(const QString &text, Connection *conn)
+QByteArray Server::Pimpl::presenceSnapshotMessage(const Room *room)
+{
+    QJsonObject snapshot = QJsonObject{
+                            {QLatin1String("version"), static_cast<qint64>(room->presenceVersion)},
+                            {QLatin1String("participants"), Payloads::participantsArray(participantRecords(room))}
+                          };
+    QJsonDocument doc(snapshot);
+    return doc.toJson(QJsonDocument::Compact);
+}
+
+QByteArray Server::Pimpl::presenceMessage(const Room *room, const Session *session)
+{
+    QJsonObject message = Payloads::participant(participantRecord(session));
+    message.insert(QLatin1String("version"), static_cast<qint64>(room->presenceVersion));
+    QJsonDocument doc(message);
+    return doc.toJson(QJsonDocument::Compact);
+}
+
+QByteArray Server::Pimpl::presenceRemoveMessage(const Room *room, const Session *session)
 {
-    const ParticipantInfo& info = m_connections.value(conn);
     QJsonObject message = QJsonObject{
-                            {QLatin1String("name"), info.name},
-                            {QLatin1String("ip"), info.address.toString()},
-                            {QLatin1String("port"), info.port},
-                            {QLatin1String("message"), text},
-                            {QLatin1String("time"), QDateTime::currentDateTime().toString(QLatin1String("dd.MM.yyyy hh:mm:ss"))}
+                            {QLatin1String("version"), static_cast<qint64>(room->presenceVersion)},
+                            {QLatin1String("id"), static_cast<qint64>(session->id)}
                           };
-    m_history.append(message);
-    if (m_history.size() > MaxHistorySize) {
-        m_history.removeFirst();
-    }
     QJsonDocument doc(message);
-    QByteArray msg = doc.toJson(QJsonDocument::Compact);
-    QByteArray data = "MESSAGE " + QByteArray::number(msg.size()) + ' ' + msg;
-    return data;
+    return doc.toJson(QJsonDocument::Compact);
 }
 
-QByteArray Server::Pimpl::joinMessage(Connection *conn)
+QByteArray Server::Pimpl::roomMessage(const Room *room)
 {
-    const ParticipantInfo& info = m_connections.value(conn);
     QJsonObject message = QJsonObject{
-                            {QLatin1String("name"), info.name},
-                            {QLatin1String("ip"), info.address.toString()},
-                            {QLatin1String("port"), info.port}
+                            {QLatin1String("room"), room->name},
+                            {QLatin1String("members"), room->members}
                           };
     QJsonDocument doc(message);
-    QByteArray msg = doc.toJson(QJsonDocument::Compact);
-    QByteArray data = "JOIN " + QByteArray::number(msg.size()) + ' ' + msg;
-    return data;
+    return doc.toJson(QJsonDocument::Compact);
 }
 
-QByteArray Server::Pimpl::leaveMessage(Connection *conn)
+EncodedFrame Server::Pimpl::textMessage(const QString &text, Session *session)
+{
+    Room* room = session->room;
+    CborPayload::Message record;{
+        record.sequence = static_cast<qint64>(room->nextSequence);
+        record.name = session->name;
+        record.ip = session->address.toString();
+        record.port = session->port;
+        record.text = text;
+        record.timestamp = m_clock.now();
+    }
+    const QJsonObject message = Payloads::textMessage(record, m_clock.text(record.timestamp));
+    relayMessage(room, message);
+    return storeMessage(room, message);
+}
+
+QByteArray Server::Pimpl::sessionMessage(const Session *session)
 {
-    const ParticipantInfo& info = m_connections.value(conn);
     QJsonObject message = QJsonObject{
-                            {QLatin1String("name"), info.name},
-                            {QLatin1String("ip"), info.address.toString()},
-                            {QLatin1String("port"), info.port}
+                            {QLatin1String("id"), static_cast<qint64>(session->id)}
                           };
     QJsonDocument doc(message);
-    QByteArray msg = doc.toJson(QJsonDocument::Compact);
-    QByteArray data = "LEAVE " + QByteArray::number(msg.size()) + ' ' + msg;
-    return data;
+    return doc.toJson(QJsonDocument::Compact);
+}
+
+CborPayload::Participant Server::Pimpl::participantRecord(const Session *session)
+{
+    CborPayload::Participant record;{
+        record.id = static_cast<qint64>(session->id);
+        record.name = session->name;
+        record.ip = session->address.toString();
+        record.port = session->port;
+    }
+    return record;
+}
+
+QVector<CborPayload::Participant> Server::Pimpl::participantRecords(const Room *room)
+{
+    QVector<CborPayload::Participant> records;
+    records.reserve(room->participants.size());
+    for (const Session* session : room->participants) {
+        records.append(participantRecord(session));
+    }
+    return records;
 }
 
-QByteArray Server::Pimpl::historyMessage()
+CborPayload::Message Server::Pimpl::messageRecord(const QJsonObject &message)
 {
-    if (m_history.isEmpty()) {
-        return QByteArray();
+    CborPayload::Message record;{
+        record.sequence = static_cast<qint64>(message.value(QLatin1String("seq")).toDouble());
+        record.name = message.value(QLatin1String("name")).toString();
+        record.ip = message.value(QLatin1String("ip")).toString();
+        record.port = message.value(QLatin1String("port")).toInt();
+        record.text = message.value(QLatin1String("message")).toString();
+        record.timestamp = static_cast<qint64>(message.value(QLatin1String("ts")).toDouble());
+    }
+    // записи журнала до появления "ts" несут только строку времени
+    if (!message.contains(QLatin1String("ts"))) {
+        record.timestamp = QDateTime::fromString(message.value(QLatin1String("time")).toString(),
+                                                 QLatin1String("dd.MM.yyyy hh:mm:ss")).toMSecsSinceEpoch();
     }
-    QJsonDocument doc(m_history);
-    QByteArray msg = doc.toJson(QJsonDocument::Compact);
-    QByteArray data = "HISTORY " + QByteArray::number(msg.size()) + ' ' + msg;
-    return data;
+    return record;
 }
 
 bool Server::Pimpl::nameIsOk(const QString &name)
 {
-    return !m_participants.contains(name);
+    return !m_names.contains(name);
+}
+
+void Server::Pimpl::relaySession(const Session *session)
+{
+    if (m_cluster) {
+        m_cluster->broadcast(Protocol::NodeUp, QJsonDocument(nodeSession(session)).toJson(QJsonDocument::Compact));
+    }
+}
+
+void Server::Pimpl::relayMessage(const Room *room, const QJsonObject &message)
+{
+    if (!m_cluster) {
+        return;
+    }
+    QJsonObject relayed = QJsonObject{
+                            {QLatin1String("room"), room->name},
+                            {QLatin1String("message"), message}
+                          };
+    m_cluster->broadcast(Protocol::NodeMessage, QJsonDocument(relayed).toJson(QJsonDocument::Compact));
+}
+
+void Server::Pimpl::applyRemoteSession(const QJsonObject &remote)
+{
+    const quint64 id = static_cast<quint64>(remote.value(QLatin1String("id")).toDouble());
+    const QString roomName = remote.value(QLatin1String("room")).toString();
+    Session* session = m_sessions.value(id);
+    if (session) {
+        // уже известная сессия перешла в другую комнату
+        Room* target = room(roomName);
+        if (session->room != target) {
+            leaveRoom(session);
+            enterRoom(target, session);
+            announce(session);
+        }
+        return;
+    }
+
+    const QString name = remote.value(QLatin1String("name")).toString();
+    const int node = static_cast<int>(id >> 32);
+    if ( name.isEmpty() || (node == m_nodeId) ) {
+        return;
+    }
+    // одно имя заняли на двух узлах одновременно: остаётся сессия узла с
+    // меньшим номером, проигравший узел сам отключит свою
+    Session* holder = m_names.value(name);
+    if (holder) {
+        if (holder->node() < node) {
+            return;
+        }
+        if (holder->isLocal()) {
+            leaveRoom(holder);
+            m_names.remove(name);
+            if (m_cluster) {
+                m_cluster->broadcast(Protocol::NodeDown, sessionMessage(holder));
+            }
+            holder->name.clear();
+            holder->worker->rejectName(holder->id);
+        }
+        else {
+            removeSession(holder->id);
+        }
+    }
+
+    session = new Session;
+    session->id = id;
+    session->name = name;
+    session->address = QHostAddress(remote.value(QLatin1String("ip")).toString());
+    session->port = remote.value(QLatin1String("port")).toInt();
+    m_sessions.insert(id, session);
+    m_names.insert(name, session);
+    enterRoom(room(roomName), session);
+    announce(session);
+}
+
+void Server::Pimpl::deliverRemoteMessage(const QJsonObject &relayed)
+{
+    const QString name = relayed.value(QLatin1String("room")).toString();
+    Room* room = name.isEmpty() ? m_lobby : m_rooms.value(name);
+    if (!room) {
+        return;
+    }
+
+    // номер в истории у каждого узла свой, по нему клиенты листают историю
+    QJsonObject message = relayed.value(QLatin1String("message")).toObject();
+    message.insert(QLatin1String("seq"), static_cast<qint64>(room->nextSequence));
+    room->hub->broadcast(storeMessage(room, message));
+}
+
+void Server::Pimpl::onNodeJoined(int node)
+{
+    // новому узлу — все наши участники, его участники придут навстречу
+    QJsonArray sessions;
+    for (const Session* session : m_sessions) {
+        if ( session->isLocal() && !session->name.isEmpty() && session->room ) {
+            sessions.append(nodeSession(session));
+        }
+    }
+    m_cluster->send(node, Protocol::NodeSync, QJsonDocument(sessions).toJson(QJsonDocument::Compact));
+}
+
+void Server::Pimpl::onNodeLeft(int node)
+{
+    QVector<quint64> gone;
+    for (const Session* session : m_sessions) {
+        if ( !session->isLocal() && (session->node() == node) ) {
+            gone.append(session->id);
+        }
+    }
+    for (quint64 id : gone) {
+        removeSession(id);
+    }
+}
+
+void Server::Pimpl::onNodeFrame(Protocol::DataType type, const QByteArray &payload)
+{
+    const QJsonDocument doc = QJsonDocument::fromJson(payload);
+    switch (type) {
+    case Protocol::NodeSync: {
+        for (const QJsonValue& remote : doc.array()) {
+            applyRemoteSession(remote.toObject());
+        }
+        break;
+    }
+    case Protocol::NodeUp: {
+        applyRemoteSession(doc.object());
+        break;
+    }
+    case Protocol::NodeDown: {
+        const quint64 id = static_cast<quint64>(doc.object().value(QLatin1String("id")).toDouble());
+        const Session* session = m_sessions.value(id);
+        if (session && !session->isLocal()) {
+            removeSession(id);
+        }
+        break;
+    }
+    case Protocol::NodeMessage: {
+        deliverRemoteMessage(doc.object());
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+QJsonObject Server::Pimpl::nodeSession(const Session *session)
+{
+    QJsonObject remote = Payloads::participant(participantRecord(session));
+    remote.insert(QLatin1String("room"), session->room ? session->room->name : QString());
+    return remote;
 }
 
 //-----------------------------------------------------------------------//
 //  Server                                                               //
 //-----------------------------------------------------------------------//
 
-Server::Server(QObject *parent)
+Server::Server(int workerCount, QObject *parent)
     : QTcpServer(parent)
 {
     m_d = new Pimpl(this);
+
+    if (workerCount <= 0) {
+        workerCount = qMax(QThread::idealThreadCount(), 1);
+    }
+    for (int i = 0; i < workerCount; ++i) {
+        Worker* worker = new Worker(i);
+        worker->start();
+        m_d->m_workers.append(worker);
+    }
+    // общая комната существует всегда, в неё попадает каждое подключение
+    m_d->m_lobby = new Pimpl::Room;
+    m_d->m_lobby->hub = new BroadcastHub(m_d->m_workers);
 }
 
 Server::~Server()
 {
+    close();
+    delete m_d->m_cluster;
+    qDeleteAll(m_d->m_workers);
+    for (Pimpl::Room* room : m_d->m_rooms.values()) {
+        m_d->dropRoom(room);
+    }
+    m_d->dropRoom(m_d->m_lobby);
+    qDeleteAll(m_d->m_sessions);
     delete m_d;
 }
 
-void Server::incomingConnection(qintptr socketDescriptor)
+QVector<Worker*> Server::workers() const
 {
-    QThread* connThread = new QThread(this);
-    Connection *connection = new Connection(socketDescriptor);
-    connect(connection, &Connection::connected,
-            this, [this](){
-        if (Connection *connection = qobject_cast<Connection *>(sender())) {
-            m_d->addConnection(connection->peerAddress(), connection->peerPort(), connection);
-        }
+    return m_d->m_workers;
+}
+
+void Server::setHistoryCapacity(int capacity)
+{
+    m_d->m_historyCapacity = capacity;
+    m_d->m_lobby->history.setCapacity(capacity);
+    for (Pimpl::Room* room : m_d->m_rooms) {
+        room->history.setCapacity(capacity);
+    }
+}
+
+bool Server::openLog(const QString &directory, qint64 maxBytes, qint64 maxAgeSeconds)
+{
+    m_d->m_logDirectory = directory;
+    m_d->m_logMaxBytes = maxBytes;
+    m_d->m_logMaxAge = maxAgeSeconds;
+    if (!m_d->openRoomLog(m_d->m_lobby)) {
+        m_d->m_logDirectory.clear();
+        return false;
+    }
+    return true;
+}
+
+const Metrics &Server::metrics() const
+{
+    return m_d->m_metrics;
+}
+
+int Server::historySize() const
+{
+    int size = m_d->m_lobby->history.size();
+    for (const Pimpl::Room* room : m_d->m_rooms) {
+        size += room->history.size();
+    }
+    return size;
+}
+
+qint64 Server::logSize() const
+{
+    qint64 size = m_d->m_lobby->log ? m_d->m_lobby->log->size() : 0;
+    for (const Pimpl::Room* room : m_d->m_rooms) {
+        size += room->log ? room->log->size() : 0;
+    }
+    return size;
+}
+
+int Server::roomCount() const
+{
+    return m_d->m_rooms.size() + 1;
+}
+
+int Server::clusterNodes() const
+{
+    return m_d->m_cluster ? m_d->m_cluster->nodeCount() : 1;
+}
+
+bool Server::startCluster(int nodeId, const QHostAddress &address, quint16 port,
+                          const QByteArray &secret, const QStringList &peers)
+{
+    m_d->m_nodeId = nodeId;
+    m_d->m_cluster = new Cluster(nodeId, secret);
+    if (!m_d->m_cluster->listen(address, port)) {
+        delete m_d->m_cluster;
+        m_d->m_cluster = nullptr;
+        return false;
+    }
+
+    connect(m_d->m_cluster, &Cluster::nodeJoined,
+            this, [this](int node){
+        m_d->onNodeJoined(node);
     });
-    connect(connection, &Connection::disconnected,
-            this, &Server::onDisconnected);
-    connect(connection, &Connection::writeMessage,
-            this, [this](const QString& text){
-        if (Connection *connection = qobject_cast<Connection *>(sender())) {
-            emit writeMessage(m_d->textMessage(text, connection));
-        }
+    connect(m_d->m_cluster, &Cluster::nodeLeft,
+            this, [this](int node){
+        m_d->onNodeLeft(node);
     });
-    connect(connection, &Connection::changeConnectionName,
-            this, &Server::onChangeConnectionName);
-    connect(this, &Server::nameError,
-            connection, &Connection::onNameError);
-    connect(this, &Server::writeMessage,
-            connection, &Connection::onWrite);
-    connect(connection, &Connection::disconnected,
-            this, [this, connThread](){
-        connThread->exit();
+    connect(m_d->m_cluster, &Cluster::frameReceived,
+            this, [this](int, Protocol::DataType type, const QByteArray& payload){
+        m_d->onNodeFrame(type, payload);
     });
-    connection->write(m_d->participantsMessage());
-    connection->write(m_d->historyMessage());
+    // узлы задаются как host:port их кластерного порта
+    for (const QString& peer : peers) {
+        const int colon = peer.lastIndexOf(QLatin1Char(':'));
+        if (colon > 0) {
+            m_d->m_cluster->addPeer(peer.left(colon), static_cast<quint16>(peer.midRef(colon + 1).toUInt()));
+        }
+    }
+    return true;
+}
+
+void Server::setIdleOnlyPing(bool idleOnly)
+{
+    m_d->m_idleOnlyPing = idleOnly;
+}
 
-    connection->moveToThread(connThread);
+void Server::setOutboundPolicy(Connection::SlowConsumerPolicy policy, qint64 highWatermark, qint64 lowWatermark)
+{
+    m_d->m_slowConsumerPolicy = policy;
+    m_d->m_highWatermark = highWatermark;
+    m_d->m_lowWatermark = lowWatermark;
+}
 
-    connect(connThread, &QThread::finished,
-            connThread, &QThread::deleteLater);
-    connThread->start();
+void Server::setWriteCoalescing(int windowMs, int maxBytes)
+{
+    m_d->m_coalesceWindow = windowMs;
+    m_d->m_coalesceBytes = maxBytes;
 }
 
-void Server::onDisconnected()
+void Server::setCompressionThreshold(int bytes)
 {
-    if (Connection *connection = qobject_cast<Connection *>(sender())) {
-        m_d->removeConnection(connection);
-    }
+    m_d->m_compressThreshold = bytes;
 }
 
-void Server::onChangeConnectionName(const QString &name)
+void Server::incomingConnection(qintptr socketDescriptor)
 {
-    if (Connection *connection = qobject_cast<Connection *>(sender())) {
-        if (m_d->nameIsOk(name)) {
-            m_d->addParticipant(name, connection);
+    Connection *connection = new Connection(socketDescriptor);
+    connection->setMetrics(&m_d->m_metrics);
+    connection->setIdleOnlyPing(m_d->m_idleOnlyPing);
+    connection->setOutboundPolicy(m_d->m_slowConsumerPolicy, m_d->m_highWatermark, m_d->m_lowWatermark);
+    connection->setWriteCoalescing(m_d->m_coalesceWindow, m_d->m_coalesceBytes);
+    connection->setCompressionThreshold(m_d->m_compressThreshold);
+    Pimpl::Session* session = m_d->addSession(connection->peerAddress(), connection->peerPort(), connection);
+    const quint64 id = session->id;
+
+    // соединение удаляется воркером, поэтому сигналы находят сессию по id
+    connect(connection, &Connection::disconnected,
+            this, [this, id](){
+        m_d->removeSession(id);
+    });
+    connect(connection, &Connection::writeMessage,
+            this, [this, id](const QString& text){
+        Pimpl::Session* session = m_d->m_sessions.value(id);
+        if (session && session->room) {
+            session->room->hub->broadcast(m_d->textMessage(text, session));
         }
-        else {
-            emit nameError(connection);
+    });
+    connect(connection, &Connection::changeConnectionName,
+            this, [this, id](const QString& name){
+        if (Pimpl::Session* session = m_d->m_sessions.value(id)) {
+            m_d->changeSessionName(name, session);
+        }
+    });
+    connect(connection, &Connection::capabilitiesNegotiated,
+            this, [this, id](quint32 capabilities){
+        if (Pimpl::Session* session = m_d->m_sessions.value(id)) {
+            m_d->setCapabilities(capabilities, session);
         }
+    });
+    connect(connection, &Connection::presenceSyncRequested,
+            this, [this, id](){
+        if (Pimpl::Session* session = m_d->m_sessions.value(id)) {
+            m_d->sendPresenceSnapshot(session);
+        }
+    });
+    connect(connection, &Connection::historyPageRequested,
+            this, [this, id](quint64 before, int limit){
+        if (Pimpl::Session* session = m_d->m_sessions.value(id)) {
+            m_d->sendHistoryPage(session, before, limit);
+        }
+    });
+    connect(connection, &Connection::roomRequested,
+            this, [this, id](const QString& room){
+        if (Pimpl::Session* session = m_d->m_sessions.value(id)) {
+            m_d->joinRoom(room, session);
+        }
+    });
+    connection->sendFrame(Protocol::Participants, m_d->participantsMessage(m_d->m_lobby));
+    // снимок истории закодирован заранее и общий для всех подключений
+    const QByteArray& history = m_d->m_lobby->history.snapshotFrame();
+    if (!history.isEmpty()) {
+        connection->write(history);
     }
+
+    session->worker = m_d->pickWorker();
+    session->worker->addConnection(id, connection);
+    m_d->enterRoom(m_d->m_lobby, session);
 }
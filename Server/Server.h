@@ -1,8 +1,14 @@
 #pragma once
 
+#include <QStringList>
 #include <QTcpServer>
+#include <QVector>
 
-class Connection;
+#include "Connection.h"
+#include "Protocol.h"
+
+class Metrics;
+class Worker;
 
 //-----------------------------------------------------------------------//
 //  Server                                                               //
@@ -11,16 +17,25 @@ class Connection;
 class Server : public QTcpServer {
     Q_OBJECT
 public:
-    explicit Server(QObject *parent = nullptr);
+    explicit Server(int workerCount = 0, QObject *parent = nullptr);
     ~Server();
+public:
+    QVector<Worker*> workers() const;
+    const Metrics& metrics() const;
+    int historySize() const;
+    qint64 logSize() const;
+    int roomCount() const;
+    int clusterNodes() const;
+    void setHistoryCapacity(int capacity);
+    bool openLog(const QString& directory, qint64 maxBytes = 0, qint64 maxAgeSeconds = 0);
+    bool startCluster(int nodeId, const QHostAddress& address, quint16 port,
+                      const QByteArray& secret, const QStringList& peers);
+    void setIdleOnlyPing(bool idleOnly);
+    void setOutboundPolicy(Connection::SlowConsumerPolicy policy, qint64 highWatermark, qint64 lowWatermark);
+    void setWriteCoalescing(int windowMs, int maxBytes);
+    void setCompressionThreshold(int bytes);
 protected:
     void incomingConnection(qintptr socketDescriptor) override;
-private slots:
-    void onDisconnected();
-    void onChangeConnectionName(const QString& name);
-signals:
-    void writeMessage(const QByteArray& text);
-    void nameError(Connection* conn);
 private:
     class Pimpl;
     Pimpl* m_d;
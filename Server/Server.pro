@@ -13,4 +13,6 @@ SOURCES += *.cpp
 
 HEADERS += *h
 
+include(../Common/Common.pri)
+
 DEFINES += QT_DEPRECATED_WARNINGS
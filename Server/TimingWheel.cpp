@@ -0,0 +1,135 @@
+#include "TimingWheel.h"
+
+// Значения Client::m_slot помимо номера слота
+static const int NotScheduled = -1;
+static const int InFlight = -2;
+static const int Cancelled = -3;
+
+//-----------------------------------------------------------------------//
+//  TimingWheel                                                          //
+//-----------------------------------------------------------------------//
+
+TimingWheel::TimingWheel(int tickInterval, int slotCount) :
+    m_tickInterval(qMax(tickInterval, 1))
+{
+    m_slots.resize(qMax(slotCount, 1));
+    m_clock.start();
+}
+
+qint64 TimingWheel::now() const
+{
+    return m_now;
+}
+
+int TimingWheel::tickInterval() const
+{
+    return m_tickInterval;
+}
+
+int TimingWheel::size() const
+{
+    return m_size;
+}
+
+void TimingWheel::schedule(Client *client)
+{
+    if ( (client->m_slot == InFlight) || (client->m_slot == Cancelled) ) {
+        // переставится сам после expire()
+        return;
+    }
+
+    const qint64 deadline = client->nextDeadline();
+    if (deadline < 0) {
+        // лишняя запись уйдёт сама, когда колесо дойдёт до слота
+        return;
+    }
+
+    const qint64 tick = qMax(m_currentTick + 1, (deadline + m_tickInterval - 1) / m_tickInterval);
+    if ( (client->m_slot >= 0) && (client->m_scheduledTick <= tick) ) {
+        // уже стоит не позже, это обычный случай для горячего пути
+        return;
+    }
+    if (client->m_slot >= 0) {
+        detach(client);
+    }
+    insert(client, deadline);
+}
+
+void TimingWheel::remove(Client *client)
+{
+    if (client->m_slot >= 0) {
+        detach(client);
+        client->m_slot = NotScheduled;
+    }
+    else if (client->m_slot == InFlight) {
+        client->m_slot = Cancelled;
+    }
+}
+
+void TimingWheel::advance()
+{
+    m_now = m_clock.elapsed();
+    const qint64 lastTick = m_now / m_tickInterval;
+    // после долгой остановки достаточно одного оборота: каждый слот проверит
+    // все свои записи с истёкшим сроком
+    qint64 tick = qMax(m_currentTick + 1, lastTick - m_slots.size() + 1);
+    for (; tick <= lastTick; ++tick) {
+        m_currentTick = tick;
+        processSlot(tick);
+    }
+}
+
+void TimingWheel::insert(Client *client, qint64 deadline)
+{
+    const qint64 tick = qMax(m_currentTick + 1, (deadline + m_tickInterval - 1) / m_tickInterval);
+    QVector<Client*>& slot = m_slots[static_cast<int>(tick % m_slots.size())];
+    client->m_scheduledTick = tick;
+    client->m_slot = static_cast<int>(tick % m_slots.size());
+    client->m_index = slot.size();
+    slot.append(client);
+    ++m_size;
+}
+
+void TimingWheel::detach(Client *client)
+{
+    QVector<Client*>& slot = m_slots[client->m_slot];
+    Client* last = slot.last();
+    slot[client->m_index] = last;
+    last->m_index = client->m_index;
+    slot.removeLast();
+    client->m_index = -1;
+    --m_size;
+}
+
+void TimingWheel::processSlot(qint64 tick)
+{
+    QVector<Client*>& slot = m_slots[static_cast<int>(tick % m_slots.size())];
+    m_due.clear();
+    for (int i = 0; i < slot.size(); ) {
+        Client* client = slot.at(i);
+        if (client->m_scheduledTick > tick) {
+            ++i;
+            continue;
+        }
+        detach(client);
+        client->m_slot = InFlight;
+        m_due.append(client);
+    }
+
+    for (Client* client : m_due) {
+        if (client->m_slot == Cancelled) {
+            client->m_slot = NotScheduled;
+            continue;
+        }
+        const qint64 deadline = client->nextDeadline();
+        if ( (deadline >= 0) && (deadline <= m_now) ) {
+            client->expire(m_now);
+        }
+        if (client->m_slot == Cancelled) {
+            client->m_slot = NotScheduled;
+            continue;
+        }
+        client->m_slot = NotScheduled;
+        schedule(client);
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QVector>
+
+//-----------------------------------------------------------------------//
+//  TimingWheel                                                          //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Хешированное колесо таймеров одного воркера. Клиент сам хранит свои сроки
+ * (обычные метки времени) и сообщает ближайший через nextDeadline(); колесо
+ * проверяет его лениво, когда доходит до слота, и переставляет при
+ * необходимости. Сроки дальше одного оборота колеса ждут нужного круга.
+ */
+class TimingWheel {
+public:
+    class Client {
+    public:
+        virtual ~Client() {}
+        virtual qint64 nextDeadline() const = 0; /*!< мс по часам колеса, < 0 — сроков нет */
+        virtual void expire(qint64 now) = 0;
+    private:
+        friend class TimingWheel;
+        qint64 m_scheduledTick = -1;
+        int m_slot = -1;
+        int m_index = -1;
+    };
+public:
+    explicit TimingWheel(int tickInterval, int slotCount = 64);
+public:
+    qint64 now() const;
+    int tickInterval() const;
+    int size() const;
+    void schedule(Client* client);
+    void remove(Client* client);
+    void advance();
+private:
+    void insert(Client* client, qint64 deadline);
+    void detach(Client* client);
+    void processSlot(qint64 tick);
+private:
+    QVector< QVector<Client*> > m_slots;
+    QVector<Client*> m_due;
+    QElapsedTimer m_clock;
+    qint64 m_now = 0;
+    qint64 m_currentTick = 0;
+    int m_tickInterval = 1;
+    int m_size = 0;
+};
@@ -0,0 +1,244 @@
+#include "Worker.h"
+#include "BroadcastHub.h"
+#include "Connection.h"
+#include "Metrics.h"
+#include "TimingWheel.h"
+#include "WriteCoalescer.h"
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QThread>
+#include <QTimer>
+
+static const int TickInterval = 50;
+// очереди обходятся раз в секунду, а не на каждом тике
+static const int QueueStatsTicks = 20;
+
+//-----------------------------------------------------------------------//
+//  Worker::Pimpl                                                        //
+//-----------------------------------------------------------------------//
+
+class Worker::Pimpl {
+public:
+    Pimpl(Worker* parent);
+public:
+    void startTicking();
+    void tick();
+    void collectQueueStats();
+    void adopt(quint64 id, Connection* connection);
+    void deliver(const EncodedFrame& frame, const QVector<quint64>& targets);
+public:
+    int m_index = 0;
+    QThread* m_thread = nullptr;
+    QTimer* m_tickTimer = nullptr;
+    WriteCoalescer* m_coalescer = nullptr;
+    QElapsedTimer m_lagClock;
+    TimingWheel m_wheel;
+    Metrics m_metrics;
+    QAtomicInt m_connectionCount;
+    QAtomicInt m_loopLag;
+    QAtomicInteger<qint64> m_queuedBytes;
+    QAtomicInteger<qint64> m_maxQueuedBytes;
+    QAtomicInteger<quint64> m_droppedFrames;
+    quint64 m_retiredDroppedFrames = 0;
+    int m_ticks = 0;
+    QHash<quint64, Connection*> m_connections; /*!< Живые соединения по id сессии */
+    Worker* m_parent = nullptr;
+};
+
+Worker::Pimpl::Pimpl(Worker *parent) :
+    m_wheel(TickInterval),
+    m_parent(parent)
+{
+}
+
+void Worker::Pimpl::startTicking()
+{
+    // единственный таймер воркера: колесо сроков всех соединений и замер задержки цикла
+    m_tickTimer = new QTimer(m_parent);
+    m_tickTimer->setTimerType(Qt::PreciseTimer);
+    m_tickTimer->setInterval(TickInterval);
+    QObject::connect(m_tickTimer, &QTimer::timeout,
+                     m_parent, [this](){
+        tick();
+    });
+    QObject::connect(m_thread, &QThread::finished,
+                     m_tickTimer, &QTimer::stop);
+    m_lagClock.start();
+    m_tickTimer->start();
+    m_coalescer = new WriteCoalescer(m_parent);
+}
+
+void Worker::Pimpl::tick()
+{
+    // насколько позже положенного сработал таймер — столько цикл был занят
+    const qint64 lag = m_lagClock.restart() - TickInterval;
+    m_loopLag.store(static_cast<int>(qMax<qint64>(lag, 0)));
+    m_wheel.advance();
+    if (++m_ticks % QueueStatsTicks == 0) {
+        collectQueueStats();
+    }
+}
+
+void Worker::Pimpl::collectQueueStats()
+{
+    qint64 total = 0;
+    qint64 deepest = 0;
+    quint64 dropped = m_retiredDroppedFrames;
+    for (const Connection* connection : m_connections) {
+        const qint64 queued = connection->queuedBytes();
+        total += queued;
+        deepest = qMax(deepest, queued);
+        dropped += connection->droppedFrames();
+    }
+    m_queuedBytes.store(total);
+    m_maxQueuedBytes.store(deepest);
+    m_droppedFrames.store(dropped);
+}
+
+void Worker::Pimpl::adopt(quint64 id, Connection *connection)
+{
+    // соединение могло закрыться раньше, чем дошла очередь до этого вызова
+    if (connection->state() == QAbstractSocket::ConnectedState) {
+        m_connections.insert(id, connection);
+        connection->setTimingWheel(&m_wheel);
+        connection->setMetrics(&m_metrics);
+        connection->setWriteCoalescer(m_coalescer);
+    }
+}
+
+void Worker::Pimpl::deliver(const EncodedFrame &frame, const QVector<quint64> &targets)
+{
+    // основной поток узнаёт об отключениях с опозданием, поэтому список
+    // сверяется с живыми соединениями воркера
+    for (quint64 id : targets) {
+        if (Connection* connection = m_connections.value(id)) {
+            connection->writeFrame(frame);
+        }
+    }
+    // от создания кадра до того, как он отдан сокетам этого воркера
+    m_metrics.fanOut(Metrics::timestamp() - frame.createdAt());
+}
+
+//-----------------------------------------------------------------------//
+//  Worker                                                               //
+//-----------------------------------------------------------------------//
+
+Worker::Worker(int index)
+{
+    m_d = new Pimpl(this);
+    m_d->m_index = index;
+}
+
+Worker::~Worker()
+{
+    stop();
+    delete m_d->m_thread;
+    delete m_d;
+}
+
+int Worker::index() const
+{
+    return m_d->m_index;
+}
+
+int Worker::connectionCount() const
+{
+    return m_d->m_connectionCount.load();
+}
+
+int Worker::loopLag() const
+{
+    return m_d->m_loopLag.load();
+}
+
+qint64 Worker::queuedBytes() const
+{
+    return m_d->m_queuedBytes.load();
+}
+
+qint64 Worker::maxQueuedBytes() const
+{
+    return m_d->m_maxQueuedBytes.load();
+}
+
+quint64 Worker::droppedFrames() const
+{
+    return m_d->m_droppedFrames.load();
+}
+
+const Metrics &Worker::metrics() const
+{
+    return m_d->m_metrics;
+}
+
+void Worker::start()
+{
+    if (m_d->m_thread) {
+        return;
+    }
+
+    m_d->m_thread = new QThread;
+    m_d->m_thread->setObjectName(QStringLiteral("Worker #%1").arg(m_d->m_index));
+    moveToThread(m_d->m_thread);
+    connect(m_d->m_thread, &QThread::started,
+            this, [this](){
+        m_d->startTicking();
+    });
+    m_d->m_thread->start();
+}
+
+void Worker::stop()
+{
+    if (m_d->m_thread && m_d->m_thread->isRunning()) {
+        m_d->m_thread->quit();
+        m_d->m_thread->wait();
+    }
+}
+
+void Worker::addConnection(quint64 id, Connection *connection)
+{
+    m_d->m_connectionCount.ref();
+    // сигнал придёт уже в потоке воркера, поэтому вызов будет прямым
+    connect(connection, &Connection::disconnected,
+            this, [this, id, connection](){
+        m_d->m_connections.remove(id);
+        m_d->m_wheel.remove(connection);
+        m_d->m_coalescer->remove(connection);
+        m_d->m_retiredDroppedFrames += connection->droppedFrames();
+        m_d->m_connectionCount.deref();
+        connection->deleteLater();
+    });
+    connection->moveToThread(m_d->m_thread);
+    QMetaObject::invokeMethod(this, [this, id, connection](){
+        m_d->adopt(id, connection);
+    }, Qt::QueuedConnection);
+}
+
+void Worker::deliver(const EncodedFrame &frame, const QVector<quint64> &targets)
+{
+    // одно событие на воркер вместо одного на каждое соединение
+    QMetaObject::invokeMethod(this, [this, frame, targets](){
+        m_d->deliver(frame, targets);
+    }, Qt::QueuedConnection);
+}
+
+void Worker::send(quint64 id, const EncodedFrame &frame)
+{
+    QMetaObject::invokeMethod(this, [this, id, frame](){
+        if (Connection* connection = m_d->m_connections.value(id)) {
+            connection->writeFrame(frame);
+        }
+    }, Qt::QueuedConnection);
+}
+
+void Worker::rejectName(quint64 id)
+{
+    // будится только поток этого соединения, а не все подключения сервера
+    QMetaObject::invokeMethod(this, [this, id](){
+        if (Connection* connection = m_d->m_connections.value(id)) {
+            connection->rejectName();
+        }
+    }, Qt::QueuedConnection);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QObject>
+#include <QVector>
+
+class Connection;
+class EncodedFrame;
+class Metrics;
+
+//-----------------------------------------------------------------------//
+//  Worker                                                               //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Поток с собственным циклом событий, обслуживающий много соединений.
+ * Соединения адресуются id сессии: адрес удалённого соединения может
+ * достаться следующему, а id не повторяются. Счётчики читаются из любого потока.
+ */
+class Worker : public QObject {
+    Q_OBJECT
+public:
+    explicit Worker(int index);
+    ~Worker();
+public:
+    int index() const;
+    int connectionCount() const;
+    int loopLag() const;
+    qint64 queuedBytes() const;
+    qint64 maxQueuedBytes() const;
+    quint64 droppedFrames() const;
+    const Metrics& metrics() const;
+    void start();
+    void stop();
+    void addConnection(quint64 id, Connection* connection);
+    void deliver(const EncodedFrame& frame, const QVector<quint64>& targets);
+    void send(quint64 id, const EncodedFrame& frame);
+    void rejectName(quint64 id);
+private:
+    class Pimpl;
+    Pimpl* m_d;
+};
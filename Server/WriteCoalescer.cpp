@@ -0,0 +1,99 @@
+#include "WriteCoalescer.h"
+#include "Connection.h"
+#include "Metrics.h"
+
+#include <QTimer>
+#include <QVector>
+
+//-----------------------------------------------------------------------//
+//  WriteCoalescer::Pimpl                                                //
+//-----------------------------------------------------------------------//
+
+class WriteCoalescer::Pimpl {
+public:
+    struct Entry {
+        Connection* connection = nullptr;
+        qint64 due = 0;
+    };
+public:
+    void flushDue();
+    void arm();
+public:
+    QTimer* m_timer = nullptr;
+    QVector<Entry> m_queue;
+    int m_head = 0;
+};
+
+void WriteCoalescer::Pimpl::flushDue()
+{
+    const qint64 now = Metrics::timestamp();
+    while ( (m_head < m_queue.size()) && (m_queue.at(m_head).due <= now) ) {
+        Connection* connection = m_queue.at(m_head++).connection;
+        if (connection) {
+            connection->flushPending();
+        }
+    }
+    if (m_head == m_queue.size()) {
+        m_queue.clear();
+        m_head = 0;
+    }
+    else if (m_head > m_queue.size() / 2) {
+        // под постоянной нагрузкой очередь не пустеет целиком: выкидываем
+        // отработанное начало, иначе вектор растёт на запись за schedule()
+        m_queue.remove(0, m_head);
+        m_head = 0;
+    }
+    arm();
+}
+
+void WriteCoalescer::Pimpl::arm()
+{
+    if (m_head >= m_queue.size()) {
+        return;
+    }
+    // таймер миллисекундный, округляем вверх, чтобы не проснуться раньше срока
+    const qint64 wait = m_queue.at(m_head).due - Metrics::timestamp();
+    m_timer->start(static_cast<int>(qMax<qint64>((wait + 999) / 1000, 0)));
+}
+
+//-----------------------------------------------------------------------//
+//  WriteCoalescer                                                       //
+//-----------------------------------------------------------------------//
+
+WriteCoalescer::WriteCoalescer(QObject *parent) :
+    QObject(parent)
+{
+    m_d = new Pimpl;
+    m_d->m_timer = new QTimer(this);
+    m_d->m_timer->setSingleShot(true);
+    m_d->m_timer->setTimerType(Qt::PreciseTimer);
+    connect(m_d->m_timer, &QTimer::timeout,
+            this, [this](){
+        m_d->flushDue();
+    });
+}
+
+WriteCoalescer::~WriteCoalescer()
+{
+    delete m_d;
+}
+
+void WriteCoalescer::schedule(Connection *connection, qint64 due)
+{
+    Pimpl::Entry entry;
+    entry.connection = connection;
+    entry.due = due;
+    m_d->m_queue.append(entry);
+    if (!m_d->m_timer->isActive()) {
+        m_d->arm();
+    }
+}
+
+void WriteCoalescer::remove(Connection *connection)
+{
+    for (int i = m_d->m_head; i < m_d->m_queue.size(); ++i) {
+        if (m_d->m_queue.at(i).connection == connection) {
+            m_d->m_queue[i].connection = nullptr;
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <QObject>
+
+class Connection;
+
+//-----------------------------------------------------------------------//
+//  WriteCoalescer                                                       //
+//-----------------------------------------------------------------------//
+
+/*!
+ * Отложенная отправка накопленных кадров для всех соединений воркера одним
+ * таймером. Окно одинаково для всех соединений, поэтому сроки идут по
+ * возрастанию и хватает очереди.
+ */
+class WriteCoalescer : public QObject {
+    Q_OBJECT
+public:
+    explicit WriteCoalescer(QObject *parent = nullptr);
+    ~WriteCoalescer();
+public:
+    void schedule(Connection* connection, qint64 due);
+    void remove(Connection* connection);
+private:
+    class Pimpl;
+    Pimpl* m_d;
+};
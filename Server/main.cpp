@@ -1,14 +1,171 @@
 #include <QCoreApplication>
 #include <QtNetwork>
 #include <QDebug>
+#include <QCommandLineParser>
+#include <QTimer>
+#include <QScopedPointer>
+#include <QStandardPaths>
+#include "FanOutBench.h"
+#include "MetricsServer.h"
 #include "Server.h"
+#include "Worker.h"
 
 int main(int argc, char *argv[])
 {
     QCoreApplication a(argc, argv);
 
-    Server server;
-    if ( !server.listen() ) {
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption portOption(QStringLiteral("port"),
+                                  QObject::tr("Port for clients (0 picks a free one)."),
+                                  QObject::tr("port"), QStringLiteral("0"));
+    QCommandLineOption workersOption(QStringLiteral("workers"),
+                                     QObject::tr("Number of connection worker threads (default: one per core)."),
+                                     QObject::tr("count"), QStringLiteral("0"));
+    QCommandLineOption statsOption(QStringLiteral("stats-interval"),
+                                   QObject::tr("Print worker statistics every <seconds> (0 disables)."),
+                                   QObject::tr("seconds"), QStringLiteral("0"));
+    QCommandLineOption idlePingOption(QStringLiteral("idle-ping"),
+                                      QObject::tr("Ping only connections that have been silent for a ping interval."));
+    QCommandLineOption slowConsumerOption(QStringLiteral("slow-consumer"),
+                                          QObject::tr("What to do with a client whose outbound queue is full: "
+                                                      "disconnect, drop (non-essential frames) or collapse (default)."),
+                                          QObject::tr("policy"), QStringLiteral("collapse"));
+    QCommandLineOption highWatermarkOption(QStringLiteral("queue-high"),
+                                           QObject::tr("Outbound queue size in bytes at which a client counts as slow."),
+                                           QObject::tr("bytes"), QStringLiteral("1048576"));
+    QCommandLineOption lowWatermarkOption(QStringLiteral("queue-low"),
+                                          QObject::tr("Outbound queue size in bytes at which a slow client has caught up."),
+                                          QObject::tr("bytes"), QStringLiteral("262144"));
+    QCommandLineOption historySizeOption(QStringLiteral("history-size"),
+                                         QObject::tr("Number of recent messages sent to a client when it joins."),
+                                         QObject::tr("count"), QStringLiteral("100"));
+    QCommandLineOption logDirOption(QStringLiteral("log-dir"),
+                                    QObject::tr("Directory of the on-disk message log."),
+                                    QObject::tr("path"),
+                                    QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + QStringLiteral("/log"));
+    QCommandLineOption noLogOption(QStringLiteral("no-log"),
+                                   QObject::tr("Keep message history in memory only."));
+    QCommandLineOption logMaxBytesOption(QStringLiteral("log-max-bytes"),
+                                         QObject::tr("Remove the oldest log segments once the log exceeds <bytes> (0 keeps everything)."),
+                                         QObject::tr("bytes"), QStringLiteral("0"));
+    QCommandLineOption logMaxAgeOption(QStringLiteral("log-max-age"),
+                                       QObject::tr("Remove log segments not written for <seconds> (0 keeps everything)."),
+                                       QObject::tr("seconds"), QStringLiteral("0"));
+    QCommandLineOption coalesceWindowOption(QStringLiteral("coalesce-window"),
+                                            QObject::tr("Collect frames that follow a write within <ms> into one write (0 disables)."),
+                                            QObject::tr("ms"), QStringLiteral("0"));
+    QCommandLineOption coalesceBytesOption(QStringLiteral("coalesce-bytes"),
+                                           QObject::tr("Write collected frames at once when they reach <bytes>."),
+                                           QObject::tr("bytes"), QStringLiteral("16384"));
+    QCommandLineOption compressThresholdOption(QStringLiteral("compress-threshold"),
+                                               QObject::tr("Deflate frames of at least <bytes> for clients that support it (0 disables)."),
+                                               QObject::tr("bytes"), QStringLiteral("256"));
+    QCommandLineOption metricsPortOption(QStringLiteral("metrics-port"),
+                                         QObject::tr("Serve Prometheus metrics on localhost:<port> (0 disables)."),
+                                         QObject::tr("port"), QStringLiteral("0"));
+    QCommandLineOption nodeIdOption(QStringLiteral("node-id"),
+                                    QObject::tr("Number of this server in a cluster, unique per cluster (0-1023)."),
+                                    QObject::tr("id"), QStringLiteral("0"));
+    QCommandLineOption clusterPortOption(QStringLiteral("cluster-port"),
+                                         QObject::tr("Accept links from other cluster nodes on <port> (0 disables clustering)."),
+                                         QObject::tr("port"), QStringLiteral("0"));
+    QCommandLineOption clusterAddressOption(QStringLiteral("cluster-address"),
+                                            QObject::tr("Address to accept links from other cluster nodes on."),
+                                            QObject::tr("address"), QHostAddress(QHostAddress::LocalHost).toString());
+    QCommandLineOption clusterSecretOption(QStringLiteral("cluster-secret"),
+                                           QObject::tr("Shared secret every cluster node must know; required with --cluster-port."),
+                                           QObject::tr("secret"));
+    QCommandLineOption peerOption(QStringLiteral("peer"),
+                                  QObject::tr("Cluster port of another node; repeat for every other node."),
+                                  QObject::tr("host:port"));
+    QCommandLineOption benchFanOutOption(QStringLiteral("bench-fanout"),
+                                         QObject::tr("Measure broadcast fan-out to 1k/10k/50k recipients and exit."));
+    QCommandLineOption benchFilterOption(QStringLiteral("bench-filter"),
+                                         QObject::tr("Run only fan-out cases whose name contains <text>."),
+                                         QObject::tr("text"));
+    parser.addOption(portOption);
+    parser.addOption(workersOption);
+    parser.addOption(statsOption);
+    parser.addOption(idlePingOption);
+    parser.addOption(slowConsumerOption);
+    parser.addOption(highWatermarkOption);
+    parser.addOption(lowWatermarkOption);
+    parser.addOption(coalesceWindowOption);
+    parser.addOption(coalesceBytesOption);
+    parser.addOption(compressThresholdOption);
+    parser.addOption(metricsPortOption);
+    parser.addOption(historySizeOption);
+    parser.addOption(logDirOption);
+    parser.addOption(noLogOption);
+    parser.addOption(logMaxBytesOption);
+    parser.addOption(logMaxAgeOption);
+    parser.addOption(nodeIdOption);
+    parser.addOption(clusterPortOption);
+    parser.addOption(clusterAddressOption);
+    parser.addOption(clusterSecretOption);
+    parser.addOption(peerOption);
+    parser.addOption(benchFanOutOption);
+    parser.addOption(benchFilterOption);
+    parser.process(a);
+
+    if (parser.isSet(benchFanOutOption)) {
+        FanOutBench bench(parser.value(workersOption).toInt());
+        bench.setFilter(parser.value(benchFilterOption));
+        return bench.run();
+    }
+
+    const int nodeId = parser.value(nodeIdOption).toInt();
+    const quint16 clusterPort = static_cast<quint16>(parser.value(clusterPortOption).toUInt());
+    if ( (nodeId < 0) || (nodeId > 1023) ) {
+        qDebug() << QObject::tr("The node id must be between 0 and 1023.");
+        return -1;
+    }
+    const QHostAddress clusterAddress(parser.value(clusterAddressOption));
+    const QByteArray clusterSecret = parser.value(clusterSecretOption).toUtf8();
+    if ( clusterPort && clusterAddress.isNull() ) {
+        qDebug() << QObject::tr("Invalid cluster address %1.").arg(parser.value(clusterAddressOption));
+        return -1;
+    }
+    if ( clusterPort && clusterSecret.isEmpty() ) {
+        qDebug() << QObject::tr("A cluster needs a shared secret, set it with --cluster-secret.");
+        return -1;
+    }
+
+    Connection::SlowConsumerPolicy slowConsumerPolicy = Connection::CollapseMissed;
+    if (parser.value(slowConsumerOption) == QLatin1String("disconnect")) {
+        slowConsumerPolicy = Connection::DisconnectSlowConsumer;
+    }
+    else if (parser.value(slowConsumerOption) == QLatin1String("drop")) {
+        slowConsumerPolicy = Connection::DropNonEssential;
+    }
+
+    Server server(parser.value(workersOption).toInt());
+    server.setIdleOnlyPing(parser.isSet(idlePingOption));
+    server.setOutboundPolicy(slowConsumerPolicy,
+                             parser.value(highWatermarkOption).toLongLong(),
+                             parser.value(lowWatermarkOption).toLongLong());
+    server.setWriteCoalescing(parser.value(coalesceWindowOption).toInt(),
+                              parser.value(coalesceBytesOption).toInt());
+    server.setCompressionThreshold(parser.value(compressThresholdOption).toInt());
+    server.setHistoryCapacity(parser.value(historySizeOption).toInt());
+    // узлы на одной машине не должны писать в один журнал
+    QString logDir = parser.value(logDirOption);
+    if ( clusterPort && !parser.isSet(logDirOption) ) {
+        logDir += QStringLiteral("/node%1").arg(nodeId);
+    }
+    if ( !parser.isSet(noLogOption) &&
+         !server.openLog(logDir,
+                         parser.value(logMaxBytesOption).toLongLong(),
+                         parser.value(logMaxAgeOption).toLongLong()) ) {
+        qDebug() << QObject::tr("Unable to open the message log in %1, history is kept in memory only.")
+                    .arg(logDir);
+    }
+    if ( clusterPort && !server.startCluster(nodeId, clusterAddress, clusterPort, clusterSecret, parser.values(peerOption)) ) {
+        qDebug() << QObject::tr("Unable to listen for cluster nodes on %1:%2.").arg(clusterAddress.toString()).arg(clusterPort);
+        return -1;
+    }
+    if ( !server.listen(QHostAddress::Any, static_cast<quint16>(parser.value(portOption).toUInt())) ) {
         qDebug() << QObject::tr("Unable to start the server: %1.").arg(server.errorString());
         return -1;
     }
@@ -29,7 +186,37 @@ int main(int argc, char *argv[])
     qDebug() << QObject::tr("The server is running on");
     qDebug() << QObject::tr("IP: %1").arg(ipAddress);
     qDebug() << QObject::tr("port: %1").arg(server.serverPort());
+    qDebug() << QObject::tr("worker threads: %1").arg(server.workers().size());
+    if (clusterPort) {
+        qDebug() << QObject::tr("cluster node %1, links on port %2").arg(nodeId).arg(clusterPort);
+    }
     qDebug() << QObject::tr("Run the Client now.");
 
+    QScopedPointer<MetricsServer> metricsServer;
+    const quint16 metricsPort = static_cast<quint16>(parser.value(metricsPortOption).toUInt());
+    if (metricsPort) {
+        metricsServer.reset(new MetricsServer(&server));
+        if (metricsServer->listen(QHostAddress::LocalHost, metricsPort)) {
+            qDebug() << QObject::tr("metrics: http://localhost:%1/metrics").arg(metricsServer->serverPort());
+        }
+        else {
+            qDebug() << QObject::tr("Unable to serve metrics: %1.").arg(metricsServer->errorString());
+        }
+    }
+
+    const int statsInterval = parser.value(statsOption).toInt();
+    QTimer statsTimer;
+    if (statsInterval > 0) {
+        QObject::connect(&statsTimer, &QTimer::timeout,
+                         &server, [&server](){
+            for (const Worker* worker : server.workers()) {
+                qDebug() << QObject::tr("worker %1: connections %2, loop lag %3 ms, queued %4 bytes (max %5), dropped %6 frames")
+                            .arg(worker->index()).arg(worker->connectionCount()).arg(worker->loopLag())
+                            .arg(worker->queuedBytes()).arg(worker->maxQueuedBytes()).arg(worker->droppedFrames());
+            }
+        });
+        statsTimer.start(statsInterval * 1000);
+    }
+
     return a.exec();
 }
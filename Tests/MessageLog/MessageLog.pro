@@ -0,0 +1,18 @@
+QT += core testlib
+QT -= gui
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_messagelog
+
+TEMPLATE = app
+
+SOURCES += tst_messagelog.cpp \
+    ../../Server/MessageLog.cpp
+
+HEADERS += ../../Server/MessageLog.h
+
+INCLUDEPATH += ../../Server
+
+DEFINES += QT_DEPRECATED_WARNINGS
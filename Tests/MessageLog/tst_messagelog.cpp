@@ -0,0 +1,102 @@
+#include "MessageLog.h"
+
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+
+static const int RecordCount = 10;
+
+//-----------------------------------------------------------------------//
+//  MessageLogTest                                                       //
+//-----------------------------------------------------------------------//
+
+class MessageLogTest : public QObject {
+    Q_OBJECT
+private slots:
+    void recoverTornTail_data();
+    void recoverTornTail();
+    void readAcrossGap();
+private:
+    static QByteArray payload(int size, quint64 sequence);
+};
+
+QByteArray MessageLogTest::payload(int size, quint64 sequence)
+{
+    QByteArray result = QByteArray::number(sequence);
+    result.append(QByteArray(size, 'x'));
+    return result;
+}
+
+void MessageLogTest::recoverTornTail_data()
+{
+    QTest::addColumn<int>("size");
+    // мелкие записи: оборванная лежит после последнего элемента индекса;
+    // крупные: индексируется каждая, оборвана та, на которую он указывает
+    QTest::newRow("tail after index") << 64;
+    QTest::newRow("indexed record") << 5000;
+}
+
+void MessageLogTest::recoverTornTail()
+{
+    QFETCH(int, size);
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+
+    {
+        MessageLog log;
+        QVERIFY(log.open(directory.path()));
+        for (quint64 sequence = 1; sequence <= RecordCount; ++sequence) {
+            QVERIFY(log.append(sequence, payload(size, sequence)));
+        }
+    }
+
+    // обрываем последнюю запись, как при падении посреди write()
+    const QStringList segments = QDir(directory.path()).entryList(QStringList{ QStringLiteral("*.log") }, QDir::Files);
+    QCOMPARE(segments.size(), 1);
+    QFile segment(QDir(directory.path()).filePath(segments.first()));
+    QVERIFY(segment.resize(segment.size() - 3));
+
+    MessageLog log;
+    QVERIFY(log.open(directory.path()));
+    QCOMPARE(log.nextSequence(), quint64(RecordCount));
+    QVERIFY(!log.append(RecordCount - 1, payload(size, RecordCount - 1)));
+    QVERIFY(log.append(RecordCount, payload(size, RecordCount)));
+    QVERIFY(log.append(RecordCount + 1, payload(size, RecordCount + 1)));
+
+    const QVector<MessageLog::Record> records = log.readBefore(RecordCount + 2, 100);
+    QCOMPARE(records.size(), RecordCount + 1);
+    for (int i = 0; i < records.size(); ++i) {
+        QCOMPARE(records.at(i).sequence, quint64(i + 1));
+        QCOMPARE(records.at(i).payload, payload(size, i + 1));
+    }
+
+    const QVector<MessageLog::Record> page = log.readBefore(RecordCount / 2 + 1, 2);
+    QCOMPARE(page.size(), 2);
+    QCOMPARE(page.at(0).sequence, quint64(RecordCount / 2 - 1));
+    QCOMPARE(page.at(1).sequence, quint64(RecordCount / 2));
+}
+
+void MessageLogTest::readAcrossGap()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+
+    // номера 6 и 7 пропущены, как после неудачной записи
+    MessageLog log;
+    QVERIFY(log.open(directory.path()));
+    for (quint64 sequence : { 1, 2, 3, 4, 5, 8, 9, 10 }) {
+        QVERIFY(log.append(sequence, payload(16, sequence)));
+    }
+
+    const QVector<MessageLog::Record> page = log.readBefore(11, 5);
+    QCOMPARE(page.size(), 5);
+    const quint64 expected[] = { 4, 5, 8, 9, 10 };
+    for (int i = 0; i < page.size(); ++i) {
+        QCOMPARE(page.at(i).sequence, expected[i]);
+    }
+}
+
+QTEST_GUILESS_MAIN(MessageLogTest)
+
+#include "tst_messagelog.moc"